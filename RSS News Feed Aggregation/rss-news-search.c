@@ -11,6 +11,7 @@
 #include "urlconnection.h"
 #include "streamtokenizer.h"
 #include "html-utils.h"
+#include "hashing.h"
 
 #define min(x, y) ((x) < (y) ? (x) : (y))
 
@@ -19,7 +20,6 @@ static const char * const filePrefix = "file://";
 static const char * const kDefaultFeedsFile = "data/test.txt";
 static const char * const kDefaultStopWordsFile = "data/stop-words.txt";
 
-static const signed long kHashMultiplier = -1664117991L;
 static const int kStopWordsNumBuckets = 1009;
 
 typedef struct
@@ -69,6 +69,7 @@ void article_free_fn(void * art_ptr);
 void load_stop_words(hashset * stop_words, const char * kStopWordsFile);
 static int vector_sort_fn(const void * var1, const void * var2);
 void print_result(vector * articles);
+static void print_hashset_stats(const char * name, hashset * h, HashSetHashFunction hash_fn);
 
 static const char * const kTextDelimiters = " \t\n\r\b!@$%^*()_+={[}]|\\'\":;/?.>,<~`";
 
@@ -87,10 +88,23 @@ static const char * const kTextDelimiters = " \t\n\r\b!@$%^*()_+={[}]|\\'\":;/?.
  * all the previously seen articles, and how you're going to
  * map words to the collection of news articles where that
  * word appears.
+ *
+ *     ./rss-news-search [--stats] [feeds file]
+ *
+ * With --stats, how the stop words and the indexed words
+ * spread over their buckets is reported before the first
+ * query (see print_hashset_stats).
  */
 
 int main(int argc, char ** argv)
 {
+	bool print_stats = (argc > 1 && strcmp(argv[1], "--stats") == 0);
+	if (print_stats)
+	{
+		argc--;
+		argv++;
+	}
+
 	hashset stop_words;
 	HashSetNew(&stop_words, sizeof(char **), kStopWordsNumBuckets, stop_word_hash_fn, stop_word_cmp_fn, stop_word_free_fn);
 
@@ -102,6 +116,11 @@ int main(int argc, char ** argv)
 	load_stop_words(&stop_words, kDefaultStopWordsFile);
 
 	BuildIndices((argc == 1) ? kDefaultFeedsFile : argv[1], &stop_words, &rss_words_hashset);
+	if (print_stats)
+	{
+		print_hashset_stats("stop words", &stop_words, stop_word_hash_fn);
+		print_hashset_stats("indexed words", &rss_words_hashset, rss_word_hash_fn);
+	}
 	QueryIndices(&stop_words, &rss_words_hashset);
 
 	HashSetDispose(&stop_words);
@@ -666,27 +685,17 @@ void print_result(vector * articles)
 /**
  * StringHash
  * ----------
- * This function adapted from Eric Roberts' "The Art and Science of C"
- * It takes a string and uses it to derive a hash code, which
- * is an integer in the range [0, numBuckets).  The hash code is computed
- * using a method called "linear congruence."  A similar function using this
- * method is described on page 144 of Kernighan and Ritchie.  The choice of
- * the value for the kHashMultiplier can have a significant effect on the
- * performance of the algorithm, but not on its correctness.
- * This hash function has the additional feature of being case-insensitive,
- * hashing "Peter Pawlowski" and "PETER PAWLOWSKI" to the same code.
+ * Hashes a word with HashStringCaseFold, which takes it eight characters
+ * at a time and lowers them as it goes, hashing "Peter Pawlowski" and
+ * "PETER PAWLOWSKI" to the same code to match the strcasecmp comparisons.
+ * The seed is drawn at random each run, so a feed can't be written to pile
+ * its words into a few of our fixed number of buckets.
  */
 
 static int stop_word_hash_fn(const void * void_s, int num_buckets)
 {
-	int i;
-	unsigned long hashcode = 0;
 	const char * s = *(const char **)void_s;
-
-	for (i = 0; i < strlen(s); i++)
-		hashcode = hashcode * kHashMultiplier + tolower(s[i]);
-
-	return hashcode % num_buckets;
+	return HashStringCaseFold(s, HashSeed()) % num_buckets;
 }
 
 int stop_word_cmp_fn(const void * str1, const void * str2)
@@ -756,3 +765,60 @@ static int vector_sort_fn(const void * var1, const void * var2)
         return 1;
     return 0;
 }
+
+typedef struct
+{
+	HashSetHashFunction hash_fn;
+	int * chain_lens;
+} chain_counter;
+
+static void count_chain_fn(void * elem, void * aux_data)
+{
+	chain_counter * counter = (chain_counter *)aux_data;
+	counter->chain_lens[counter->hash_fn(elem, kStopWordsNumBuckets)]++;
+}
+
+/**
+ * Function: print_hashset_stats
+ * -----------------------------
+ * Reports how the elements of a hashset of kStopWordsNumBuckets buckets
+ * spread over them: how many buckets are used, the longest chain, a
+ * histogram of chain lengths (the last entry counting all longer ones),
+ * and what that costs lookups.  The hashset in librssnews doesn't keep
+ * statistics of its own, so the chains are counted here, by hashing
+ * every element again with the hash function the hashset was built
+ * with.  A bucket is searched from the front, so a lookup that finds an
+ * element in a chain of c compares (c + 1) / 2 times on average, and
+ * one that misses compares c times.
+ */
+
+enum { kStatsHistogramSize = 8 };
+static void print_hashset_stats(const char * name, hashset * h, HashSetHashFunction hash_fn)
+{
+	chain_counter counter = { hash_fn, calloc(kStopWordsNumBuckets, sizeof(int)) };
+	assert(counter.chain_lens != NULL);
+	HashSetMap(h, count_chain_fn, &counter);
+
+	int histogram[kStatsHistogramSize] = { 0 };
+	int used_buckets = 0, longest_chain = 0;
+	double hit_compares = 0;
+	for (int i = 0; i < kStopWordsNumBuckets; i++)
+	{
+		int chain_len = counter.chain_lens[i];
+		histogram[min(chain_len, kStatsHistogramSize - 1)]++;
+		if (chain_len > 0) used_buckets++;
+		if (chain_len > longest_chain) longest_chain = chain_len;
+		hit_compares += chain_len * (chain_len + 1) / 2.0;
+	}
+	free(counter.chain_lens);
+
+	int count = HashSetCount(h);
+	printf("%s: %d in %d buckets, %d used, longest chain %d.\n", name, count, kStopWordsNumBuckets,
+		used_buckets, longest_chain);
+	printf("    comparisons per lookup: %.2f when found, %.2f when not.\n",
+		(count > 0) ? hit_compares / count : 0.0, (double)count / kStopWordsNumBuckets);
+	printf("    buckets by chain length:");
+	for (int k = 0; k < kStatsHistogramSize; k++)
+		if (histogram[k] != 0) printf(" %d%s: %d", k, (k == kStatsHistogramSize - 1) ? "+" : "", histogram[k]);
+	printf("\n");
+}
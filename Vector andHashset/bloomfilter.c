@@ -0,0 +1,70 @@
+#include "bloomfilter.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t kBlockBytes = kBloomFilterBlockWords * sizeof(uint64_t);
+
+/* The finalizer of splitmix64.  Client hash codes can be weak in their
+	low or high bits, so the filter only ever uses them mixed. */
+static uint64_t Mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/* The top 32 bits of the mixed code pick the block, with a multiply rather
+	than a division, and the bottom 48 bits pick one bit in each word. */
+static uint64_t * BlockFor(const bloomfilter * bf, uint64_t mixed)
+{
+	size_t block_pos = ((mixed >> 32) * (uint64_t)bf->blocks_num) >> 32;
+	return bf->blocks + block_pos * kBloomFilterBlockWords;
+}
+
+static uint64_t WordBit(uint64_t mixed, int word)
+{
+	return 1ULL << ((mixed >> (6 * word)) & 63);
+}
+
+void BloomFilterNew(bloomfilter * bf, int numCodes, int bitsPerCode)
+{
+	// Check all assert conditions
+	assert (numCodes >= 0);
+	assert (bitsPerCode > 0);
+	// Asserts checked
+
+	size_t num_bits = (size_t)numCodes * bitsPerCode;
+	bf->blocks_num = (num_bits + kBlockBytes * 8 - 1) / (kBlockBytes * 8);
+	if (bf->blocks_num == 0) bf->blocks_num = 1;
+
+	// Blocks are aligned to cache lines, so each lookup touches just one
+	int err = posix_memalign((void **)&bf->blocks, kBlockBytes, bf->blocks_num * kBlockBytes);
+	assert(err == 0);
+	memset(bf->blocks, 0, bf->blocks_num * kBlockBytes);
+}
+
+void BloomFilterDispose(bloomfilter * bf)
+{
+	free(bf->blocks);
+}
+
+void BloomFilterAdd(bloomfilter * bf, uint64_t hash)
+{
+	uint64_t mixed = Mix(hash);
+	uint64_t * block = BlockFor(bf, mixed);
+	for (int i = 0; i < kBloomFilterBlockWords; i++)
+		block[i] |= WordBit(mixed, i);
+}
+
+bool BloomFilterMayContain(const bloomfilter * bf, uint64_t hash)
+{
+	uint64_t mixed = Mix(hash);
+	const uint64_t * block = BlockFor(bf, mixed);
+	uint64_t missing = 0;
+	for (int i = 0; i < kBloomFilterBlockWords; i++)
+		missing |= WordBit(mixed, i) & ~block[i];
+	return missing == 0;
+}
@@ -0,0 +1,75 @@
+#ifndef _bloomfilter_
+#define _bloomfilter_
+#include "bool.h"
+#include <stdint.h>
+
+/* File: bloomfilter.h
+ * --------------------
+ * Defines the interface for the blocked Bloom filter, a compact summary
+ * of a set of 64-bit hash codes that can say for certain that a code was
+ * never added, and otherwise says it may have been.  The hashset keeps
+ * one in front of its table on request (see HashSetSetBloomFilter), so
+ * that most lookups for absent elements never reach the table at all.
+ *
+ * The filter is split into 64-byte blocks, one cache line each.  Every
+ * code belongs to a single block and sets one bit in each of the block's
+ * eight 64-bit words, so adding or testing a code touches one cache line
+ * and takes no branches.
+ */
+
+/**
+ * Type: bloomfilter
+ * -----------------
+ * The concrete representation of the blocked Bloom filter.  Clients
+ * should interact with it only through the functions below.
+ */
+
+enum { kBloomFilterBlockWords = 8 };
+
+typedef struct
+{
+  uint64_t * blocks;
+  int blocks_num;
+} bloomfilter;
+
+/**
+ * Function: BloomFilterNew
+ * ------------------------
+ * Initializes the identified filter to be empty, with room for about
+ * numCodes codes at bitsPerCode bits apiece.  At 8 bits per code about
+ * 3% of the codes never added are let through, at 10 bits 1%, and at
+ * 16 bits 0.1%.
+ *
+ * An assert is raised if numCodes is negative or bitsPerCode isn't
+ * positive.
+ */
+
+void BloomFilterNew(bloomfilter *bf, int numCodes, int bitsPerCode);
+
+/**
+ * Function: BloomFilterDispose
+ * ----------------------------
+ * Disposes of the memory the filter holds.
+ */
+
+void BloomFilterDispose(bloomfilter *bf);
+
+/**
+ * Function: BloomFilterAdd
+ * ------------------------
+ * Adds the specified hash code to the filter.  Codes can't be taken
+ * back out: a filter whose set shrinks has to be built again.
+ */
+
+void BloomFilterAdd(bloomfilter *bf, uint64_t hash);
+
+/**
+ * Function: BloomFilterMayContain
+ * -------------------------------
+ * Returns false if the specified hash code has certainly never been
+ * added to the filter, and true if it may have been.
+ */
+
+bool BloomFilterMayContain(const bloomfilter *bf, uint64_t hash);
+
+#endif
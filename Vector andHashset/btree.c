@@ -0,0 +1,301 @@
+#include "btree.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A node is a header, then room for max_elems elements in order, then (in
+	internal nodes only) max_elems + 1 child pointers, child i holding the
+	elements that come between elements i - 1 and i.  The elements start
+	16 bytes in, so they're as aligned as malloc's own blocks. */
+typedef struct
+{
+	int count;
+	bool leaf;
+} BTreeNode;
+
+static const int kNodeBytes = 512;
+static const int kElemsOffset = 16;
+
+static void * NodeElem(const btree * t, const BTreeNode * node, int pos)
+{
+	return (char *)node + kElemsOffset + (size_t)pos * t->elem_size;
+}
+
+/* Where the child pointers start, which is also the size of a leaf. */
+static size_t ChildrenOffset(const btree * t)
+{
+	size_t offset = kElemsOffset + (size_t)t->max_elems * t->elem_size;
+	return (offset + sizeof(BTreeNode *) - 1) / sizeof(BTreeNode *) * sizeof(BTreeNode *);
+}
+
+static BTreeNode ** NodeChildren(const btree * t, const BTreeNode * node)
+{
+	return (BTreeNode **)((char *)node + ChildrenOffset(t));
+}
+
+static BTreeNode * NodeNew(const btree * t, bool leaf)
+{
+	size_t size = ChildrenOffset(t);
+	if (!leaf) size += (t->max_elems + 1) * sizeof(BTreeNode *);
+	BTreeNode * node = malloc(size);
+	assert(node != NULL);
+	node->count = 0;
+	node->leaf = leaf;
+	return node;
+}
+
+static void NodeDispose(btree * t, BTreeNode * node)
+{
+	if (!node->leaf)
+	{
+		for (int i = 0; i <= node->count; i++)
+			NodeDispose(t, NodeChildren(t, node)[i]);
+	}
+	if (t->freeFn != NULL)
+	{
+		for (int i = 0; i < node->count; i++)
+			t->freeFn(NodeElem(t, node, i));
+	}
+	free(node);
+}
+
+/* The position of the first element in the node that doesn't come before
+	keyAddr, found by binary search. */
+static int NodeLowerBound(const btree * t, const BTreeNode * node, const void * keyAddr)
+{
+	int low = 0, high = node->count;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (t->cmpFn(NodeElem(t, node, mid), keyAddr) < 0) low = mid + 1;
+			else high = mid;
+	}
+	return low;
+}
+
+/* Splits the full child at pos around its middle element, which moves up
+	into the parent between the two halves. */
+static void NodeSplitChild(btree * t, BTreeNode * parent, int pos)
+{
+	BTreeNode ** children = NodeChildren(t, parent);
+	BTreeNode * left = children[pos];
+	int half = t->max_elems / 2;
+	BTreeNode * right = NodeNew(t, left->leaf);
+
+	right->count = half;
+	memcpy(NodeElem(t, right, 0), NodeElem(t, left, half + 1), (size_t)half * t->elem_size);
+	if (!left->leaf)
+		memcpy(NodeChildren(t, right), NodeChildren(t, left) + half + 1, (half + 1) * sizeof(BTreeNode *));
+	left->count = half;
+
+	memmove(children + pos + 2, children + pos + 1, (parent->count - pos) * sizeof(BTreeNode *));
+	memmove(NodeElem(t, parent, pos + 1), NodeElem(t, parent, pos), (size_t)(parent->count - pos) * t->elem_size);
+	memcpy(NodeElem(t, parent, pos), NodeElem(t, left, half), t->elem_size);
+	children[pos + 1] = right;
+	parent->count++;
+}
+
+static void ReplaceElem(btree * t, void * elem, const void * elemAddr)
+{
+	if (t->freeFn != NULL) t->freeFn(elem);
+	memcpy(elem, elemAddr, t->elem_size);
+}
+
+void BTreeNew(btree * t, int elemSize, BTreeCompareFunction comparefn, BTreeFreeFunction freefn)
+{
+	// Check all assert conditions
+	assert (elemSize > 0);
+	assert (comparefn != NULL);
+	// Asserts checked
+
+	t->log_len = 0;
+	t->elem_size = elemSize;
+	t->cmpFn = comparefn;
+	t->freeFn = freefn;
+
+	// As many elements as fill a node, but an odd number and at least three, so nodes split evenly
+	t->max_elems = (kNodeBytes - kElemsOffset) / elemSize;
+	if (t->max_elems < 3) t->max_elems = 3;
+	if (t->max_elems % 2 == 0) t->max_elems--;
+
+	t->root = NodeNew(t, true);
+	t->height = 1;
+}
+
+void BTreeDispose(btree * t)
+{
+	NodeDispose(t, t->root);
+}
+
+int BTreeCount(const btree * t)
+{
+	return t->log_len;
+}
+
+/* Full nodes are split on the way down, before the search reaches them, so
+	there's always room in a node for the element its split child sends up,
+	and the element itself always goes into a leaf with room to spare. */
+void BTreeEnter(btree * t, const void * elemAddr)
+{
+	assert(elemAddr != NULL);
+
+	BTreeNode * node = t->root;
+	if (node->count == t->max_elems)
+	{
+		assert(t->height < kBTreeMaxHeight);
+		BTreeNode * root = NodeNew(t, false);
+		NodeChildren(t, root)[0] = node;
+		NodeSplitChild(t, root, 0);
+		t->root = node = root;
+		t->height++;
+	}
+
+	while (true)
+	{
+		int pos = NodeLowerBound(t, node, elemAddr);
+		if (pos < node->count && t->cmpFn(elemAddr, NodeElem(t, node, pos)) == 0)
+		{
+			ReplaceElem(t, NodeElem(t, node, pos), elemAddr);
+			return;
+		}
+
+		if (node->leaf)
+		{
+			memmove(NodeElem(t, node, pos + 1), NodeElem(t, node, pos), (size_t)(node->count - pos) * t->elem_size);
+			memcpy(NodeElem(t, node, pos), elemAddr, t->elem_size);
+			node->count++;
+			t->log_len++;
+			return;
+		}
+
+		if (NodeChildren(t, node)[pos]->count == t->max_elems)
+		{
+			NodeSplitChild(t, node, pos);
+			int cmp = t->cmpFn(elemAddr, NodeElem(t, node, pos));
+			if (cmp == 0)
+			{
+				ReplaceElem(t, NodeElem(t, node, pos), elemAddr);
+				return;
+			}
+			if (cmp > 0) pos++;
+		}
+		node = NodeChildren(t, node)[pos];
+	}
+}
+
+void * BTreeLookup(const btree * t, const void * elemAddr)
+{
+	assert(elemAddr != NULL);
+
+	const BTreeNode * node = t->root;
+	while (true)
+	{
+		int pos = NodeLowerBound(t, node, elemAddr);
+		if (pos < node->count && t->cmpFn(elemAddr, NodeElem(t, node, pos)) == 0) return NodeElem(t, node, pos);
+		if (node->leaf) return NULL;
+		node = NodeChildren(t, node)[pos];
+	}
+}
+
+static void NodeMap(btree * t, BTreeNode * node, BTreeMapFunction mapfn, void * auxData)
+{
+	for (int i = 0; i < node->count; i++)
+	{
+		if (!node->leaf) NodeMap(t, NodeChildren(t, node)[i], mapfn, auxData);
+		mapfn(NodeElem(t, node, i), auxData);
+	}
+	if (!node->leaf) NodeMap(t, NodeChildren(t, node)[node->count], mapfn, auxData);
+}
+
+void BTreeMap(btree * t, BTreeMapFunction mapfn, void * auxData)
+{
+	assert(mapfn != NULL);
+	NodeMap(t, t->root, mapfn, auxData);
+}
+
+void BTreeMapRange(btree * t, const void * keyAddr, BTreeCompareFunction rangecmpfn,
+		BTreeMapFunction mapfn, void * auxData)
+{
+	// Check all assert conditions
+	assert(keyAddr != NULL);
+	assert(rangecmpfn != NULL);
+	assert(mapfn != NULL);
+	// Asserts checked
+
+	btreecursor c;
+	BTreeLowerBound(t, keyAddr, &c);
+	for (void * elem = BTreeCursorElem(&c); elem != NULL && rangecmpfn(keyAddr, elem) == 0; elem = BTreeCursorNext(&c))
+		mapfn(elem, auxData);
+}
+
+/* The cursor's path runs from the root (at depth 0) to the node at the top,
+	where the cursor is at the element at that node's position.  Every node
+	below the top is at the position of the child the path goes on into, and
+	the element at that position is the one to visit once the child is done. */
+static void CursorPush(btreecursor * c, const BTreeNode * node, int pos)
+{
+	c->depth++;
+	assert(c->depth < kBTreeMaxHeight);
+	c->nodes[c->depth] = (void *)node;
+	c->positions[c->depth] = pos;
+}
+
+static void CursorPushLeftmost(btreecursor * c, const BTreeNode * node)
+{
+	CursorPush(c, node, 0);
+	while (!node->leaf)
+	{
+		node = NodeChildren(c->tree, node)[0];
+		CursorPush(c, node, 0);
+	}
+}
+
+/* Climbs out of nodes the cursor has gone past the last element of, up to
+	the first one with an element left, or off the top of the tree. */
+static void CursorSkipFinished(btreecursor * c)
+{
+	while (c->depth >= 0 && c->positions[c->depth] == ((const BTreeNode *)c->nodes[c->depth])->count)
+		c->depth--;
+}
+
+void BTreeFirst(const btree * t, btreecursor * c)
+{
+	c->tree = t;
+	c->depth = -1;
+	CursorPushLeftmost(c, t->root);
+	CursorSkipFinished(c);
+}
+
+void BTreeLowerBound(const btree * t, const void * keyAddr, btreecursor * c)
+{
+	assert(keyAddr != NULL);
+
+	c->tree = t;
+	c->depth = -1;
+	const BTreeNode * node = t->root;
+	while (true)
+	{
+		int pos = NodeLowerBound(t, node, keyAddr);
+		CursorPush(c, node, pos);
+		if (node->leaf || (pos < node->count && t->cmpFn(NodeElem(t, node, pos), keyAddr) == 0)) break;
+		node = NodeChildren(t, node)[pos];
+	}
+	CursorSkipFinished(c);
+}
+
+void * BTreeCursorElem(const btreecursor * c)
+{
+	if (c->depth < 0) return NULL;
+	return NodeElem(c->tree, c->nodes[c->depth], c->positions[c->depth]);
+}
+
+void * BTreeCursorNext(btreecursor * c)
+{
+	assert(c->depth >= 0);
+
+	const BTreeNode * node = c->nodes[c->depth];
+	int pos = c->positions[c->depth]++;
+	if (!node->leaf) CursorPushLeftmost(c, NodeChildren(c->tree, node)[pos + 1]);
+	CursorSkipFinished(c);
+	return BTreeCursorElem(c);
+}
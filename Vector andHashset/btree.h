@@ -0,0 +1,219 @@
+#ifndef _btree_
+#define _btree_
+#include "bool.h"
+
+/* File: btree.h
+ * --------------
+ * Defines the interface for the btree, an ordered set of elements of any
+ * one size, for the questions a hashset can't answer without visiting
+ * every element: which elements come first, which is the first at or
+ * after some key, and which begin with some prefix.
+ *
+ * The btree is a B-tree of wide nodes of about 512 bytes each, which
+ * keep their elements inline (copied in, just as the vector and the
+ * hashset copy theirs) in sorted order.  A search reads a handful of
+ * nodes, one per level, rather than one element per level as a binary
+ * tree would, and a scan reads elements that sit side by side in memory.
+ */
+
+/**
+ * Type: BTreeCompareFunction
+ * --------------------------
+ * Class of function used to order the elements of a btree, each
+ * identified by address, with the same convention as strcmp: a negative
+ * return value means the element addressed by elemAddr1 comes before the
+ * one addressed by elemAddr2, zero means they're equal, and a positive
+ * value means it comes after.
+ */
+
+typedef int (*BTreeCompareFunction)(const void *elemAddr1, const void *elemAddr2);
+
+/**
+ * Type: BTreeMapFunction
+ * ----------------------
+ * Class of function that can be mapped over the elements of a btree, in
+ * order.  Map functions accept a pointer to a client element and the
+ * auxiliary data passed in to BTreeMap or BTreeMapRange.
+ */
+
+typedef void (*BTreeMapFunction)(void *elemAddr, void *auxData);
+
+/**
+ * Type: BTreeFreeFunction
+ * -----------------------
+ * Class of function designed to dispose of and/or clean up any resources
+ * embedded within the element at the specified address, when the element
+ * is replaced or the btree is disposed of.
+ */
+
+typedef void (*BTreeFreeFunction)(void *elemAddr);
+
+/**
+ * Type: btree
+ * -----------
+ * The concrete representation of the btree.  In spite of all of the
+ * fields being publicly accessible, the client is absolutely required
+ * to initialize, dispose of, and otherwise interact with all btree
+ * instances via the suite of the btree-related functions described below.
+ */
+
+typedef struct
+{
+  void * root;
+  int log_len;
+  int elem_size;
+  int max_elems;
+  int height;
+
+  void (*freeFn)(void *);
+  int (*cmpFn)(const void *, const void *);
+} btree;
+
+/**
+ * Type: btreecursor
+ * -----------------
+ * A position in a btree, between its first element and just past its
+ * last, for walking its elements in order.  The cursor holds the path
+ * from the root down to the node of the element it's at.  Entering a new
+ * element invalidates every cursor on the btree; replacing an element
+ * doesn't.
+ */
+
+enum { kBTreeMaxHeight = 32 };
+
+typedef struct
+{
+  void * nodes[kBTreeMaxHeight];
+  int positions[kBTreeMaxHeight];
+  int depth;
+  const btree * tree;
+} btreecursor;
+
+/**
+ * Function: BTreeNew
+ * ------------------
+ * Initializes the identified btree to be empty.  elemSize is the size of
+ * the elements, comparefn is the function that orders them, and freefn
+ * (which may be NULL) disposes of an element's resources.
+ *
+ * An assert is raised if elemSize isn't positive or comparefn is NULL.
+ */
+
+void BTreeNew(btree *t, int elemSize, BTreeCompareFunction comparefn, BTreeFreeFunction freefn);
+
+/**
+ * Function: BTreeDispose
+ * ----------------------
+ * Disposes of all the resources acquired by the btree, calling the free
+ * function (if there is one) on every element.
+ */
+
+void BTreeDispose(btree *t);
+
+/**
+ * Function: BTreeCount
+ * --------------------
+ * Returns the number of elements in the specified btree.
+ */
+
+int BTreeCount(const btree *t);
+
+/**
+ * Function: BTreeEnter
+ * --------------------
+ * Inserts a copy of the specified element into the btree, in its place
+ * in order.  If an equal element (as far as the compare function is
+ * concerned) is already there, it's freed and replaced with the new one,
+ * and the count stays the same.  Takes time proportional to the log of
+ * the number of elements.
+ *
+ * An assert is raised if elemAddr is NULL.
+ */
+
+void BTreeEnter(btree *t, const void *elemAddr);
+
+/**
+ * Function: BTreeLookup
+ * ---------------------
+ * Returns a pointer to the element equal to the specified one, or NULL
+ * if there is none.  The pointer stays good until the next BTreeEnter.
+ *
+ * An assert is raised if elemAddr is NULL.
+ */
+
+void *BTreeLookup(const btree *t, const void *elemAddr);
+
+/**
+ * Function: BTreeMap
+ * ------------------
+ * Applies mapfn to every element of the btree, in order, passing auxData
+ * along to each call.  mapfn mustn't change the elements in any way that
+ * would change their order.
+ *
+ * An assert is raised if the mapping routine is NULL.
+ */
+
+void BTreeMap(btree *t, BTreeMapFunction mapfn, void *auxData);
+
+/**
+ * Function: BTreeMapRange
+ * -----------------------
+ * Applies mapfn, in order, to every element from the first one at or
+ * after keyAddr onwards, for as long as rangecmpfn(keyAddr, elemAddr)
+ * returns 0.  The elements rangecmpfn accepts have to come one after
+ * another in the btree's order, starting at keyAddr's place.  With
+ * elements that are C strings and a rangecmpfn that compares the first
+ * strlen(key) characters, say, this maps over every string beginning
+ * with the key.
+ *
+ * An assert is raised if keyAddr, rangecmpfn or mapfn is NULL.
+ */
+
+void BTreeMapRange(btree *t, const void *keyAddr, BTreeCompareFunction rangecmpfn,
+		   BTreeMapFunction mapfn, void *auxData);
+
+/**
+ * Function: BTreeFirst
+ * --------------------
+ * Sets up the cursor at the first element of the btree, or just past
+ * the end if the btree is empty.
+ */
+
+void BTreeFirst(const btree *t, btreecursor *c);
+
+/**
+ * Function: BTreeLowerBound
+ * -------------------------
+ * Sets up the cursor at the first element of the btree that doesn't come
+ * before keyAddr (an element equal to it, if there is one), or just past
+ * the end if every element comes before it.
+ *
+ * An assert is raised if keyAddr is NULL.
+ */
+
+void BTreeLowerBound(const btree *t, const void *keyAddr, btreecursor *c);
+
+/**
+ * Function: BTreeCursorElem
+ * -------------------------
+ * Returns a pointer to the element the cursor is at, or NULL if it's
+ * past the end.
+ */
+
+void *BTreeCursorElem(const btreecursor *c);
+
+/**
+ * Function: BTreeCursorNext
+ * -------------------------
+ * Moves the cursor on to the next element in order and returns a pointer
+ * to it, or NULL once the cursor has moved past the end.  A typical walk
+ * looks like this:
+ *
+ *     for (void *elem = BTreeCursorElem(&c); elem != NULL; elem = BTreeCursorNext(&c))
+ *
+ * An assert is raised if the cursor is already past the end.
+ */
+
+void *BTreeCursorNext(btreecursor *c);
+
+#endif
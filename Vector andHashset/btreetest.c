@@ -0,0 +1,218 @@
+#include "btree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Function: CompareInt
+ * --------------------
+ * Orders ints the usual way.
+ */
+
+static int CompareInt(const void *elem1, const void *elem2)
+{
+  int a = *(const int *) elem1, b = *(const int *) elem2;
+  return (a > b) - (a < b);
+}
+
+/**
+ * Function: CheckNextInt
+ * ----------------------
+ * Mapping function that checks the ints it's handed come in the order
+ * the int at auxData predicts (counting up by two), and moves the
+ * prediction along.
+ */
+
+static void CheckNextInt(void *elem, void *auxData)
+{
+  int *expected = auxData;
+  assert(*(int *) elem == *expected);
+  *expected += 2;
+}
+
+/**
+ * Function: TestOrderedInts
+ * -------------------------
+ * Enters the even ints below a limit in a scrambled order (the first
+ * few thousand of them twice), then checks the count, that BTreeMap and
+ * a cursor both visit them in order, that lookups find exactly the even
+ * ints, and that BTreeLowerBound puts an odd int's cursor at the even
+ * int after it and puts the cursor past the end for anything too big.
+ */
+
+static const int kNumOrderedInts = 200000;
+static const int kScramblingPrime = 7919;
+static void TestOrderedInts(void)
+{
+  btree ints;
+  btreecursor c;
+
+  fprintf(stdout, "\n\n ------------------------- Starting the ordered ints test\n");
+  BTreeNew(&ints, sizeof(int), CompareInt, NULL);
+  BTreeFirst(&ints, &c);
+  assert(BTreeCursorElem(&c) == NULL);
+
+  for (int i = 0; i < kNumOrderedInts / 2; i++) {
+    int even = 2 * (int) ((long) i * kScramblingPrime % (kNumOrderedInts / 2));
+    BTreeEnter(&ints, &even);
+  }
+  for (int even = 0; even < kNumOrderedInts / 20; even += 2)
+    BTreeEnter(&ints, &even);
+  assert(BTreeCount(&ints) == kNumOrderedInts / 2);
+
+  int expected = 0;
+  BTreeMap(&ints, CheckNextInt, &expected);
+  assert(expected == kNumOrderedInts);
+
+  expected = 0;
+  BTreeFirst(&ints, &c);
+  for (int *elem = BTreeCursorElem(&c); elem != NULL; elem = BTreeCursorNext(&c))
+    CheckNextInt(elem, &expected);
+  assert(expected == kNumOrderedInts);
+
+  for (int i = 0; i < kNumOrderedInts; i++) {
+    int *found = BTreeLookup(&ints, &i);
+    assert(i % 2 == 0 ? found != NULL && *found == i : found == NULL);
+    BTreeLowerBound(&ints, &i, &c);
+    int *bound = BTreeCursorElem(&c);
+    assert(i == kNumOrderedInts - 1 ? bound == NULL : *bound == i + i % 2);
+  }
+  int tooBig = kNumOrderedInts;
+  BTreeLowerBound(&ints, &tooBig, &c);
+  assert(BTreeCursorElem(&c) == NULL);
+
+  fprintf(stdout, "Entered %d ints into a btree of height %d, and found them all in order.\n",
+	  BTreeCount(&ints), ints.height);
+  BTreeDispose(&ints);
+}
+
+/**
+ * Function: CompareString, ComparePrefix, FreeString, CountString
+ * ---------------------------------------------------------------
+ * Helpers for btrees of dynamically allocated C strings.  ComparePrefix
+ * only compares as much of the element as the key has, so it accepts
+ * every string that begins with the key, and CountString checks that the
+ * strings it's mapped over come in increasing order while counting them.
+ */
+
+static int CompareString(const void *elem1, const void *elem2)
+{
+  return strcmp(*(char **) elem1, *(char **) elem2);
+}
+
+static int ComparePrefix(const void *key, const void *elem)
+{
+  const char *prefix = *(char **) key;
+  return strncmp(prefix, *(char **) elem, strlen(prefix));
+}
+
+static void FreeString(void *elem)
+{
+  free(*(char **) elem);
+}
+
+struct stringCount {
+  const char *last;
+  int count;
+};
+
+static void CountString(void *elem, void *auxData)
+{
+  struct stringCount *counted = auxData;
+  const char *s = *(char **) elem;
+  assert(counted->last == NULL || strcmp(counted->last, s) < 0);
+  counted->last = s;
+  counted->count++;
+}
+
+/**
+ * Function: TestPrefixScan
+ * ------------------------
+ * Fills a btree with numbered words, enters some of them a second
+ * time (the second copy replacing, and freeing, the first), and then
+ * counts the words with various prefixes with BTreeMapRange, which
+ * should visit them in order and stop at the first word without the
+ * prefix.
+ */
+
+static const int kNumWords = 30000;
+static void TestPrefixScan(void)
+{
+  btree words;
+  char buffer[32];
+
+  fprintf(stdout, "\n\n ------------------------- Starting the prefix scan test\n");
+  BTreeNew(&words, sizeof(char *), CompareString, FreeString);
+  for (int i = 0; i < kNumWords; i++) {
+    sprintf(buffer, "word%05d", (int) ((long) i * kScramblingPrime % kNumWords));
+    char *word = strdup(buffer);
+    BTreeEnter(&words, &word);
+  }
+  for (int i = 0; i < kNumWords; i += 3) {
+    sprintf(buffer, "word%05d", i);
+    char *word = strdup(buffer);
+    BTreeEnter(&words, &word);
+    assert(*(char **) BTreeLookup(&words, &word) == word);
+  }
+  assert(BTreeCount(&words) == kNumWords);
+
+  const char *const kPrefixes[] = { "word0123", "word012", "word2", "word", "wore", "a", "word29999", "word3" };
+  const int kPrefixCounts[] = { 10, 100, 10000, kNumWords, 0, 0, 1, 0 };
+  for (int i = 0; i < sizeof(kPrefixes) / sizeof(kPrefixes[0]); i++) {
+    struct stringCount counted = { NULL, 0 };
+    BTreeMapRange(&words, &kPrefixes[i], ComparePrefix, CountString, &counted);
+    assert(counted.count == kPrefixCounts[i]);
+    fprintf(stdout, "%d word%s begin%s with \"%s\".\n", counted.count, counted.count == 1 ? "" : "s",
+	    counted.count == 1 ? "s" : "", kPrefixes[i]);
+  }
+  BTreeDispose(&words);
+}
+
+/**
+ * Function: TestWideElements
+ * --------------------------
+ * Uses elements so big only three fit in a node, which makes for a tall
+ * btree with plenty of splits, and checks that everything still comes
+ * out in order.
+ */
+
+struct wideElement {
+  int key;
+  char padding[400];
+};
+
+static const int kNumWideElements = 5000;
+static void TestWideElements(void)
+{
+  btree wide;
+  struct wideElement elem;
+  btreecursor c;
+
+  fprintf(stdout, "\n\n ------------------------- Starting the wide elements test\n");
+  BTreeNew(&wide, sizeof(struct wideElement), CompareInt, NULL);
+  for (int i = kNumWideElements - 1; i >= 0; i--) {
+    elem.key = 2 * i;
+    memset(elem.padding, i % 128, sizeof(elem.padding));
+    BTreeEnter(&wide, &elem);
+  }
+  assert(wide.max_elems == 3);
+
+  int expected = 0;
+  BTreeFirst(&wide, &c);
+  for (struct wideElement *e = BTreeCursorElem(&c); e != NULL; e = BTreeCursorNext(&c)) {
+    assert(e->padding[sizeof(e->padding) - 1] == (e->key / 2) % 128);
+    CheckNextInt(&e->key, &expected);
+  }
+  assert(expected == 2 * kNumWideElements);
+  fprintf(stdout, "Entered %d wide elements into a btree of height %d.\n", BTreeCount(&wide), wide.height);
+  BTreeDispose(&wide);
+}
+
+int main(int unused, char **alsoUnused)
+{
+  TestOrderedInts();
+  TestPrefixScan();
+  TestWideElements();
+  return 0;
+}
@@ -0,0 +1,505 @@
+#include "concurrenthashset.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const double kDefaultMaxLoadFactor = 1.0;
+static const int kDefaultStripesNum = 64;
+static const int kHashRange = INT_MAX;
+static const uint64_t kHashMultiplier = 0x9E3779B97F4A7C15ULL;
+static const int kRetiredInitialAllocation = 16;
+static const int kAdvanceInterval = 64;
+
+/* Each node is followed directly by its element. */
+struct ConcurrentHashSetNode
+{
+	ConcurrentHashSetNode * next;
+	uint64_t hash;
+};
+
+/* The state is the epoch the reader last saw shifted left by one, with
+	the low bit set while the reader is inside a lookup. */
+struct ConcurrentHashSetReader
+{
+	uint64_t state;
+	bool owned;
+	ConcurrentHashSetReader * next;
+};
+
+typedef enum { kRetiredNode, kRetiredNodeAndElem, kRetiredTable } RetiredKind;
+
+typedef struct
+{
+	void * block;
+	RetiredKind kind;
+} RetiredBlock;
+
+static void * NodeElem(ConcurrentHashSetNode * node)
+{
+	return (char *)node + sizeof(ConcurrentHashSetNode);
+}
+
+static ConcurrentHashSetNode * NodeNew(const concurrenthashset * h, const void * elemAddr, uint64_t hash)
+{
+	ConcurrentHashSetNode * node = malloc(sizeof(ConcurrentHashSetNode) + h->elem_size);
+	assert(node != NULL);
+	node->next = NULL;
+	node->hash = hash;
+	memcpy(NodeElem(node), elemAddr, h->elem_size);
+	return node;
+}
+
+static ConcurrentHashSetTable * TableNew(int buckets_num)
+{
+	ConcurrentHashSetTable * table = calloc(1, sizeof(ConcurrentHashSetTable) + buckets_num * sizeof(ConcurrentHashSetNode *));
+	assert(table != NULL);
+	table->buckets_num = buckets_num;
+	return table;
+}
+
+/* Links are always read with acquire loads and written with release
+	stores, so a lock-free reader that reaches a node sees it whole. */
+static ConcurrentHashSetNode * LoadLink(ConcurrentHashSetNode ** link)
+{
+	return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+}
+
+static void PublishLink(ConcurrentHashSetNode ** link, ConcurrentHashSetNode * node)
+{
+	__atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+
+/* As in the Swiss layout, the client's hash code modulo INT_MAX is spread
+	over 64 bits by a multiply, and the high half is folded into the low
+	half, whose bits pick both the bucket and the stripe. */
+static uint64_t ConcurrentHashSetHash(const concurrenthashset * h, const void * elemAddr)
+{
+	int hashcode = h->hashFn(elemAddr, kHashRange);
+	assert(hashcode >= 0);
+	assert(hashcode < kHashRange);
+	uint64_t hash = ((uint64_t)hashcode + 1) * kHashMultiplier;
+	return hash ^ (hash >> 32);
+}
+
+static ConcurrentHashSetStripe * StripeFor(const concurrenthashset * h, uint64_t hash)
+{
+	return &h->stripes[hash & (h->stripes_num - 1)];
+}
+
+static ConcurrentHashSetNode ** BucketFor(ConcurrentHashSetTable * table, uint64_t hash)
+{
+	return &table->buckets[hash & (table->buckets_num - 1)];
+}
+
+static ConcurrentHashSetNode * ChainFind(const concurrenthashset * h, ConcurrentHashSetNode ** link,
+		const void * elemAddr, uint64_t hash)
+{
+	for (ConcurrentHashSetNode * node = LoadLink(link); node != NULL; node = LoadLink(&node->next))
+		if (node->hash == hash && h->cmpFn(elemAddr, NodeElem(node)) == 0) return node;
+	return NULL;
+}
+
+/* Returns the link that points at the matching node, or the null link at
+	the end of the chain if there's none.  Writers need the link to unlink
+	or replace the node, and since they hold the stripe lock the link can't
+	change under them. */
+static ConcurrentHashSetNode ** ChainFindLink(const concurrenthashset * h, ConcurrentHashSetNode ** link,
+		const void * elemAddr, uint64_t hash)
+{
+	ConcurrentHashSetNode * node;
+	while ((node = LoadLink(link)) != NULL)
+	{
+		if (node->hash == hash && h->cmpFn(elemAddr, NodeElem(node)) == 0) break;
+		link = &node->next;
+	}
+	return link;
+}
+
+static void LockAllStripes(concurrenthashset * h)
+{
+	for (int i = 0; i < h->stripes_num; i++)
+		pthread_mutex_lock(&h->stripes[i].lock);
+}
+
+static void UnlockAllStripes(concurrenthashset * h)
+{
+	for (int i = h->stripes_num - 1; i >= 0; i--)
+		pthread_mutex_unlock(&h->stripes[i].lock);
+}
+
+void ConcurrentHashSetNew(concurrenthashset * h, int elemSize, int numBuckets,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn)
+{
+	// Check all assert conditions
+	assert (elemSize > 0);
+	assert (numBuckets > 0);
+	assert (hashfn != NULL);
+	assert (comparefn != NULL);
+	// Asserts checked
+
+	h->elem_size = elemSize;
+	h->max_load = kDefaultMaxLoadFactor;
+	h->hashFn = hashfn;
+	h->cmpFn = comparefn;
+	h->freeFn = freefn;
+
+	// Every stripe has a lock and a count of its own
+	h->stripes_num = kDefaultStripesNum;
+	h->stripes = malloc(h->stripes_num * sizeof(ConcurrentHashSetStripe));
+	assert(h->stripes != NULL);
+	for (int i = 0; i < h->stripes_num; i++)
+	{
+		pthread_mutex_init(&h->stripes[i].lock, NULL);
+		h->stripes[i].count = 0;
+	}
+
+	// Buckets come in powers of two, at least one per stripe
+	int buckets_num = h->stripes_num;
+	while (buckets_num < numBuckets)
+	{
+		assert(buckets_num <= INT_MAX / 2);
+		buckets_num *= 2;
+	}
+	h->table = TableNew(buckets_num);
+
+	h->lock_free_reads = false;
+}
+
+static void FreeRetired(concurrenthashset * h, vector * retired)
+{
+	for (int i = 0; i < VectorLength(retired); i++)
+	{
+		RetiredBlock * retiredBlock = VectorNth(retired, i);
+		if (retiredBlock->kind == kRetiredNodeAndElem && h->freeFn != NULL)
+			h->freeFn(NodeElem(retiredBlock->block));
+		free(retiredBlock->block);
+	}
+	VectorDispose(retired);
+	VectorNew(retired, sizeof(RetiredBlock), NULL, kRetiredInitialAllocation);
+}
+
+void ConcurrentHashSetDispose(concurrenthashset * h)
+{
+	ConcurrentHashSetTable * table = h->table;
+	for (int i = 0; i < table->buckets_num; i++)
+	{
+		ConcurrentHashSetNode * node = table->buckets[i];
+		while (node != NULL)
+		{
+			ConcurrentHashSetNode * next = node->next;
+			if (h->freeFn != NULL) h->freeFn(NodeElem(node));
+			free(node);
+			node = next;
+		}
+	}
+	free(table);
+
+	if (h->lock_free_reads)
+	{
+		// Nobody is reading any more, so everything retired can go
+		for (int i = 0; i < kConcurrentHashSetEpochsNum; i++)
+		{
+			FreeRetired(h, &h->retired[i]);
+			VectorDispose(&h->retired[i]);
+		}
+		while (h->readers != NULL)
+		{
+			ConcurrentHashSetReader * next = h->readers->next;
+			free(h->readers);
+			h->readers = next;
+		}
+		pthread_key_delete(h->reader_key);
+		pthread_mutex_destroy(&h->reclaim_lock);
+	}
+
+	for (int i = 0; i < h->stripes_num; i++)
+		pthread_mutex_destroy(&h->stripes[i].lock);
+	free(h->stripes);
+}
+
+/* Called by pthreads as a thread that has a reader record exits. */
+static void ReleaseReader(void * reader)
+{
+	__atomic_store_n(&((ConcurrentHashSetReader *)reader)->owned, false, __ATOMIC_RELEASE);
+}
+
+void ConcurrentHashSetEnableLockFreeReads(concurrenthashset * h)
+{
+	// Check all assert conditions
+	assert (!h->lock_free_reads);
+	assert (ConcurrentHashSetCount(h) == 0);
+	// Asserts checked
+
+	h->lock_free_reads = true;
+	h->epoch = 0;
+	h->readers = NULL;
+	h->retired_since_advance = 0;
+	pthread_mutex_init(&h->reclaim_lock, NULL);
+	int err = pthread_key_create(&h->reader_key, ReleaseReader);
+	assert(err == 0);
+	for (int i = 0; i < kConcurrentHashSetEpochsNum; i++)
+		VectorNew(&h->retired[i], sizeof(RetiredBlock), NULL, kRetiredInitialAllocation);
+}
+
+/* Returns the calling thread's reader record, taking over one that an
+	exited thread handed back before resorting to a new one. */
+static ConcurrentHashSetReader * ThisThreadsReader(concurrenthashset * h)
+{
+	ConcurrentHashSetReader * reader = pthread_getspecific(h->reader_key);
+	if (reader != NULL) return reader;
+
+	pthread_mutex_lock(&h->reclaim_lock);
+	for (reader = h->readers; reader != NULL; reader = reader->next)
+		if (!__atomic_load_n(&reader->owned, __ATOMIC_ACQUIRE)) break;
+	if (reader == NULL)
+	{
+		reader = malloc(sizeof(ConcurrentHashSetReader));
+		assert(reader != NULL);
+		reader->state = 0;
+		reader->next = h->readers;
+		h->readers = reader;
+	}
+	reader->owned = true;
+	pthread_mutex_unlock(&h->reclaim_lock);
+
+	pthread_setspecific(h->reader_key, reader);
+	return reader;
+}
+
+/* The announcement has to be visible to the writers before the reader
+	loads any link, hence the sequentially consistent store.  A reader that
+	announces an epoch that has just gone by only holds up the next
+	advance, which is safe. */
+static ConcurrentHashSetReader * EnterEpoch(concurrenthashset * h)
+{
+	ConcurrentHashSetReader * reader = ThisThreadsReader(h);
+	uint64_t epoch = __atomic_load_n(&h->epoch, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&reader->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+	return reader;
+}
+
+static void ExitEpoch(ConcurrentHashSetReader * reader)
+{
+	__atomic_store_n(&reader->state, reader->state & ~(uint64_t)1, __ATOMIC_RELEASE);
+}
+
+/* Moves the epoch on if every reader inside a lookup has seen the current
+	one.  Those readers can't reach anything retired in the epoch before,
+	which is then freed.  Called with the reclaim lock held. */
+static void TryAdvanceEpoch(concurrenthashset * h)
+{
+	uint64_t epoch = h->epoch;
+	for (ConcurrentHashSetReader * reader = h->readers; reader != NULL; reader = reader->next)
+	{
+		uint64_t state = __atomic_load_n(&reader->state, __ATOMIC_SEQ_CST);
+		if ((state & 1) && (state >> 1) != epoch) return;
+	}
+
+	__atomic_store_n(&h->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+	FreeRetired(h, &h->retired[(epoch + 2) % kConcurrentHashSetEpochsNum]);
+	h->retired_since_advance = 0;
+}
+
+/* Called with the reclaim lock held, after the block has been unlinked. */
+static void Retire(concurrenthashset * h, void * block, RetiredKind kind)
+{
+	RetiredBlock retiredBlock = { block, kind };
+	VectorAppend(&h->retired[h->epoch % kConcurrentHashSetEpochsNum], &retiredBlock);
+	if (++h->retired_since_advance >= kAdvanceInterval) TryAdvanceEpoch(h);
+}
+
+/* Gets rid of a node that has just been unlinked, along with its element
+	if freeElem is set, at once or after a grace period. */
+static void DiscardNode(concurrenthashset * h, ConcurrentHashSetNode * node, bool freeElem)
+{
+	if (h->lock_free_reads)
+	{
+		pthread_mutex_lock(&h->reclaim_lock);
+		Retire(h, node, freeElem ? kRetiredNodeAndElem : kRetiredNode);
+		pthread_mutex_unlock(&h->reclaim_lock);
+	} else {
+		if (freeElem && h->freeFn != NULL) h->freeFn(NodeElem(node));
+		free(node);
+	}
+}
+
+int ConcurrentHashSetCount(concurrenthashset * h)
+{
+	int count = 0;
+	for (int i = 0; i < h->stripes_num; i++)
+	{
+		pthread_mutex_lock(&h->stripes[i].lock);
+		count += h->stripes[i].count;
+		pthread_mutex_unlock(&h->stripes[i].lock);
+	}
+	return count;
+}
+
+/* Doubles the number of buckets, unless another thread has already grown
+	the table since the caller saw it with observedBucketsNum buckets.  The
+	nodes are relinked into their new buckets, except in lock-free mode,
+	where readers may still be walking the old chains: there the nodes are
+	copied into the new table and the old table is retired whole. */
+static void ConcurrentHashSetGrow(concurrenthashset * h, int observedBucketsNum)
+{
+	LockAllStripes(h);
+	ConcurrentHashSetTable * table = h->table;
+	if (table->buckets_num == observedBucketsNum && table->buckets_num <= INT_MAX / 2)
+	{
+		ConcurrentHashSetTable * new_table = TableNew(2 * table->buckets_num);
+		for (int i = 0; i < table->buckets_num; i++)
+		{
+			ConcurrentHashSetNode * node = table->buckets[i];
+			while (node != NULL)
+			{
+				ConcurrentHashSetNode * next = node->next;
+				ConcurrentHashSetNode * moved = node;
+				if (h->lock_free_reads) moved = NodeNew(h, NodeElem(node), node->hash);
+				ConcurrentHashSetNode ** bucket = BucketFor(new_table, node->hash);
+				moved->next = *bucket;
+				*bucket = moved;
+				node = next;
+			}
+		}
+		__atomic_store_n(&h->table, new_table, __ATOMIC_RELEASE);
+
+		if (h->lock_free_reads)
+		{
+			// Only now is the old table out of new readers' reach
+			pthread_mutex_lock(&h->reclaim_lock);
+			for (int i = 0; i < table->buckets_num; i++)
+			{
+				for (ConcurrentHashSetNode * node = table->buckets[i]; node != NULL; node = node->next)
+					Retire(h, node, kRetiredNode);
+			}
+			Retire(h, table, kRetiredTable);
+			pthread_mutex_unlock(&h->reclaim_lock);
+		}
+		else free(table);
+	}
+	UnlockAllStripes(h);
+}
+
+/* Does the work of Enter and Update with the element's stripe locked.  A
+	stripe that has taken more than its share of the maximum load asks for
+	the table to grow, which has to wait until the stripe lock is released. */
+static bool ConcurrentHashSetFindOrInsert(concurrenthashset * h, const void * elemAddr, bool replace,
+		ConcurrentHashSetUpdateFunction updatefn, void * auxData)
+{
+	uint64_t hash = ConcurrentHashSetHash(h, elemAddr);
+	ConcurrentHashSetStripe * stripe = StripeFor(h, hash);
+
+	pthread_mutex_lock(&stripe->lock);
+	int buckets_num = h->table->buckets_num;
+	ConcurrentHashSetNode ** link = ChainFindLink(h, BucketFor(h->table, hash), elemAddr, hash);
+	ConcurrentHashSetNode * node = LoadLink(link);
+	ConcurrentHashSetNode * replaced = NULL;
+	bool inserted = (node == NULL);
+
+	if (inserted)
+	{
+		// The node is only published once it's complete
+		node = NodeNew(h, elemAddr, hash);
+		if (updatefn != NULL) updatefn(NodeElem(node), true, auxData);
+		PublishLink(link, node);
+		stripe->count++;
+	}
+	else if (h->lock_free_reads)
+	{
+		// Lookups may be copying the element, so its new version goes into a new node
+		replaced = node;
+		node = NodeNew(h, replace ? elemAddr : NodeElem(replaced), hash);
+		if (updatefn != NULL) updatefn(NodeElem(node), false, auxData);
+		node->next = replaced->next;
+		PublishLink(link, node);
+	} else {
+		if (replace)
+		{
+			if (h->freeFn != NULL) h->freeFn(NodeElem(node));
+			memcpy(NodeElem(node), elemAddr, h->elem_size);
+		}
+		if (updatefn != NULL) updatefn(NodeElem(node), false, auxData);
+	}
+
+	bool overloaded = stripe->count > h->max_load * buckets_num / h->stripes_num;
+	pthread_mutex_unlock(&stripe->lock);
+
+	if (replaced != NULL) DiscardNode(h, replaced, replace);
+	if (overloaded) ConcurrentHashSetGrow(h, buckets_num);
+	return inserted;
+}
+
+void ConcurrentHashSetEnter(concurrenthashset * h, const void * elemAddr)
+{
+	assert(elemAddr != NULL);
+	ConcurrentHashSetFindOrInsert(h, elemAddr, true, NULL, NULL);
+}
+
+bool ConcurrentHashSetUpdate(concurrenthashset * h, const void * elemAddr,
+		ConcurrentHashSetUpdateFunction updatefn, void * auxData)
+{
+	assert(elemAddr != NULL);
+	assert(updatefn != NULL);
+	return ConcurrentHashSetFindOrInsert(h, elemAddr, false, updatefn, auxData);
+}
+
+bool ConcurrentHashSetLookup(concurrenthashset * h, const void * elemAddr, void * copyAddr)
+{
+	assert(elemAddr != NULL);
+
+	uint64_t hash = ConcurrentHashSetHash(h, elemAddr);
+	ConcurrentHashSetStripe * stripe = StripeFor(h, hash);
+	ConcurrentHashSetReader * reader = NULL;
+
+	if (h->lock_free_reads) reader = EnterEpoch(h);
+	else pthread_mutex_lock(&stripe->lock);
+
+	ConcurrentHashSetTable * table = __atomic_load_n(&h->table, __ATOMIC_ACQUIRE);
+	ConcurrentHashSetNode * node = ChainFind(h, BucketFor(table, hash), elemAddr, hash);
+	if (node != NULL && copyAddr != NULL) memcpy(copyAddr, NodeElem(node), h->elem_size);
+
+	if (h->lock_free_reads) ExitEpoch(reader);
+	else pthread_mutex_unlock(&stripe->lock);
+
+	return node != NULL;
+}
+
+bool ConcurrentHashSetRemove(concurrenthashset * h, const void * elemAddr)
+{
+	assert(elemAddr != NULL);
+
+	uint64_t hash = ConcurrentHashSetHash(h, elemAddr);
+	ConcurrentHashSetStripe * stripe = StripeFor(h, hash);
+
+	pthread_mutex_lock(&stripe->lock);
+	ConcurrentHashSetNode ** link = ChainFindLink(h, BucketFor(h->table, hash), elemAddr, hash);
+	ConcurrentHashSetNode * node = LoadLink(link);
+	if (node != NULL)
+	{
+		// The node keeps its link, so a lookup standing on it can carry on
+		PublishLink(link, node->next);
+		stripe->count--;
+	}
+	pthread_mutex_unlock(&stripe->lock);
+
+	if (node != NULL) DiscardNode(h, node, true);
+	return node != NULL;
+}
+
+void ConcurrentHashSetMap(concurrenthashset * h, HashSetMapFunction mapfn, void * auxData)
+{
+	assert(mapfn != NULL);
+
+	for (int s = 0; s < h->stripes_num; s++)
+	{
+		ConcurrentHashSetStripe * stripe = &h->stripes[s];
+		pthread_mutex_lock(&stripe->lock);
+		for (int i = s; i < h->table->buckets_num; i += h->stripes_num)
+		{
+			for (ConcurrentHashSetNode * node = h->table->buckets[i]; node != NULL; node = node->next)
+				mapfn(NodeElem(node), auxData);
+		}
+		pthread_mutex_unlock(&stripe->lock);
+	}
+}
@@ -0,0 +1,242 @@
+#ifndef _concurrenthashset_
+#define _concurrenthashset_
+#include "hashset.h"
+#include <pthread.h>
+
+/* File: concurrenthashset.h
+ * --------------------------
+ * Defines the interface for the concurrent hashset, a hashset that any
+ * number of threads can enter elements into, look elements up in and map
+ * over at the same time.
+ *
+ * Rather than one lock around the whole table, the buckets are divided
+ * among a fixed number of stripes, each with a lock of its own, so threads
+ * working on different stripes never wait for one another.  The element
+ * count is kept per stripe too, so inserting threads don't all fight over
+ * one shared counter.  Only growing the table takes every stripe's lock.
+ *
+ * Since another thread may replace or move an element at any moment, the
+ * concurrent hashset never hands out the addresses of its elements:
+ * lookups copy the element out, and elements are modified in place only
+ * through ConcurrentHashSetUpdate, which runs the client's function while
+ * holding the element's stripe lock.
+ *
+ * For read-mostly use, e.g. a query loop running while a background
+ * thread keeps indexing, lookups can be made lock-free as well (see
+ * ConcurrentHashSetEnableLockFreeReads).  Writers then never change a
+ * node a reader might be looking at: they publish new nodes in its place,
+ * and the old ones are reclaimed only once every reader that could have
+ * seen them has finished, using epoch-based reclamation.
+ */
+
+/**
+ * Type: ConcurrentHashSetUpdateFunction
+ * -------------------------------------
+ * Class of function ConcurrentHashSetUpdate applies to the element it
+ * finds or inserts.  It's called with the address of the element as
+ * stored in the hashset, whether the element was just inserted, and the
+ * client data passed to ConcurrentHashSetUpdate.  The function may change
+ * the element freely, provided it doesn't change how the element hashes
+ * or compares, but it mustn't call back into the same hashset.
+ *
+ * In lock-free mode the element it's handed is a bitwise copy of the
+ * published one, whose pointees lock-free readers may be copying out
+ * at that very moment.  There the function may only change fields stored
+ * directly in the element (a count, say); it mustn't write through, free
+ * or reallocate anything the element points to.
+ */
+
+typedef void (*ConcurrentHashSetUpdateFunction)(void *elemAddr, bool inserted, void *auxData);
+
+/**
+ * Type: concurrenthashset
+ * -----------------------
+ * The concrete representation of the concurrent hashset.  As with
+ * the hashset, the client should treat it as opaque and interact
+ * with it only through the functions described below.
+ *
+ * Each bucket is a singly linked chain of nodes, every node holding
+ * one element along with its hash code.  The bucket count is a power
+ * of two and a multiple of the stripe count, and bucket i belongs to
+ * stripe i % stripes_num.  Growing the table splits bucket i into
+ * buckets i and i + buckets_num, which belong to the same stripe, so
+ * an element's stripe never changes.  The buckets live in a table that
+ * carries its own bucket count, so that a lock-free reader loading the
+ * table pointer once sees the two agree.
+ *
+ * With lock-free reads, every thread that has looked something up owns
+ * a reader record announcing the epoch it's reading in, if any.  Nodes
+ * and tables the writers unlink are retired onto the list for the
+ * current epoch, and the epoch advances once every reader inside a
+ * lookup has caught up with it, at which point whatever was retired two
+ * epochs back is out of every reader's reach and is freed.
+ */
+
+enum { kConcurrentHashSetEpochsNum = 3 };
+
+typedef struct ConcurrentHashSetNode ConcurrentHashSetNode;
+typedef struct ConcurrentHashSetReader ConcurrentHashSetReader;
+
+typedef struct
+{
+  int buckets_num;
+  ConcurrentHashSetNode * buckets[];
+} ConcurrentHashSetTable;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  int count;
+} __attribute__((aligned(64))) ConcurrentHashSetStripe;
+
+typedef struct
+{
+  ConcurrentHashSetTable * table;
+  int elem_size;
+  double max_load;
+
+  ConcurrentHashSetStripe * stripes;
+  int stripes_num;
+
+  bool lock_free_reads;
+  uint64_t epoch;
+  ConcurrentHashSetReader * readers;
+  pthread_key_t reader_key;
+  pthread_mutex_t reclaim_lock;
+  vector retired[kConcurrentHashSetEpochsNum];
+  int retired_since_advance;
+
+  void (*freeFn)(void *);
+  int (*hashFn)(const void *, int);
+  int (*cmpFn)(const void *, const void *);
+} concurrenthashset;
+
+/**
+ * Function: ConcurrentHashSetNew
+ * ------------------------------
+ * Initializes the identified concurrent hashset to be empty.  The
+ * parameters mean just what they do for HashSetNew, and the same
+ * asserts are raised.  The hash function is called with a numBuckets
+ * of INT_MAX, whatever the actual number of buckets, which is rounded
+ * up to a power of two, and it grows as elements are entered.  The
+ * hash and compare functions may be called from any thread, several
+ * at once, so they shouldn't rely on any shared mutable state.
+ */
+
+void ConcurrentHashSetNew(concurrenthashset *h, int elemSize, int numBuckets,
+			  HashSetHashFunction hashfn, HashSetCompareFunction comparefn,
+			  HashSetFreeFunction freefn);
+
+/**
+ * Function: ConcurrentHashSetDispose
+ * ----------------------------------
+ * Disposes of all the resources the concurrent hashset holds, applying
+ * the free function (if any) to every element.  No other thread may be
+ * using the hashset, or ever use it again.
+ */
+
+void ConcurrentHashSetDispose(concurrenthashset *h);
+
+/**
+ * Function: ConcurrentHashSetEnableLockFreeReads
+ * ----------------------------------------------
+ * Switches the concurrent hashset over to lock-free lookups, which never
+ * wait on a writer and never make a writer wait.  Writes still take the
+ * stripe locks, and get dearer: replacing or updating an element copies
+ * it into a new node, growing the table copies every node, and nothing
+ * unlinked is freed (or handed to the free function) until no lookup can
+ * still be looking at it.  Updates may then only change fields stored
+ * directly in an element (see ConcurrentHashSetUpdateFunction).  The mode
+ * suits tables that are read far more often than they're written.  Every
+ * thread that looks something up is given a record of its own, which it
+ * hands back when it exits.
+ *
+ * An assert is raised unless the hashset is empty and not yet in
+ * lock-free mode.
+ */
+
+void ConcurrentHashSetEnableLockFreeReads(concurrenthashset *h);
+
+/**
+ * Function: ConcurrentHashSetCount
+ * --------------------------------
+ * Returns the number of elements in the concurrent hashset.  While other
+ * threads are entering elements, the count is only a snapshot: each
+ * stripe is counted at a slightly different moment.
+ */
+
+int ConcurrentHashSetCount(concurrenthashset *h);
+
+/**
+ * Function: ConcurrentHashSetEnter
+ * --------------------------------
+ * Inserts a copy of the element at elemAddr, or replaces the element
+ * that matches it, just like HashSetEnter.
+ *
+ * An assert is raised if the specified address is NULL.
+ */
+
+void ConcurrentHashSetEnter(concurrenthashset *h, const void *elemAddr);
+
+/**
+ * Function: ConcurrentHashSetLookup
+ * ---------------------------------
+ * Looks for an element matching the one at elemAddr and returns true if
+ * there is one, after copying it (unless copyAddr is NULL) to copyAddr,
+ * which must have room for one element.  The copy is bitwise, so it
+ * shares anything the element points to with the hashset.  In lock-free
+ * mode that memory is only safe to use for as long as the element stays
+ * in the hashset.
+ *
+ * An assert is raised if elemAddr is NULL.
+ */
+
+bool ConcurrentHashSetLookup(concurrenthashset *h, const void *elemAddr, void *copyAddr);
+
+/**
+ * Function: ConcurrentHashSetUpdate
+ * ---------------------------------
+ * Finds the element matching the one at elemAddr, inserting a copy of it
+ * if there's none, and applies updatefn to the resident element while no
+ * other thread can touch it.  This is how an element is modified in place,
+ * e.g. to bump a count or, outside lock-free mode, to append to a vector
+ * the element holds.  Returns true if the element was inserted.  In
+ * lock-free mode, updatefn is applied to a fresh copy of the element that
+ * then takes its place, so it may be called on an element that no lookup
+ * will see.  The copy is bitwise and shares its pointees with the element
+ * readers can still see, so updatefn may only change fields stored
+ * directly in the element (see ConcurrentHashSetUpdateFunction).
+ *
+ * An assert is raised if elemAddr or updatefn is NULL.
+ */
+
+bool ConcurrentHashSetUpdate(concurrenthashset *h, const void *elemAddr,
+			     ConcurrentHashSetUpdateFunction updatefn, void *auxData);
+
+/**
+ * Function: ConcurrentHashSetRemove
+ * ---------------------------------
+ * Removes the element matching the one at elemAddr, if any, and returns
+ * true if there was one.  The free function, if any, is applied to the
+ * removed element, at once or, in lock-free mode, once no lookup can
+ * still be copying it.
+ *
+ * An assert is raised if elemAddr is NULL.
+ */
+
+bool ConcurrentHashSetRemove(concurrenthashset *h, const void *elemAddr);
+
+/**
+ * Function: ConcurrentHashSetMap
+ * ------------------------------
+ * Applies mapfn to every element, as HashSetMap does.  The stripes are
+ * visited one at a time, each with its lock held, so mapfn sees a
+ * consistent stripe but not necessarily a consistent hashset, and it
+ * mustn't call back into the same hashset.
+ *
+ * An assert is raised if mapfn is NULL.
+ */
+
+void ConcurrentHashSetMap(concurrenthashset *h, HashSetMapFunction mapfn, void *auxData);
+
+#endif
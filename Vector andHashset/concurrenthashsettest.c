@@ -0,0 +1,222 @@
+#include "concurrenthashset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+
+/**
+ * Struct: occurrence
+ * ------------------
+ * An int along with the number of times it has been indexed,
+ * which the test threads bump through ConcurrentHashSetUpdate.
+ */
+
+struct occurrence {
+  int value;
+  int count;
+};
+
+static const int kNumThreads = 8;
+static const int kNumIndexedInts = 50000;
+static const int kNumReindexings = 4;
+
+/**
+ * Function: HashOccurrence
+ * ------------------------
+ * Hash function for the occurrences, which hash by value only.
+ */
+
+static int HashOccurrence(const void *elem, int numBuckets)
+{
+  return (unsigned int)((const struct occurrence *)elem)->value % numBuckets;
+}
+
+static int CompareOccurrence(const void *elem1, const void *elem2)
+{
+  return ((const struct occurrence *)elem1)->value - ((const struct occurrence *)elem2)->value;
+}
+
+/**
+ * Function: CountOccurrence
+ * -------------------------
+ * Update function that counts one more occurrence of the element.
+ * The element is entered with a count of zero, so the count is
+ * bumped whether or not the element was just inserted.
+ */
+
+static void CountOccurrence(void *elem, bool inserted, void *auxData)
+{
+  ((struct occurrence *)elem)->count++;
+}
+
+/**
+ * Function: IndexInts
+ * -------------------
+ * Thread routine that indexes every int once, starting at a different
+ * point for each thread so the threads collide on different stripes,
+ * and checks along the way that an int it has indexed can be looked up.
+ * The thread's number is passed as the client data.
+ */
+
+static concurrenthashset occurrences;
+static void *IndexInts(void *threadNum)
+{
+  int start = (long)threadNum * (kNumIndexedInts / kNumThreads);
+  for (int i = 0; i < kNumIndexedInts; i++) {
+    struct occurrence key = { (start + i) % kNumIndexedInts, 0 };
+    ConcurrentHashSetUpdate(&occurrences, &key, CountOccurrence, NULL);
+
+    struct occurrence found;
+    assert(ConcurrentHashSetLookup(&occurrences, &key, &found));
+    assert(found.value == key.value && found.count >= 1 && found.count <= kNumThreads);
+  }
+  return NULL;
+}
+
+/**
+ * Function: SumCounts
+ * -------------------
+ * Mapping function that adds each element's count to the running
+ * total passed as the client data.
+ */
+
+static void SumCounts(void *elem, void *total)
+{
+  *(long *)total += ((struct occurrence *)elem)->count;
+}
+
+/**
+ * Function: TestConcurrentIndexing
+ * --------------------------------
+ * Has kNumThreads threads index the same ints at once, starting
+ * from a handful of buckets so the table has to grow while they're
+ * at it, and checks that no update was lost: every int must have
+ * been counted once by every thread.
+ */
+
+static void TestConcurrentIndexing(void)
+{
+  pthread_t threads[kNumThreads];
+
+  fprintf(stdout, "\n\n ------------------------- Starting the concurrent indexing test\n");
+  ConcurrentHashSetNew(&occurrences, sizeof(struct occurrence), 1, HashOccurrence, CompareOccurrence, NULL);
+  for (long i = 0; i < kNumThreads; i++)
+    pthread_create(&threads[i], NULL, IndexInts, (void *)i);
+  for (int i = 0; i < kNumThreads; i++)
+    pthread_join(threads[i], NULL);
+
+  assert(ConcurrentHashSetCount(&occurrences) == kNumIndexedInts);
+  for (int i = 0; i < kNumIndexedInts; i++) {
+    struct occurrence key = { i, 0 }, found;
+    assert(ConcurrentHashSetLookup(&occurrences, &key, &found));
+    assert(found.count == kNumThreads);
+  }
+  long total = 0;
+  ConcurrentHashSetMap(&occurrences, SumCounts, &total);
+  assert(total == (long)kNumThreads * kNumIndexedInts);
+  fprintf(stdout, "%d threads indexed %d ints, hashset grew to %d buckets.\n",
+	  kNumThreads, ConcurrentHashSetCount(&occurrences), occurrences.table->buckets_num);
+
+  ConcurrentHashSetDispose(&occurrences);
+}
+
+/**
+ * Function: CountFree
+ * -------------------
+ * Free function that just counts how many elements it has been
+ * handed, so the lock-free test can tell that every replaced or
+ * removed element is eventually freed, and freed once.
+ */
+
+static int numFreed;
+static void CountFree(void *elem)
+{
+  numFreed++;
+}
+
+/**
+ * Function: LookUpWhileIndexing
+ * -----------------------------
+ * Thread routine for the lock-free test's readers, which keep looking
+ * ints up until the writer is done, checking that whatever they find
+ * is a version of the element the writer really entered.  The address
+ * of the writer's done flag is passed as the client data.
+ */
+
+static void *LookUpWhileIndexing(void *writerDone)
+{
+  int numFound = 0;
+  for (int i = 0; !__atomic_load_n((bool *)writerDone, __ATOMIC_ACQUIRE); i = (i + 7919) % kNumIndexedInts) {
+    struct occurrence key = { i, 0 }, found;
+    if (ConcurrentHashSetLookup(&occurrences, &key, &found)) {
+      assert(found.value == i);
+      assert(found.count >= 0 && found.count <= kNumReindexings);
+      numFound++;
+    }
+  }
+  return (void *)(long)numFound;
+}
+
+/**
+ * Function: TestLockFreeReads
+ * ---------------------------
+ * Has one thread index the ints over and over, replacing every element
+ * each time round, then update the even ones and remove the odd ones,
+ * while the other threads look ints up without taking any locks.  The
+ * table starts small, so it also grows under the readers' feet.  Every
+ * element the writer replaced or removed has to be freed exactly once,
+ * by the time the hashset is disposed of.
+ */
+
+static void TestLockFreeReads(void)
+{
+  pthread_t readers[kNumThreads - 1];
+  bool writerDone = false;
+
+  fprintf(stdout, "\n\n ------------------------- Starting the lock-free reads test\n");
+  ConcurrentHashSetNew(&occurrences, sizeof(struct occurrence), 1, HashOccurrence, CompareOccurrence, CountFree);
+  ConcurrentHashSetEnableLockFreeReads(&occurrences);
+  numFreed = 0;
+  for (long i = 0; i < kNumThreads - 1; i++)
+    pthread_create(&readers[i], NULL, LookUpWhileIndexing, &writerDone);
+
+  for (int round = 0; round < kNumReindexings; round++) {
+    for (int i = 0; i < kNumIndexedInts; i++) {
+      struct occurrence occ = { i, round };
+      ConcurrentHashSetEnter(&occurrences, &occ);
+    }
+  }
+  for (int i = 0; i < kNumIndexedInts; i++) {
+    struct occurrence key = { i, 0 };
+    if (i % 2 == 0) assert(!ConcurrentHashSetUpdate(&occurrences, &key, CountOccurrence, NULL));
+    else assert(ConcurrentHashSetRemove(&occurrences, &key));
+  }
+  __atomic_store_n(&writerDone, true, __ATOMIC_RELEASE);
+
+  long numFound = 0;
+  for (int i = 0; i < kNumThreads - 1; i++) {
+    void *readerFound;
+    pthread_join(readers[i], &readerFound);
+    numFound += (long)readerFound;
+  }
+
+  assert(ConcurrentHashSetCount(&occurrences) == kNumIndexedInts / 2);
+  for (int i = 0; i < kNumIndexedInts; i++) {
+    struct occurrence key = { i, 0 }, found;
+    bool present = ConcurrentHashSetLookup(&occurrences, &key, &found);
+    assert(present == (i % 2 == 0));
+    assert(!present || found.count == kNumReindexings);
+  }
+  fprintf(stdout, "%d readers found %ld ints while the writer replaced them %d times over.\n",
+	  kNumThreads - 1, numFound, kNumReindexings);
+
+  ConcurrentHashSetDispose(&occurrences);
+  assert(numFreed == kNumReindexings * kNumIndexedInts);
+}
+
+int main(int ununsed, char **alsoUnused)
+{
+  TestConcurrentIndexing();
+  TestLockFreeReads();
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include "hashing.h"
+#include "bool.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const uint64_t kSecret[4] = {
+	0xA0761D6478BD642FULL, 0xE7037ED1A0B428DBULL, 0x8EBC6AF09C88C6E3ULL, 0x589965CC75374CC3ULL
+};
+static const uint64_t kOnes = 0x0101010101010101ULL;
+static const uint64_t kHighBits = 0x8080808080808080ULL;
+
+/* The 128-bit product of *a and *b, low half in *a and high half in *b. */
+static inline __attribute__((always_inline)) void MultiplyFull(uint64_t * a, uint64_t * b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t product = (__uint128_t)*a * *b;
+	*a = (uint64_t)product;
+	*b = (uint64_t)(product >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), lo = t + (rm1 << 32);
+	uint64_t carry = (t < rl) + (lo < t);
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static inline __attribute__((always_inline)) uint64_t Mum(uint64_t a, uint64_t b)
+{
+	MultiplyFull(&a, &b);
+	return a ^ b;
+}
+
+/* Lowers every ASCII capital among the eight bytes of w at once: a byte
+	is a capital if its low seven bits reach 'A' but not 'Z' + 1, which the
+	adds below detect in each byte's high bit, and its own high bit is
+	clear.  Setting the 0x20 bit then lowers it. */
+static inline __attribute__((always_inline)) uint64_t FoldCase(uint64_t w)
+{
+	uint64_t low_bits = w & ~kHighBits;
+	uint64_t at_least_a = (low_bits + kOnes * (0x80 - 'A')) & kHighBits;
+	uint64_t past_z = (low_bits + kOnes * (0x80 - 'Z' - 1)) & kHighBits;
+	return w | ((at_least_a & ~past_z & ~w) >> 2);
+}
+
+static inline __attribute__((always_inline)) uint64_t Read8(const uint8_t * p, bool fold)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return fold ? FoldCase(v) : v;
+}
+
+static inline __attribute__((always_inline)) uint64_t Read4(const uint8_t * p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Packs the first, middle and last of 1 to 3 bytes. */
+static inline __attribute__((always_inline)) uint64_t Read3(const uint8_t * p, size_t len)
+{
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+/* The one hash behind all of the functions.  fold is always a constant, so
+	the compiler makes a separate copy for each of its values.  It and its
+	helpers are inlined even without optimization, which the Makefile
+	doesn't ask for, since the calls would otherwise cost more than the
+	hashing. */
+static inline __attribute__((always_inline)) uint64_t Hash(const uint8_t * p, size_t len, uint64_t seed, bool fold)
+{
+	uint64_t a, b;
+	seed ^= Mum(seed ^ kSecret[0], kSecret[1]);
+	if (len <= 16)
+	{
+		// FoldCase works byte by byte, so it can wait until the bytes are packed
+		if (len >= 4)
+		{
+			size_t middle = (len >> 3) << 2;
+			a = (Read4(p) << 32) | Read4(p + middle);
+			b = (Read4(p + len - 4) << 32) | Read4(p + len - 4 - middle);
+		}
+		else if (len > 0)
+		{
+			a = Read3(p, len);
+			b = 0;
+		}
+		else a = b = 0;
+		if (fold)
+		{
+			a = FoldCase(a);
+			b = FoldCase(b);
+		}
+	}
+	else
+	{
+		size_t left = len;
+		if (left > 48)
+		{
+			// Three independent lanes, so the multiplies overlap
+			uint64_t seed1 = seed, seed2 = seed;
+			do
+			{
+				seed = Mum(Read8(p, fold) ^ kSecret[1], Read8(p + 8, fold) ^ seed);
+				seed1 = Mum(Read8(p + 16, fold) ^ kSecret[2], Read8(p + 24, fold) ^ seed1);
+				seed2 = Mum(Read8(p + 32, fold) ^ kSecret[3], Read8(p + 40, fold) ^ seed2);
+				p += 48;
+				left -= 48;
+			} while (left > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (left > 16)
+		{
+			seed = Mum(Read8(p, fold) ^ kSecret[1], Read8(p + 8, fold) ^ seed);
+			p += 16;
+			left -= 16;
+		}
+		a = Read8(p + left - 16, fold);
+		b = Read8(p + left - 8, fold);
+	}
+
+	a ^= kSecret[1];
+	b ^= seed;
+	MultiplyFull(&a, &b);
+	return Mum(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+/* Falls back on the clock and the address of a local, which the system
+	randomizes, if there's no /dev/urandom. */
+static uint64_t DrawSeed(void)
+{
+	uint64_t seed = 0;
+	FILE * urandom = fopen("/dev/urandom", "rb");
+	if (urandom != NULL)
+	{
+		if (fread(&seed, sizeof(seed), 1, urandom) != 1) seed = 0;
+		fclose(urandom);
+	}
+	if (seed == 0)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		seed = Mum((uint64_t)now.tv_sec ^ kSecret[2], (uint64_t)now.tv_nsec ^ (uintptr_t)&now);
+	}
+	return seed;
+}
+
+uint64_t HashSeed(void)
+{
+	// 0 means not drawn yet; a race just draws twice and keeps the first
+	static uint64_t process_seed = 0;
+	uint64_t seed = __atomic_load_n(&process_seed, __ATOMIC_RELAXED);
+	if (seed != 0) return seed;
+
+	seed = DrawSeed();
+	if (seed == 0) seed = kSecret[3];
+	uint64_t unset = 0;
+	if (!__atomic_compare_exchange_n(&process_seed, &unset, seed, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		seed = unset;
+	return seed;
+}
+
+uint64_t HashBytes(const void * data, size_t len, uint64_t seed)
+{
+	return Hash(data, len, seed, false);
+}
+
+uint64_t HashString(const char * s, uint64_t seed)
+{
+	return Hash((const uint8_t *)s, strlen(s), seed, false);
+}
+
+uint64_t HashStringCaseFold(const char * s, uint64_t seed)
+{
+	return Hash((const uint8_t *)s, strlen(s), seed, true);
+}
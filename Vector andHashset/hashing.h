@@ -0,0 +1,64 @@
+#ifndef _hashing_
+#define _hashing_
+#include <stddef.h>
+#include <stdint.h>
+
+/* File: hashing.h
+ * ----------------
+ * Defines a small family of fast, well-mixed 64-bit hash functions for
+ * clients to build their HashSetHashFunctions and HashSetFullHashFunctions
+ * on.  The functions read their input eight bytes at a time and finish
+ * with a couple of 64x64->128 bit multiplies (the construction is that of
+ * wyhash), so hashing a word costs a few nanoseconds whatever its length,
+ * and changing any bit of the input changes about half the bits of the
+ * code.
+ *
+ * Every function takes a seed, and the same input hashes differently
+ * under different seeds.  Clients hashing text that comes from outside
+ * (a news feed, say) should pass HashSeed(), which is drawn at random
+ * once per process, so that nobody can prepare a batch of words that all
+ * land in the same bucket.  Hash codes computed with HashSeed() mean
+ * nothing to another process and must not be saved.
+ */
+
+/**
+ * Function: HashSeed
+ * ------------------
+ * Returns this process's random seed, the same one on every call.  It's
+ * read from the system's source of randomness the first time it's asked
+ * for.  Safe to call from several threads at once.
+ */
+
+uint64_t HashSeed(void);
+
+/**
+ * Function: HashBytes
+ * -------------------
+ * Returns the 64-bit hash code of the len bytes at data under the
+ * specified seed.  The bytes need not be aligned.
+ */
+
+uint64_t HashBytes(const void *data, size_t len, uint64_t seed);
+
+/**
+ * Function: HashString
+ * --------------------
+ * Returns the hash code of the characters of the C string s, the same
+ * one HashBytes gives them.
+ */
+
+uint64_t HashString(const char *s, uint64_t seed);
+
+/**
+ * Function: HashStringCaseFold
+ * ----------------------------
+ * Returns the hash code of the C string s with its letters lowered, so
+ * that "Peter Pawlowski" and "PETER PAWLOWSKI" hash alike, for hashsets
+ * that compare with strcasecmp.  Only the ASCII letters are folded, as
+ * tolower does in the C locale, and the result is the code HashString
+ * would give the lowered string.  No copy of the string is made.
+ */
+
+uint64_t HashStringCaseFold(const char *s, uint64_t seed);
+
+#endif
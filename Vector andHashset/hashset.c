@@ -1,8 +1,194 @@
 #include "hashset.h"
+#include "robinhood.h"
+#include "swisstable.h"
+#include "hashsetcounters.h"
+#include "parallel.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
+static const double kDefaultMaxLoadFactor = 1.0;
+static const double kDefaultOpenMaxLoadFactor = 0.875;
+static const int kBucketInitialAllocation = 2;
+static const int kMaxBucketsNum = INT_MAX / sizeof(vector *);
+static const int kRehashWorkPerStep = 4;
+enum { kLookupBatchSize = 16 };
+
+static void HashSetRehash(hashset * h, int newBucketsNum);
+static void HashSetRehashStep(hashset * h, int work);
+static void HashSetFinishRehash(hashset * h);
+static bool HashSetGrowIfNeeded(hashset * h, int numElems);
+static void HashSetShrinkIfNeeded(hashset * h);
+static void HashSetRebuildBloomFilter(hashset * h);
+
+/* A bucket array is an array of vector pointers, and a bucket doesn't
+	get its vector until something is appended to it, so an empty bucket
+	costs nothing more than its NULL pointer.
+
+	Bucket vectors hold entries rather than bare elements: with a full hash
+	function installed, an entry is the element's full hash code followed
+	(at entry_offset) by the element, otherwise it's just the element.  The
+	vectors have no free function of their own, since freeFn expects an
+	element and not an entry, so the hashset calls it itself. */
+static vector ** BucketAt(vector ** data, int pos)
+{
+	return data + pos;
+}
+
+static bool BucketIsAllocated(vector * const * bucket)
+{
+	return *bucket != NULL;
+}
+
+static void * EntryElem(const hashset * h, void * entry)
+{
+	return (char *)entry + h->entry_offset;
+}
+
+static uint64_t EntryHash(const void * entry)
+{
+	uint64_t hash;
+	memcpy(&hash, entry, sizeof(hash));
+	return hash;
+}
+
+/* Returns the entry to store for elemAddr: the element itself, or its
+	hash code and a copy of it put together in h->scratch. */
+static const void * MakeEntry(hashset * h, const void * elemAddr, uint64_t hash)
+{
+	if (h->entry_offset == 0) return elemAddr;
+	memcpy(h->scratch, &hash, sizeof(hash));
+	memcpy(EntryElem(h, h->scratch), elemAddr, h->elem_size);
+	return h->scratch;
+}
+
+static void BucketAppend(hashset * h, vector ** bucket, const void * entry)
+{
+	if (!BucketIsAllocated(bucket))
+	{
+		*bucket = malloc(sizeof(vector));
+		assert(*bucket != NULL);
+		VectorNew(*bucket, h->entry_offset + h->elem_size, NULL, kBucketInitialAllocation);
+	}
+	VectorAppend(*bucket, entry);
+}
+
+static void BucketDispose(hashset * h, vector ** bucket, bool freeElems)
+{
+	if (!BucketIsAllocated(bucket)) return;
+	if (freeElems && h->freeFn != NULL)
+	{
+		for (int i = 0; i < VectorLength(*bucket); i++)
+			h->freeFn(EntryElem(h, VectorNth(*bucket, i)));
+	}
+	VectorDispose(*bucket);
+	free(*bucket);
+	*bucket = NULL;
+}
+
+const int kNotFound = -1;
+static int BucketSearch(const hashset * h, vector * const * bucket, const void * keyAddr,
+		uint64_t hash, HashSetCompareFunction cmpfn)
+{
+	if (!BucketIsAllocated(bucket)) return kNotFound;
+	if (h->entry_offset == 0)
+	{
+		// The search compares against every entry up to the one it finds
+		int pos = VectorSearch(*bucket, keyAddr, cmpfn, 0, false);
+		HASHSET_COUNT_COMPARES(h, (pos == kNotFound) ? VectorLength(*bucket) : pos + 1);
+		return pos;
+	}
+
+	// Only entries with the very same hash code are worth comparing
+	for (int i = 0; i < VectorLength(*bucket); i++)
+	{
+		void * entry = VectorNth(*bucket, i);
+		if (EntryHash(entry) != hash) continue;
+		HASHSET_COUNT_COMPARES(h, 1);
+		if (cmpfn(keyAddr, EntryElem(h, entry)) == 0) return i;
+	}
+	return kNotFound;
+}
+
+static bool HashSetIsOpen(const hashset * h)
+{
+	return h->layout != HashSetChainedLayout;
+}
+
+static bool HashSetIsInitialized(const hashset * h)
+{
+	return HashSetIsOpen(h) ? h->slots != NULL : h->data != NULL;
+}
+
+static bool HashSetIsRehashing(const hashset * h)
+{
+	return h->old_data != NULL;
+}
+
+/* The full hash code of keyAddr, or 0 when the hashset doesn't keep them. */
+static uint64_t HashSetFullHash(const hashset * h, const void * keyAddr, HashSetFullHashFunction fullhashfn)
+{
+	return (h->fullHashFn != NULL) ? fullhashfn(keyAddr) : 0;
+}
+
+/* The code the Bloom filter knows keyAddr by: its full hash code, or failing
+	that its hash code modulo INT_MAX, which the filter mixes anyway. */
+static uint64_t HashSetBloomHash(const hashset * h, const void * keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn)
+{
+	if (h->fullHashFn != NULL) return fullhashfn(keyAddr);
+
+	int hashcode = hashfn(keyAddr, INT_MAX);
+	assert(hashcode >= 0);
+	assert(hashcode < INT_MAX);
+	return hashcode;
+}
+
+static int BucketIndex(const hashset * h, const void * keyAddr, HashSetHashFunction hashfn,
+		uint64_t hash, int bucketsNum)
+{
+	if (h->fullHashFn != NULL) return hash % bucketsNum;
+
+	int bucket_pos = hashfn(keyAddr, bucketsNum);
+	assert(bucket_pos >= 0);
+	assert(bucket_pos < bucketsNum);
+	return bucket_pos;
+}
+
+/* Finds the bucket keyAddr belongs to.  While a rehash is in progress
+	the old buckets at or past migrate_pos haven't moved yet, so elements
+	hashing there are still looked for (and entered) in the old table.  The
+	old bucket at migrate_pos may be partly migrated, though, which is why
+	searches go through HashSetSearch. */
+static vector ** HashSetFindBucket(const hashset * h, const void * keyAddr, HashSetHashFunction hashfn, uint64_t hash)
+{
+	if (HashSetIsRehashing(h))
+	{
+		int old_pos = BucketIndex(h, keyAddr, hashfn, hash, h->old_buckets_num);
+		if (old_pos >= h->migrate_pos) return BucketAt(h->old_data, old_pos);
+	}
+
+	return BucketAt(h->data, BucketIndex(h, keyAddr, hashfn, hash, h->buckets_num));
+}
+
+/* Searches the bucket HashSetFindBucket found for keyAddr, and if that's
+	the old bucket being migrated, the new bucket the entries already moved
+	out of it went to as well.  On success *bucket is the bucket the entry
+	was found in, otherwise it's left as the one to enter keyAddr in. */
+static int HashSetSearch(const hashset * h, vector *** bucket, const void * keyAddr,
+		HashSetHashFunction hashfn, uint64_t hash, HashSetCompareFunction cmpfn)
+{
+	int pos = BucketSearch(h, *bucket, keyAddr, hash, cmpfn);
+	if (pos != kNotFound || !HashSetIsRehashing(h) || *bucket != BucketAt(h->old_data, h->migrate_pos))
+		return pos;
+
+	vector ** moved = BucketAt(h->data, BucketIndex(h, keyAddr, hashfn, hash, h->buckets_num));
+	pos = BucketSearch(h, moved, keyAddr, hash, cmpfn);
+	if (pos != kNotFound) *bucket = moved;
+	return pos;
+}
+
 void HashSetNew(hashset * h, int elemSize, int numBuckets,
 		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn)
 {
@@ -14,104 +200,900 @@ void HashSetNew(hashset * h, int elemSize, int numBuckets,
 	// Asserts checked
 
 	// Initalize stats of numbers and sizes
+	h->layout = HashSetChainedLayout;
 	h->log_len = 0;
 	h->buckets_num = numBuckets;
-	h->bucket_size = sizeof(vector);
+	h->bucket_size = sizeof(vector *);
+	h->elem_size = elemSize;
+	h->max_load = kDefaultMaxLoadFactor;
+	h->min_load = 0;
+
+	// No rehash in progress
+	h->old_data = NULL;
+	h->old_buckets_num = 0;
+	h->migrate_pos = 0;
+	h->incremental = false;
+
+	// Open addressing storage isn't used
+	h->slots = NULL;
+	h->probe_lens = NULL;
+	h->scratch = NULL;
+	h->ctrl = NULL;
+	h->deleted_num = 0;
+
+	// Entries are bare elements until a full hash function is installed
+	h->entry_offset = 0;
+	h->hashes = NULL;
+
+	// No Bloom filter until one is asked for
+	h->bloom.blocks = NULL;
+	h->bloom_bits = 0;
+	HASHSET_COUNT_RESET(h);
 
 	// Initialize functions
 	h->hashFn = hashfn;
+	h->fullHashFn = NULL;
 	h->cmpFn = comparefn;
 	h->freeFn = freefn;
 
-	h->data = malloc(h->buckets_num * sizeof(vector));
+	// Buckets get their vectors on first insert
+	h->data = calloc(h->buckets_num, h->bucket_size);
 	assert(h->data != NULL);
+}
 
-	// Create vectors
-	for (int i = 0; i < h->buckets_num; i++)
-	{
-		vector * create_vec = (vector *)((char *)h->data + i * sizeof(vector)); 
-		VectorNew(create_vec, elemSize, freefn, 4); 
-	}
+/* Shared by the open addressing layouts, which keep their elements in
+	h->slots instead of in bucket vectors. */
+static void HashSetNewOpenLayout(hashset * h, HashSetLayout layout, int elemSize,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn)
+{
+	// Check all assert conditions
+	assert (elemSize > 0);
+	assert (hashfn != NULL);
+	assert (comparefn != NULL);
+	// Asserts checked
+
+	h->layout = layout;
+	h->log_len = 0;
+	h->bucket_size = elemSize;
+	h->elem_size = elemSize;
+	h->max_load = kDefaultOpenMaxLoadFactor;
+	h->min_load = 0;
+
+	// Chained storage isn't used
+	h->data = NULL;
+	h->old_data = NULL;
+	h->old_buckets_num = 0;
+	h->migrate_pos = 0;
+	h->incremental = false;
+	h->entry_offset = 0;
+
+	h->hashFn = hashfn;
+	h->fullHashFn = NULL;
+	h->cmpFn = comparefn;
+	h->freeFn = freefn;
+
+	h->slots = NULL;
+	h->probe_lens = NULL;
+	h->scratch = NULL;
+	h->ctrl = NULL;
+	h->deleted_num = 0;
+	h->hashes = NULL;
+
+	h->bloom.blocks = NULL;
+	h->bloom_bits = 0;
+	HASHSET_COUNT_RESET(h);
+}
+
+void HashSetNewOpen(hashset * h, int elemSize, int numBuckets,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn)
+{
+	assert (numBuckets > 0);
+	HashSetNewOpenLayout(h, HashSetRobinHoodLayout, elemSize, hashfn, comparefn, freefn);
+	RobinHoodNew(h, numBuckets);
+}
+
+void HashSetNewSwiss(hashset * h, int elemSize, int numBuckets,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn)
+{
+	assert (numBuckets > 0);
+	HashSetNewOpenLayout(h, HashSetSwissLayout, elemSize, hashfn, comparefn, freefn);
+	SwissTableNew(h, numBuckets);
 }
 
 void HashSetDispose(hashset * h)
 {
+	BloomFilterDispose(&h->bloom);
+
+	if (h->layout == HashSetRobinHoodLayout)
+	{
+		RobinHoodDispose(h);
+		return;
+	}
+	if (h->layout == HashSetSwissLayout)
+	{
+		SwissTableDispose(h);
+		return;
+	}
+
 	// Delete all the vectors of hashset data
 	assert(h->data != NULL);
 
 	for (int i = 0; i < h->buckets_num; i++)
+		BucketDispose(h, BucketAt(h->data, i), true);
+	free(h->data);
+	free(h->scratch);
+
+	// Buckets before migrate_pos have already been disposed of
+	if (HashSetIsRehashing(h))
 	{
-		vector * vec = (vector *)((char *)h->data + i * h->bucket_size);
-		VectorDispose(vec);
+		for (int i = h->migrate_pos; i < h->old_buckets_num; i++)
+			BucketDispose(h, BucketAt(h->old_data, i), true);
+		free(h->old_data);
 	}
-	free(h->data);
 }
 
 int HashSetCount(const hashset * h)
 {
 	// Return logical size of hashset
-	assert(h->data != NULL);
+	assert(HashSetIsInitialized(h));
 	return h->log_len;
 }
 
+/* An entry's probe length is its position in the bucket plus one, the
+	number of entries a search examines to find it.  Buckets that are still
+	waiting to be migrated count as buckets of their own. */
+static void BucketStats(const hashset * h, vector * const * bucket, hashsetstats * stats)
+{
+	int chain_len = BucketIsAllocated(bucket) ? VectorLength(*bucket) : 0;
+	StatsAddChain(stats, chain_len);
+	for (int i = 0; i < chain_len; i++)
+		StatsAddProbe(stats, i + 1);
+	if (BucketIsAllocated(bucket))
+		stats->bytes_allocated += sizeof(vector) + (size_t)(*bucket)->alloc_len * (h->entry_offset + h->elem_size);
+}
+
+void HashSetStats(const hashset * h, hashsetstats * stats)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(stats != NULL);
+	// Asserts checked
+
+	memset(stats, 0, sizeof(hashsetstats));
+	if (h->layout == HashSetRobinHoodLayout) RobinHoodStats(h, stats);
+		else if (h->layout == HashSetSwissLayout) SwissTableStats(h, stats);
+		else {
+			stats->bytes_allocated = (size_t)h->buckets_num * h->bucket_size;
+			if (h->scratch != NULL) stats->bytes_allocated += h->entry_offset + h->elem_size;
+			for (int i = 0; i < h->buckets_num; i++)
+				BucketStats(h, BucketAt(h->data, i), stats);
+			if (HashSetIsRehashing(h))
+			{
+				stats->bytes_allocated += (size_t)h->old_buckets_num * h->bucket_size;
+				for (int i = h->migrate_pos; i < h->old_buckets_num; i++)
+					BucketStats(h, BucketAt(h->old_data, i), stats);
+			}
+		}
+	assert(stats->elems_num == h->log_len);
+
+	if (h->bloom.blocks != NULL) stats->bytes_allocated += (size_t)h->bloom.blocks_num * sizeof(uint64_t[kBloomFilterBlockWords]);
+	if (stats->used_buckets > 0) stats->mean_chain_len /= stats->used_buckets;
+	if (stats->elems_num > 0) stats->mean_probe_len /= stats->elems_num;
+
+#ifdef HASHSET_STATS
+	stats->counted = true;
+	stats->lookups = h->counters.lookups;
+	stats->lookup_compares = h->counters.lookup_compares;
+	stats->inserts = h->counters.inserts;
+	stats->insert_compares = h->counters.insert_compares;
+	stats->resizes = h->counters.resizes;
+#endif
+}
+
+static void BucketMap(hashset * h, vector ** bucket, HashSetMapFunction mapfn, void * auxData)
+{
+	if (!BucketIsAllocated(bucket)) return;
+	for (int i = 0; i < VectorLength(*bucket); i++)
+		mapfn(EntryElem(h, VectorNth(*bucket, i)), auxData);
+}
+
 void HashSetMap(hashset * h, HashSetMapFunction mapfn, void * auxData)
 {
+	assert(mapfn != NULL);
+	if (h->layout == HashSetRobinHoodLayout)
+	{
+		RobinHoodMap(h, mapfn, auxData);
+		return;
+	}
+	if (h->layout == HashSetSwissLayout)
+	{
+		SwissTableMap(h, mapfn, auxData);
+		return;
+	}
+
 	// Map all the vectors of hashset
 	assert(h->data != NULL);
 	for (int i = 0; i < h->buckets_num; i++)
+		BucketMap(h, BucketAt(h->data, i), mapfn, auxData);
+
+	// Map the buckets that haven't been migrated yet
+	if (HashSetIsRehashing(h))
 	{
-		vector * vec = (vector *)((char *)h->data + i * h->bucket_size); 
-		VectorMap(vec, mapfn, auxData); 
+		for (int i = h->migrate_pos; i < h->old_buckets_num; i++)
+			BucketMap(h, BucketAt(h->old_data, i), mapfn, auxData);
 	}
 }
 
-const int kNotFound = -1;
-void HashSetEnter(hashset * h, const void * elemAddr)
+/* What the threads of a HashSetParallelMap or HashSetParallelReduce share.
+	With an accumulator_size of 0 every thread maps with the same aux_data,
+	otherwise each takes its own accumulator out of the array at aux_data. */
+typedef struct
+{
+	hashset * h;
+	HashSetMapFunction mapfn;
+	void * aux_data;
+	int accumulator_size;
+} MapState;
+
+/* The chained layout is mapped over its new buckets followed by the old
+	ones that still hold elements, so a migration in progress is left be. */
+static int HashSetMapBucketsNum(const hashset * h)
+{
+	if (HashSetIsOpen(h)) return h->buckets_num;
+	return h->buckets_num + (HashSetIsRehashing(h) ? h->old_buckets_num - h->migrate_pos : 0);
+}
+
+static vector ** HashSetMapBucket(const hashset * h, int i)
+{
+	if (i < h->buckets_num) return BucketAt(h->data, i);
+	return BucketAt(h->old_data, h->migrate_pos + i - h->buckets_num);
+}
+
+static void MapRange(int start, int end, int thread, void * auxData)
+{
+	const MapState * state = auxData;
+	hashset * h = state->h;
+	void * aux_data = (char *)state->aux_data + (size_t)thread * state->accumulator_size;
+
+	if (h->layout == HashSetRobinHoodLayout) RobinHoodMapSlots(h, start, end, state->mapfn, aux_data);
+		else if (h->layout == HashSetSwissLayout) SwissTableMapSlots(h, start, end, state->mapfn, aux_data);
+		else {
+			for (int i = start; i < end; i++)
+				BucketMap(h, HashSetMapBucket(h, i), state->mapfn, aux_data);
+		}
+}
+
+void HashSetParallelMap(hashset * h, HashSetMapFunction mapfn, void * auxData, int numThreads)
 {
 	// Check all assert conditions
-	assert(h->data != NULL);
-	assert(elemAddr != NULL); 
+	assert(HashSetIsInitialized(h));
+	assert(mapfn != NULL);
+	assert(numThreads > 0);
+	// Asserts checked
 
-	int bucket_pos = h->hashFn(elemAddr, h->buckets_num);
-	assert(bucket_pos >= 0);
-	assert(bucket_pos < h->buckets_num);
+	MapState state = { h, mapfn, auxData, 0 };
+	ParallelFor(HashSetMapBucketsNum(h), numThreads, MapRange, &state);
+}
+
+void HashSetParallelReduce(hashset * h, HashSetMapFunction mapfn, void * accumulators, int accumulatorSize,
+		int numThreads, HashSetMergeFunction mergefn)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(mapfn != NULL);
+	assert(mergefn != NULL);
+	assert(accumulators != NULL);
+	assert(accumulatorSize > 0);
+	assert(numThreads > 0);
 	// Asserts checked
-	
+
+	MapState state = { h, mapfn, accumulators, accumulatorSize };
+	ParallelFor(HashSetMapBucketsNum(h), numThreads, MapRange, &state);
+	for (int t = 1; t < numThreads; t++)
+		mergefn(accumulators, (char *)accumulators + (size_t)t * accumulatorSize);
+}
+
+/* The chained layout's share of HashSetFindOrInsert and HashSetLookup. */
+static void * HashSetChainedFindOrInsert(hashset * h, const void * elemAddr, bool * inserted)
+{
+	if (HashSetIsRehashing(h)) HashSetRehashStep(h, kRehashWorkPerStep);
+
 	// Find vector in the hashset
-	vector * vec = (vector *)((char *)h->data + bucket_pos * h->bucket_size);
+	uint64_t hash = HashSetFullHash(h, elemAddr, h->fullHashFn);
+	vector ** bucket = HashSetFindBucket(h, elemAddr, h->hashFn, hash);
 
 	// Find element in the vector
-	int pos = VectorSearch(vec, elemAddr, h->cmpFn, 0, false);
-	
-	/* If such element doesn't exist, append it to the vector
-		and increase logical length of hashet.
-	   If such element exists in the vector, replace it on the position POS. */
+	int pos = HashSetSearch(h, &bucket, elemAddr, h->hashFn, hash, h->cmpFn);
+
+	// If such element doesn't exist, append it to the vector
+	*inserted = (pos == kNotFound);
 	if (pos == kNotFound)
 	{
-		VectorAppend(vec, elemAddr);
-	  	h->log_len++;
-	} else VectorReplace(vec, elemAddr, pos);
+		BucketAppend(h, bucket, MakeEntry(h, elemAddr, hash));
+		pos = VectorLength(*bucket) - 1;
+	}
+	return EntryElem(h, VectorNth(*bucket, pos));
 }
 
-void * HashSetLookup(const hashset * h, const void * elemAddr)
+static void * HashSetChainedLookup(const hashset * h, const void * keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn, HashSetCompareFunction cmpfn)
+{
+	// Find vector in the hashset
+	uint64_t hash = HashSetFullHash(h, keyAddr, fullhashfn);
+	vector ** bucket = HashSetFindBucket(h, keyAddr, hashfn, hash);
+
+	// Find element in the vector
+	int pos = HashSetSearch(h, &bucket, keyAddr, hashfn, hash, cmpfn);
+
+	/* If such element doesn't exist, return NULL,
+		else return pointer of the element of the POS index in the vector */
+	if (pos == kNotFound) return NULL;
+	return EntryElem(h, VectorNth(*bucket, pos));
+}
+
+/* Looks the key up in whichever layout the hashset uses, hashing and
+	comparing it with the supplied functions. */
+static void * HashSetFindKey(const hashset * h, const void * keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn, HashSetCompareFunction cmpfn)
+{
+	if (h->bloom_bits != 0 && !BloomFilterMayContain(&h->bloom, HashSetBloomHash(h, keyAddr, hashfn, fullhashfn)))
+		return NULL;
+	if (h->layout == HashSetRobinHoodLayout) return RobinHoodLookup(h, keyAddr, hashfn, fullhashfn, cmpfn);
+	if (h->layout == HashSetSwissLayout) return SwissTableLookup(h, keyAddr, hashfn, fullhashfn, cmpfn);
+	return HashSetChainedLookup(h, keyAddr, hashfn, fullhashfn, cmpfn);
+}
+
+/* Finds or inserts the element in whichever layout the hashset uses, and
+	keeps the logical length up to date.  Growing is left to the caller. */
+static void * HashSetFindOrInsertElem(hashset * h, const void * elemAddr, bool * inserted)
+{
+	void * elem;
+	if (h->layout == HashSetRobinHoodLayout) elem = RobinHoodFindOrInsert(h, elemAddr, inserted);
+		else if (h->layout == HashSetSwissLayout) elem = SwissTableFindOrInsert(h, elemAddr, inserted);
+		else elem = HashSetChainedFindOrInsert(h, elemAddr, inserted);
+	if (!*inserted) return elem;
+
+	h->log_len++;
+	if (h->bloom_bits != 0) BloomFilterAdd(&h->bloom, HashSetBloomHash(h, elemAddr, h->hashFn, h->fullHashFn));
+	return elem;
+}
+
+void HashSetEnter(hashset * h, const void * elemAddr)
 {
 	// Check all assert conditions
-	assert(h->data != NULL);
+	assert(HashSetIsInitialized(h));
 	assert(elemAddr != NULL);
+	// Asserts checked
 
-	int bucket_pos = h->hashFn(elemAddr, h->buckets_num);
-	assert(bucket_pos >= 0);
-	assert(bucket_pos < h->buckets_num);
+	HASHSET_COUNT_OPERATIONS(h, insert, 1);
+	bool inserted;
+	void * elem = HashSetFindOrInsertElem(h, elemAddr, &inserted);
+
+	if (inserted)
+	{
+		HashSetGrowIfNeeded(h, h->log_len);
+		return;
+	}
+
+	// If such element already exists, replace it
+	if (h->freeFn != NULL) h->freeFn(elem);
+	memcpy(elem, elemAddr, h->elem_size);
+}
+
+void * HashSetFindOrInsert(hashset * h, const void * elemAddr, bool * inserted)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(elemAddr != NULL);
 	// Asserts checked
 
+	HASHSET_COUNT_OPERATIONS(h, insert, 1);
+	bool elem_inserted;
+	void * elem = HashSetFindOrInsertElem(h, elemAddr, &elem_inserted);
+	if (inserted != NULL) *inserted = elem_inserted;
+	if (!elem_inserted || !HashSetGrowIfNeeded(h, h->log_len)) return elem;
+
+	// The new element moved along with all the others, so find it again
+	return HashSetFindKey(h, elemAddr, h->hashFn, h->fullHashFn, h->cmpFn);
+}
+
+/* Entries within a bucket are in no particular order, so the last one
+	fills the hole, and a bucket left empty gives its vector back. */
+static bool HashSetChainedRemove(hashset * h, const void * elemAddr)
+{
+	if (HashSetIsRehashing(h)) HashSetRehashStep(h, kRehashWorkPerStep);
+
 	// Find vector in the hashset
-	vector * vec = (vector *)((char *)h->data + bucket_pos * h->bucket_size);
+	uint64_t hash = HashSetFullHash(h, elemAddr, h->fullHashFn);
+	vector ** bucket = HashSetFindBucket(h, elemAddr, h->hashFn, hash);
 
 	// Find element in the vector
-	int pos = VectorSearch(vec, elemAddr, h->cmpFn, 0, false);
-  
-	/* If such element doesn't exist, return NULL,
-		else return pointer of the element of the POS index in the vector */
-	if (pos == kNotFound) return NULL;
-	return (void *)VectorNth(vec, pos);
+	int pos = HashSetSearch(h, &bucket, elemAddr, h->hashFn, hash, h->cmpFn);
+	if (pos == kNotFound) return false;
+
+	if (h->freeFn != NULL) h->freeFn(EntryElem(h, VectorNth(*bucket, pos)));
+	int last_pos = VectorLength(*bucket) - 1;
+	if (pos != last_pos) memcpy(VectorNth(*bucket, pos), VectorNth(*bucket, last_pos), h->entry_offset + h->elem_size);
+	VectorDelete(*bucket, last_pos);
+
+	if (VectorLength(*bucket) == 0) BucketDispose(h, bucket, false);
+	return true;
+}
+
+bool HashSetRemove(hashset * h, const void * elemAddr)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(elemAddr != NULL);
+	// Asserts checked
+
+	HASHSET_COUNT_NO_COMPARES(h);
+	bool removed;
+	if (h->layout == HashSetRobinHoodLayout) removed = RobinHoodRemove(h, elemAddr);
+		else if (h->layout == HashSetSwissLayout) removed = SwissTableRemove(h, elemAddr);
+		else removed = HashSetChainedRemove(h, elemAddr);
+	if (!removed) return false;
+
+	h->log_len--;
+	HashSetShrinkIfNeeded(h);
+	return true;
+}
+
+void * HashSetLookup(const hashset * h, const void * elemAddr)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(elemAddr != NULL);
+	// Asserts checked
+
+	HASHSET_COUNT_OPERATIONS(h, lookup, 1);
+	return HashSetFindKey(h, elemAddr, h->hashFn, h->fullHashFn, h->cmpFn);
+}
+
+void * HashSetLookupKey(const hashset * h, const void * keyAddr, HashSetHashFunction keyhashfn,
+		HashSetFullHashFunction keyfullhashfn, HashSetCompareFunction keycmpfn)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(keyAddr != NULL);
+	assert(keyhashfn != NULL);
+	assert(keycmpfn != NULL);
+	assert(h->fullHashFn == NULL || keyfullhashfn != NULL);
+	// Asserts checked
+
+	HASHSET_COUNT_OPERATIONS(h, lookup, 1);
+	return HashSetFindKey(h, keyAddr, keyhashfn, keyfullhashfn, keycmpfn);
+}
+
+/* Resolves a batch of lookups in stages, and at each stage prefetches what
+	the next one will touch for every key in the batch: first the bucket
+	pointer, then the bucket's vector, then the vector's entries.  The cache
+	misses of all the keys then overlap instead of following one another.
+	Keys the Bloom filter rules out are dropped as they're hashed, and the
+	stages after that only touch memory for the ones that got past it. */
+static void HashSetChainedLookupBatch(const hashset * h, const void * keys, int n, void ** results)
+{
+	uint64_t hashes[kLookupBatchSize];
+	vector ** buckets[kLookupBatchSize];
+	bool ruled_out[kLookupBatchSize];
+
+	for (int start = 0; start < n; start += kLookupBatchSize)
+	{
+		int batch_len = (n - start < kLookupBatchSize) ? n - start : kLookupBatchSize;
+		const char * batch_keys = (const char *)keys + (size_t)start * h->elem_size;
+
+		for (int i = 0; i < batch_len; i++)
+		{
+			const void * key = batch_keys + (size_t)i * h->elem_size;
+			hashes[i] = HashSetFullHash(h, key, h->fullHashFn);
+			ruled_out[i] = h->bloom_bits != 0 && !BloomFilterMayContain(&h->bloom, BloomCode(h, key, hashes[i]));
+			if (ruled_out[i]) continue;
+			buckets[i] = HashSetFindBucket(h, key, h->hashFn, hashes[i]);
+			__builtin_prefetch(buckets[i]);
+		}
+		for (int i = 0; i < batch_len; i++)
+			if (!ruled_out[i] && BucketIsAllocated(buckets[i])) __builtin_prefetch(*buckets[i]);
+		for (int i = 0; i < batch_len; i++)
+			if (!ruled_out[i] && BucketIsAllocated(buckets[i])) __builtin_prefetch(VectorNth(*buckets[i], 0));
+
+		for (int i = 0; i < batch_len; i++)
+		{
+			const void * key = batch_keys + (size_t)i * h->elem_size;
+			if (ruled_out[i])
+			{
+				results[start + i] = NULL;
+				continue;
+			}
+			int pos = HashSetSearch(h, &buckets[i], key, h->hashFn, hashes[i], h->cmpFn);
+			results[start + i] = (pos == kNotFound) ? NULL : EntryElem(h, VectorNth(*buckets[i], pos));
+		}
+	}
+}
+
+void HashSetLookupBatch(const hashset * h, const void * keys, int n, void ** results)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(n >= 0);
+	assert(n == 0 || (keys != NULL && results != NULL));
+	// Asserts checked
+
+	HASHSET_COUNT_OPERATIONS(h, lookup, n);
+	if (h->layout == HashSetRobinHoodLayout) RobinHoodLookupBatch(h, keys, n, results);
+		else if (h->layout == HashSetSwissLayout) SwissTableLookupBatch(h, keys, n, results);
+		else HashSetChainedLookupBatch(h, keys, n, results);
+}
+
+void HashSetSetMaxLoadFactor(hashset * h, double maxLoad)
+{
+	assert(HashSetIsInitialized(h));
+	assert(maxLoad > 0);
+	assert(!HashSetIsOpen(h) || maxLoad < 1);
+	assert(2 * h->min_load < maxLoad);
+
+	h->max_load = maxLoad;
+	if (!HashSetGrowIfNeeded(h, h->log_len)) HashSetRebuildBloomFilter(h);
+}
+
+void HashSetSetMinLoadFactor(hashset * h, double minLoad)
+{
+	assert(HashSetIsInitialized(h));
+	assert(minLoad >= 0);
+	assert(2 * minLoad < h->max_load);
+
+	h->min_load = minLoad;
+	HashSetShrinkIfNeeded(h);
+}
+
+void HashSetReserve(hashset * h, int numElems)
+{
+	assert(HashSetIsInitialized(h));
+	assert(numElems >= 0);
+
+	HashSetGrowIfNeeded(h, numElems);
+}
+
+/* What the threads of a HashSetBuildFrom share.  counts holds one row of
+	bucket counts per thread, which the counting sort then turns into the
+	positions in order where each thread's elements of each bucket go, so
+	that every bucket's elements end up together and in input order. */
+typedef struct
+{
+	hashset * h;
+	const char * elems;
+	int threads_num;
+	uint64_t * hashes;
+	int * bucket_of;
+	int * counts;
+	int * bucket_starts;
+	int * order;
+	int * inserted;
+} BuildState;
+
+static const void * BuildElem(const BuildState * state, int i)
+{
+	return state->elems + (size_t)i * state->h->elem_size;
+}
+
+static void HashElems(int start, int end, int thread, void * auxData)
+{
+	BuildState * state = auxData;
+	hashset * h = state->h;
+	int * counts = state->counts + (size_t)thread * h->buckets_num;
+	for (int i = start; i < end; i++)
+	{
+		const void * elem = BuildElem(state, i);
+		uint64_t hash = HashSetFullHash(h, elem, h->fullHashFn);
+		if (state->hashes != NULL) state->hashes[i] = hash;
+		state->bucket_of[i] = BucketIndex(h, elem, h->hashFn, hash, h->buckets_num);
+		counts[state->bucket_of[i]]++;
+	}
+}
+
+/* Gets the same range of elements as in HashElems, since ParallelFor splits
+	the same n over the same number of threads the same way. */
+static void ScatterElems(int start, int end, int thread, void * auxData)
+{
+	BuildState * state = auxData;
+	int * positions = state->counts + (size_t)thread * state->h->buckets_num;
+	for (int i = start; i < end; i++)
+		state->order[positions[state->bucket_of[i]]++] = i;
+}
+
+/* Fills the buckets [start, end), each vector allocated for everything bound
+	for it.  Equal elements always share a bucket, so each thread can settle
+	its own duplicates, the later one replacing the earlier as in HashSetEnter. */
+static void FillBuckets(int start, int end, int thread, void * auxData)
+{
+	BuildState * state = auxData;
+	hashset * h = state->h;
+	char * entry = malloc(h->entry_offset + h->elem_size);
+	assert(entry != NULL);
+	int inserted = 0;
+
+	for (int b = start; b < end; b++)
+	{
+		int first = state->bucket_starts[b], last = state->bucket_starts[b + 1];
+		if (first == last) continue;
+		vector ** bucket = BucketAt(h->data, b);
+		BucketDispose(h, bucket, false);
+		*bucket = malloc(sizeof(vector));
+		assert(*bucket != NULL);
+		VectorNew(*bucket, h->entry_offset + h->elem_size, NULL, last - first);
+
+		for (int k = first; k < last; k++)
+		{
+			int i = state->order[k];
+			const void * elem = BuildElem(state, i);
+			uint64_t hash = (state->hashes != NULL) ? state->hashes[i] : 0;
+			int pos = BucketSearch(h, bucket, elem, hash, h->cmpFn);
+			if (pos != kNotFound)
+			{
+				void * resident = EntryElem(h, VectorNth(*bucket, pos));
+				if (h->freeFn != NULL) h->freeFn(resident);
+				memcpy(resident, elem, h->elem_size);
+				continue;
+			}
+
+			memcpy(entry, &hash, h->entry_offset);
+			memcpy(EntryElem(h, entry), elem, h->elem_size);
+			VectorAppend(*bucket, entry);
+			inserted++;
+		}
+	}
+
+	state->inserted[thread] = inserted;
+	free(entry);
+}
+
+void HashSetBuildFrom(hashset * h, const void * elems, int n, int numThreads)
+{
+	// Check all assert conditions
+	assert(HashSetIsInitialized(h));
+	assert(h->log_len == 0);
+	assert(elems != NULL || n == 0);
+	assert(n >= 0);
+	assert(numThreads > 0);
+	// Asserts checked
+
+	if (HashSetIsOpen(h))
+	{
+		HashSetReserve(h, n);
+		for (int i = 0; i < n; i++)
+			HashSetEnter(h, (const char *)elems + (size_t)i * h->elem_size);
+		return;
+	}
+
+	// The bucket array is sized for all n up front, and it has nothing to move
+	HashSetFinishRehash(h);
+	HashSetGrowIfNeeded(h, n);
+	HASHSET_COUNT_OPERATIONS(h, insert, n);
+	HASHSET_COUNT_NO_COMPARES(h);
+
+	BuildState state = { h, elems, numThreads };
+	state.hashes = (h->fullHashFn != NULL) ? malloc(n * sizeof(uint64_t)) : NULL;
+	state.bucket_of = malloc(n * sizeof(int));
+	state.counts = calloc((size_t)numThreads * h->buckets_num, sizeof(int));
+	state.bucket_starts = malloc((h->buckets_num + 1) * sizeof(int));
+	state.order = malloc(n * sizeof(int));
+	state.inserted = malloc(numThreads * sizeof(int));
+	assert((state.bucket_of != NULL && state.order != NULL) || n == 0);
+	assert(state.hashes != NULL || h->fullHashFn == NULL || n == 0);
+	assert(state.counts != NULL && state.bucket_starts != NULL && state.inserted != NULL);
+
+	ParallelFor(n, numThreads, HashElems, &state);
+
+	// Bucket by bucket, thread by thread, each count becomes a starting position
+	int pos = 0;
+	for (int b = 0; b < h->buckets_num; b++)
+	{
+		state.bucket_starts[b] = pos;
+		for (int t = 0; t < numThreads; t++)
+		{
+			int * count = &state.counts[(size_t)t * h->buckets_num + b];
+			int bucket_count = *count;
+			*count = pos;
+			pos += bucket_count;
+		}
+	}
+	state.bucket_starts[h->buckets_num] = pos;
+
+	ParallelFor(n, numThreads, ScatterElems, &state);
+	ParallelFor(h->buckets_num, numThreads, FillBuckets, &state);
+	for (int t = 0; t < numThreads; t++)
+		h->log_len += state.inserted[t];
+
+	free(state.hashes);
+	free(state.bucket_of);
+	free(state.counts);
+	free(state.bucket_starts);
+	free(state.order);
+	free(state.inserted);
+	HashSetRebuildBloomFilter(h);
+}
+
+void HashSetSetIncrementalRehash(hashset * h, bool incremental)
+{
+	assert(HashSetIsInitialized(h));
+
+	h->incremental = incremental;
+	if (!incremental) HashSetFinishRehash(h);
+}
+
+/* The hashset is empty, so switching representations only means rebuilding
+	the (empty) storage: the open layouts allocate h->hashes alongside their
+	slots when they see a fullHashFn, and bucket vectors are sized for entries
+	when they're created, which is why any left over from earlier inserts
+	and lookups have to go. */
+void HashSetSetFullHashFunction(hashset * h, HashSetFullHashFunction fullhashfn)
+{
+	assert(HashSetIsInitialized(h));
+	assert(h->log_len == 0);
+	assert(fullhashfn != NULL);
+
+	h->fullHashFn = fullhashfn;
+	if (h->layout == HashSetRobinHoodLayout) RobinHoodRehash(h, h->buckets_num);
+		else if (h->layout == HashSetSwissLayout) SwissTableRehash(h, h->buckets_num);
+		else {
+			HashSetFinishRehash(h);
+			for (int i = 0; i < h->buckets_num; i++)
+				BucketDispose(h, BucketAt(h->data, i), false);
+
+			h->entry_offset = sizeof(uint64_t);
+			free(h->scratch);
+			h->scratch = malloc(h->entry_offset + h->elem_size);
+			assert(h->scratch != NULL);
+		}
+
+	// The filter knows elements by their full hash codes from now on
+	HashSetRebuildBloomFilter(h);
+}
+
+void HashSetSetBloomFilter(hashset * h, int bitsPerElem)
+{
+	assert(HashSetIsInitialized(h));
+	assert(bitsPerElem >= 0);
+
+	h->bloom_bits = bitsPerElem;
+	HashSetRebuildBloomFilter(h);
+}
+
+static void AddToBloomFilter(void * elemAddr, void * auxData)
+{
+	hashset * h = auxData;
+	BloomFilterAdd(&h->bloom, HashSetBloomHash(h, elemAddr, h->hashFn, h->fullHashFn));
+}
+
+/* Sizes the filter for as many elements as the hashset holds before it
+	next grows, and fills it with the ones it holds now, which also clears
+	out any removed since the last rebuild. */
+static void HashSetRebuildBloomFilter(hashset * h)
+{
+	BloomFilterDispose(&h->bloom);
+	h->bloom.blocks = NULL;
+	if (h->bloom_bits == 0) return;
+
+	int capacity = h->max_load * h->buckets_num;
+	if (capacity < h->log_len) capacity = h->log_len;
+	BloomFilterNew(&h->bloom, capacity, h->bloom_bits);
+	HashSetMap(h, AddToBloomFilter, h);
+}
+
+static void HashSetResize(hashset * h, int newBucketsNum)
+{
+	if (h->layout == HashSetRobinHoodLayout) RobinHoodRehash(h, newBucketsNum);
+		else if (h->layout == HashSetSwissLayout) SwissTableRehash(h, newBucketsNum);
+		else HashSetRehash(h, newBucketsNum);
+	HashSetRebuildBloomFilter(h);
+	HASHSET_COUNT_RESIZE(h);
+}
+
+/* Keeps doubling the number of buckets until numElems fit under the maximum
+	load factor, then rehashes once.  The count grows to 2n + 1, which keeps
+	it odd and treats the usual hashcode % numBuckets functions kindly, except
+	for the Swiss layout, whose slot count must stay a power of two.
+
+	Slots the Swiss layout has marked deleted lengthen searches just like
+	elements do, so they count towards its load too.  When it's only them
+	pushing the load over the maximum, the table is rehashed at its current
+	size, which clears them all.  Returns true if the hashset was rehashed. */
+static bool HashSetGrowIfNeeded(hashset * h, int numElems)
+{
+	int new_buckets_num = h->buckets_num;
+	while (numElems > h->max_load * new_buckets_num)
+	{
+		assert(new_buckets_num <= (kMaxBucketsNum - 1) / 2);
+		new_buckets_num = 2 * new_buckets_num + (h->layout != HashSetSwissLayout);
+	}
+
+	if (new_buckets_num == h->buckets_num && numElems + h->deleted_num <= h->max_load * h->buckets_num) return false;
+	HashSetResize(h, new_buckets_num);
+	return true;
+}
+
+/* The reverse of HashSetGrowIfNeeded: halves the number of buckets (2n + 1
+	back to n) for as long as the load factor stays under the minimum. */
+static void HashSetShrinkIfNeeded(hashset * h)
+{
+	int min_buckets_num = (h->layout == HashSetSwissLayout) ? kSwissGroupSize : 1;
+	int new_buckets_num = h->buckets_num;
+	while (h->log_len < h->min_load * new_buckets_num && new_buckets_num / 2 >= min_buckets_num)
+		new_buckets_num /= 2;
+
+	if (new_buckets_num != h->buckets_num) HashSetResize(h, new_buckets_num);
+}
+
+/* Swaps in a fresh (all NULL) bucket array and makes the current one the old
+	table, whose buckets get migrated by HashSetRehashStep.  Unless the hashset
+	is in incremental mode, the whole migration happens right here. */
+static void HashSetRehash(hashset * h, int newBucketsNum)
+{
+	// Only one migration can be in flight at a time
+	HashSetFinishRehash(h);
+
+	vector ** new_data = calloc(newBucketsNum, h->bucket_size);
+	assert(new_data != NULL);
+
+	h->old_data = h->data;
+	h->old_buckets_num = h->buckets_num;
+	h->migrate_pos = 0;
+
+	h->data = new_data;
+	h->buckets_num = newBucketsNum;
+
+	if (!h->incremental) HashSetFinishRehash(h);
+}
+
+/* Does about work units of migration, a unit being one entry moved or one
+	old bucket left behind.  Entries come off the end of the old bucket at
+	migrate_pos, so a bucket can be left partly migrated between steps; a
+	long chain then costs no more per step than a short one.  Only
+	insertions and removals take steps, each of them kRehashWorkPerStep
+	units, which at the default load factor passes a couple of old buckets,
+	more than the one per insertion that finishes the migration before the
+	new table fills.  At much lower maximum load factors it may not, and then
+	HashSetRehash finishing any migration still in progress is what
+	guarantees it completes.  Stored hash codes travel with their entries,
+	so they're never recomputed. */
+static void HashSetRehashStep(hashset * h, int work)
+{
+	while (work > 0 && h->migrate_pos < h->old_buckets_num)
+	{
+		vector ** old_bucket = BucketAt(h->old_data, h->migrate_pos);
+		if (!BucketIsAllocated(old_bucket))
+		{
+			h->migrate_pos++;
+			work--;
+			continue;
+		}
+
+		// Move entries off the end into their new buckets, copying them bitwise
+		int len = VectorLength(*old_bucket);
+		int moved_num = (len < work) ? len : work;
+		for (int j = len - moved_num; j < len; j++)
+		{
+			void * entry = VectorNth(*old_bucket, j);
+			uint64_t hash = (h->entry_offset != 0) ? EntryHash(entry) : 0;
+			int bucket_pos = BucketIndex(h, EntryElem(h, entry), h->hashFn, hash, h->buckets_num);
+			BucketAppend(h, BucketAt(h->data, bucket_pos), entry);
+		}
+		work -= moved_num;
+
+		// Elements now live in the new buckets, so they mustn't be freed here
+		if (moved_num == len) BucketDispose(h, old_bucket, false);
+			else VectorDeleteRange(*old_bucket, len - moved_num, moved_num);
+	}
+
+	if (h->migrate_pos == h->old_buckets_num)
+	{
+		free(h->old_data);
+		h->old_data = NULL;
+		h->old_buckets_num = 0;
+		h->migrate_pos = 0;
+	}
+}
+
+static void HashSetFinishRehash(hashset * h)
+{
+	if (HashSetIsRehashing(h)) HashSetRehashStep(h, INT_MAX);
 }
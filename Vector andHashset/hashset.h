@@ -1,6 +1,9 @@
 #ifndef _hashset_
 #define _hashset_
 #include "vector.h"
+#include "bloomfilter.h"
+#include <stddef.h>
+#include <stdint.h>
 
 /* File: hashtable.h
  * ------------------
@@ -21,6 +24,18 @@
 
 typedef int (*HashSetHashFunction)(const void *elemAddr, int numBuckets);
 
+/**
+ * Type: HashSetFullHashFunction
+ * -----------------------------
+ * Class of function designed to map the element at the specified elemAddr
+ * to a full 64-bit hash code, without reducing it to any particular number
+ * of buckets.  The same stability requirement applies as for the
+ * HashSetHashFunction: equal elements must always produce equal codes.
+ * See HashSetSetFullHashFunction for how a hashset puts it to use.
+ */
+
+typedef uint64_t (*HashSetFullHashFunction)(const void *elemAddr);
+
 /**
  * Type: HashSetCompareFunction
  * ----------------------------
@@ -62,6 +77,55 @@ typedef void (*HashSetMapFunction)(void *elemAddr, void *auxData);
 
 typedef void (*HashSetFreeFunction)(void *elemAddr);
 
+/**
+ * Type: HashSetMergeFunction
+ * --------------------------
+ * Class of function that HashSetParallelReduce uses to fold what one
+ * thread accumulated (at threadAccumulator) into the accumulator at
+ * accumulator.  Whatever threadAccumulator owns is the merge function's
+ * to take over or release.
+ */
+
+typedef void (*HashSetMergeFunction)(void *accumulator, void *threadAccumulator);
+
+/**
+ * Type: HashSetLayout
+ * -------------------
+ * Identifies how a hashset stores its elements.  The chained layout
+ * (HashSetNew) keeps a vector of elements per bucket.  The Robin Hood
+ * layout (HashSetNewOpen) stores the elements inline in one flat array
+ * and resolves collisions with Robin Hood linear probing.  The Swiss
+ * layout (HashSetNewSwiss) also stores elements inline, but probes groups
+ * of slots at once using a byte of hash per slot.
+ */
+
+typedef enum {
+  HashSetChainedLayout,
+  HashSetRobinHoodLayout,
+  HashSetSwissLayout
+} HashSetLayout;
+
+/**
+ * Type: hashsetcounters
+ * ---------------------
+ * The running counts behind the counters of HashSetStats, which a hashset
+ * only keeps when the library is built with HASHSET_STATS defined (see
+ * the Makefile).  Every file using the hashset has to be built the same
+ * way, since the counters change the size of the hashset.  compares points
+ * at whichever of the two comparison counts the operation under way is
+ * charged to, or is NULL if it isn't being counted.
+ */
+
+typedef struct
+{
+  long lookups;
+  long lookup_compares;
+  long inserts;
+  long insert_compares;
+  long resizes;
+  long * compares;
+} hashsetcounters;
+
 /**
  * Type: hashset
  * -------------
@@ -69,18 +133,44 @@ typedef void (*HashSetFreeFunction)(void *elemAddr);
  * In spite of all of the fields being publicly accessible, the
  * client is absolutely required to initialize, dispose of, and
  * otherwise interact with all hashset instances via the suite
- * of the six hashset-related functions described below.
+ * of the hashset-related functions described below.
  */
 
 typedef struct
 {
-  vector * data;
+  HashSetLayout layout;
+  vector ** data;
   int log_len;
   int buckets_num;
   int bucket_size;
+  int elem_size;
+  double max_load;
+  double min_load;
+
+  vector ** old_data;
+  int old_buckets_num;
+  int migrate_pos;
+  bool incremental;
+
+  void * slots;
+  unsigned short * probe_lens;
+  void * scratch;
+  signed char * ctrl;
+  int deleted_num;
+
+  int entry_offset;
+  uint64_t * hashes;
+
+  bloomfilter bloom;
+  int bloom_bits;
+
+#ifdef HASHSET_STATS
+  hashsetcounters counters;
+#endif
 
   void (*freeFn)(void *); 
   int (*hashFn)(const void *, int);
+  uint64_t (*fullHashFn)(const void *);
   int (*cmpFn)(const void *, const void *);
 } hashset;
 
@@ -97,9 +187,14 @@ typedef struct
  * raised if this size is less than or equal to 0.
  *
  * The numBuckets parameter specifies the number of buckets that the elements
- * will be partitioned into.  Once a hashset is created, this number does
- * not change.  The numBuckets parameter must be in sync with the behavior of
- * the hashfn, which must return a hash code between 0 and numBuckets - 1.   
+ * will initially be partitioned into.  Buckets are only allocated once
+ * something is entered into them (an empty bucket costs a single NULL
+ * pointer), so generous bucket counts are cheap.  The hashset tracks its load factor
+ * (elements per bucket) and, once it exceeds the maximum load factor (see
+ * HashSetSetMaxLoadFactor), grows the bucket array and rehashes every element,
+ * so numBuckets is only a starting guess.  The hashfn is always called with
+ * the current number of buckets and must return a hash code between 0 and
+ * that number minus 1.
  * The hashfn parameter specifies the function that is called to retrieve the
  * hash code for a given element.  See the type declaration of HashSetHashFunction
  * above for more information.  An assert is raised if numBuckets is less than or
@@ -126,6 +221,51 @@ typedef struct
 void HashSetNew(hashset *h, int elemSize, int numBuckets, 
 		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn);
 
+/**
+ * Function:  HashSetNewOpen
+ * -------------------------
+ * Initializes the identified hashset to be empty, exactly like HashSetNew
+ * and with the same parameters, except that the hashset uses open addressing:
+ * all elements live inline in a single flat array of slots, and numBuckets is
+ * the initial number of slots.  The hashfn is called with the current number of
+ * slots and picks the element's home slot.  Collisions are resolved with Robin
+ * Hood linear probing (an element entering the table displaces any element that
+ * sits closer to its own home slot), which keeps probe sequences short and lets
+ * unsuccessful lookups stop early, and deletion shifts the following elements
+ * back instead of leaving tombstones.
+ *
+ * Because there are no per-bucket allocations, a lookup touches one
+ * contiguous run of slots and only calls comparefn on elements that share the
+ * key's home slot.  The maximum load factor of an open hashset defaults to
+ * 0.875 and must stay below 1.  Open hashsets always rehash all at once.
+ */
+
+void HashSetNewOpen(hashset *h, int elemSize, int numBuckets,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn);
+
+/**
+ * Function:  HashSetNewSwiss
+ * --------------------------
+ * Initializes the identified hashset to be empty, exactly like HashSetNew
+ * and with the same parameters, except that the elements are stored inline in
+ * groups of 16 slots, alongside one control byte per slot.  The control byte of
+ * a full slot holds 7 bits of its element's hash, so a lookup compares the key's
+ * 7 bits against a whole group at once (with a single SSE2 instruction where
+ * available) and only calls comparefn on the slots that match.  This makes the
+ * layout a good fit for read-heavy sets, particularly ones that see many
+ * unsuccessful lookups.
+ *
+ * The slot count is numBuckets rounded up to a power of two.  Rather than
+ * reducing elements to a slot directly, the hashset calls hashfn with a very
+ * large numBuckets (INT_MAX) and derives both the group and the control byte
+ * from the result, so hashfn should spread its codes over that whole range.
+ * As with HashSetNewOpen, the maximum load factor defaults to 0.875 and must
+ * stay below 1, and the hashset always rehashes all at once.
+ */
+
+void HashSetNewSwiss(hashset *h, int elemSize, int numBuckets,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn);
+
 /**
  * Function: HashSetDispose
  * ------------------------
@@ -153,6 +293,65 @@ void HashSetDispose(hashset *h);
 
 int HashSetCount(const hashset *h);
 
+/**
+ * Type: hashsetstats
+ * ------------------
+ * What HashSetStats reports about a hashset, to size its buckets and
+ * judge its hash function by.  A bucket is a bucket vector in the chained
+ * layout, a home slot in the Robin Hood layout, and a group of slots in
+ * the Swiss layout, and its chain is every element whose search starts
+ * there.  histogram[k] is the number of buckets with chains of k elements,
+ * except that the last entry counts every longer chain as well.  An
+ * element's probe length is how far its search goes before finding it:
+ * the entries examined in the chained layout, the slots in the Robin Hood
+ * layout and the groups in the Swiss layout, 1 at best.
+ *
+ * The counts from lookups on are only kept if the hashset was built with
+ * HASHSET_STATS defined, which is what counted says; otherwise they're
+ * all 0.  lookups counts HashSetLookup, HashSetLookupKey and every key of
+ * HashSetLookupBatch, inserts counts HashSetEnter, HashSetFindOrInsert
+ * and every element given to HashSetBuildFrom, and the compares are the
+ * calls to the compare function they make (except from HashSetBuildFrom,
+ * whose threads don't count theirs).  resizes counts the times the hashset
+ * grew or shrank.
+ */
+
+enum { kHashSetStatsHistogramSize = 16 };
+
+typedef struct
+{
+  int elems_num;
+  int buckets_num;
+  int used_buckets;
+  int histogram[kHashSetStatsHistogramSize];
+  int max_chain_len;
+  double mean_chain_len;
+  int max_probe_len;
+  double mean_probe_len;
+  size_t bytes_allocated;
+
+  bool counted;
+  long lookups;
+  long lookup_compares;
+  long inserts;
+  long insert_compares;
+  long resizes;
+} hashsetstats;
+
+/**
+ * Function: HashSetStats
+ * ----------------------
+ * Fills in *stats for the specified hashset.  mean_chain_len is the
+ * average over the used buckets (those holding at least one element) and
+ * mean_probe_len the average over the elements, both 0 when the hashset
+ * is empty.  bytes_allocated covers every block of memory the hashset
+ * itself owns, but not memory the elements point to.  Takes time
+ * proportional to the number of buckets, and longer for the Swiss layout
+ * without a full hash function, since every element is hashed again.
+ */
+
+void HashSetStats(const hashset *h, hashsetstats *stats);
+
 /**
  * Function: HashSetEnter
  * ----------------------
@@ -161,6 +360,10 @@ int HashSetCount(const hashset *h);
  * element previously inserted (as far as the hash
  * and compare functions are concerned), the the
  * old element is replaced by this new element.
+ * If the insertion pushes the load factor over the
+ * maximum, the hashset grows and rehashes, so any
+ * addresses previously returned by HashSetLookup
+ * should be considered invalid after this call.
  *
  * An assert is raised if the specified address is NULL, or
  * if the embedded hash function somehow computes a hash code
@@ -169,6 +372,53 @@ int HashSetCount(const hashset *h);
 
 void HashSetEnter(hashset *h, const void *elemAddr);
 
+/**
+ * Function: HashSetFindOrInsert
+ * -----------------------------
+ * Looks for an element matching the one at the specified elemAddr
+ * and, if there isn't one, inserts a copy of it, all in a single
+ * pass over the table.  Either way the address of the resident
+ * element is returned, and *inserted (if inserted isn't NULL) is
+ * set to true if the element was just inserted, or false if a
+ * matching element was already present, in which case that element
+ * is left as it was (unlike HashSetEnter, nothing is replaced).
+ *
+ * This is the way to build up an index: look a key up, and if it's
+ * new, fill in the rest of the freshly inserted element through the
+ * returned address (provided that doesn't change how it hashes or
+ * compares).  The address stays valid until the next call to
+ * HashSetEnter, HashSetFindOrInsert or HashSetRemove, or to a function
+ * that can resize the table (HashSetReserve, HashSetSetMaxLoadFactor,
+ * HashSetSetMinLoadFactor or HashSetSetIncrementalRehash).
+ *
+ * An assert is raised if the specified address is NULL, or
+ * if the embedded hash function somehow computes a hash code
+ * for the element that is out of the [0, numBuckets) range.
+ */
+
+void *HashSetFindOrInsert(hashset *h, const void *elemAddr, bool *inserted);
+
+/**
+ * Function: HashSetRemove
+ * -----------------------
+ * Removes the element matching the one at the specified elemAddr (as far
+ * as the hash and compare functions are concerned), applying the free
+ * function supplied at construction time to it first.  Returns true if an
+ * element was removed, or false if there was no match.  If the removal
+ * takes the load factor under the minimum (see HashSetSetMinLoadFactor),
+ * the hashset shrinks and rehashes.  Either way, any addresses previously
+ * returned by HashSetLookup should be considered invalid after this call.
+ *
+ * Open addressing hashsets remove elements without leaving tombstones
+ * behind wherever they can: the Robin Hood layout shifts the rest of the
+ * probe sequence back, and the Swiss layout only marks a slot deleted
+ * when its group has never had an empty slot to stop a search.
+ *
+ * An assert is raised if the specified address is NULL.
+ */
+
+bool HashSetRemove(hashset *h, const void *elemAddr);
+
 /**
  * Function: HashSetLookup
  * -----------------------
@@ -187,6 +437,48 @@ void HashSetEnter(hashset *h, const void *elemAddr);
 
 void *HashSetLookup(const hashset *h, const void *elemAddr);
 
+/**
+ * Function: HashSetLookupKey
+ * --------------------------
+ * Same as HashSetLookup, except that what resides at keyAddr is a key
+ * of the client's choosing rather than an element, so there's no need
+ * to build a whole element (and perhaps allocate memory for it) just
+ * to look one up.  For instance, a hashset of structs keyed by a C
+ * string can be searched with the bare string.
+ *
+ * The key is hashed with keyhashfn, which must return the same hash
+ * code for a key as the hashset's own hash function returns for the
+ * elements matching it, and keyfullhashfn likewise stands in for the
+ * HashSetFullHashFunction, if the hashset has one (otherwise it's
+ * ignored and may be NULL).  keycmpfn is always called with the key
+ * as its first argument and a stored element as its second.
+ *
+ * An assert is raised if keyAddr, keyhashfn or keycmpfn is NULL, or if
+ * keyfullhashfn is NULL and the hashset has a full hash function.
+ */
+
+void *HashSetLookupKey(const hashset *h, const void *keyAddr, HashSetHashFunction keyhashfn,
+		       HashSetFullHashFunction keyfullhashfn, HashSetCompareFunction keycmpfn);
+
+/**
+ * Function: HashSetLookupBatch
+ * ----------------------------
+ * Looks up n keys at once, storing in results[i] what HashSetLookup would
+ * return for the i-th key: the address of the matching stored element, or
+ * NULL.  keys addresses an array of n elements laid out just like the
+ * hashset's own (each the element size given at construction time).
+ *
+ * The answers are the same as n calls to HashSetLookup would give, only
+ * faster for large hashsets: keys are hashed a batch at a time and the
+ * memory each one is going to need is prefetched before any of them is
+ * compared, so the cache misses of many lookups are waited on together.
+ *
+ * An assert is raised if n is negative, or if n is positive and keys or
+ * results is NULL.
+ */
+
+void HashSetLookupBatch(const hashset *h, const void *keys, int n, void **results);
+
 /**
  * Function: HashSetMap
  * --------------------
@@ -203,5 +495,173 @@ void *HashSetLookup(const hashset *h, const void *elemAddr);
  */
 
 void HashSetMap(hashset *h, HashSetMapFunction mapfn, void *auxData);
+
+/**
+ * Function: HashSetParallelMap
+ * ----------------------------
+ * Does what HashSetMap does, but splits the buckets into numThreads
+ * ranges and maps over each range on a thread of its own (see
+ * ParallelFor), so mapfn is applied to several elements at once and in
+ * no particular order.  mapfn mustn't change the hashset's elements in
+ * any way the hash and compare functions would notice, and anything it
+ * updates through auxData has to be safe to update from several threads,
+ * which is what HashSetParallelReduce is for.  A rehash in progress is
+ * finished first.
+ *
+ * An assert is raised if the mapping routine is NULL or numThreads isn't
+ * positive.
+ */
+
+void HashSetParallelMap(hashset *h, HashSetMapFunction mapfn, void *auxData, int numThreads);
+
+/**
+ * Function: HashSetParallelReduce
+ * -------------------------------
+ * The reducing form of HashSetParallelMap, for scans that total
+ * something up.  accumulators is an array of numThreads accumulators of
+ * accumulatorSize bytes each, all initialized by the client (to zero
+ * counts, empty vectors, and so on).  Each thread passes its own
+ * accumulator to mapfn as the auxData, so no two threads ever share
+ * one, and once every thread is done mergefn folds accumulators 1 through
+ * numThreads - 1, in order, into accumulator 0, where the result is left.
+ *
+ * An assert is raised if the mapping routine or merge function is NULL,
+ * accumulators is NULL, or accumulatorSize or numThreads isn't positive.
+ */
+
+void HashSetParallelReduce(hashset *h, HashSetMapFunction mapfn, void *accumulators, int accumulatorSize,
+			   int numThreads, HashSetMergeFunction mergefn);
+
+/**
+ * Function: HashSetSetMaxLoadFactor
+ * ---------------------------------
+ * Sets the maximum load factor (the ratio of elements to buckets) the
+ * hashset tolerates before it grows its bucket array and rehashes.  Lower
+ * values keep the chains shorter at the expense of memory.  A new hashset
+ * uses a maximum load factor of 1.0.  If the hashset is already loaded
+ * beyond the new maximum, it is grown right away.
+ *
+ * An assert is raised if maxLoad is not greater than 0, or if the
+ * hashset uses open addressing and maxLoad is not less than 1, or if
+ * maxLoad isn't more than twice the minimum load factor.
+ */
+
+void HashSetSetMaxLoadFactor(hashset *h, double maxLoad);
+
+/**
+ * Function: HashSetSetMinLoadFactor
+ * ---------------------------------
+ * Sets the minimum load factor the hashset tolerates before HashSetRemove
+ * shrinks its bucket array, so that a hashset whose elements come and go
+ * (a rolling window, say) gives memory back instead of staying as large as
+ * it ever was.  The bucket count is halved until the load factor is back
+ * above the minimum.  A new hashset has a minimum load factor of 0, which
+ * means it never shrinks.
+ *
+ * An assert is raised if minLoad is less than 0, or not less than half the
+ * maximum load factor (which leaves room to enter and remove an element
+ * without growing and shrinking every time).
+ */
+
+void HashSetSetMinLoadFactor(hashset *h, double minLoad);
+
+/**
+ * Function: HashSetReserve
+ * ------------------------
+ * Grows the bucket array (if necessary) so that numElems elements can
+ * be stored without exceeding the maximum load factor, sparing clients
+ * who know roughly how many elements they'll enter the cost of repeated
+ * rehashing along the way.  The hashset never shrinks as a result of
+ * this call.
+ *
+ * An assert is raised if numElems is less than 0.
+ */
+
+void HashSetReserve(hashset *h, int numElems);
+
+/**
+ * Function: HashSetBuildFrom
+ * --------------------------
+ * Enters the n elements laid out one after another at elems into the empty
+ * hashset, leaving it just as n calls to HashSetEnter in order would: when
+ * several elements are equal, the last of them is the one kept, and the free
+ * function is applied to the others.
+ *
+ * Rather than being entered one at a time, the elements of a chained hashset
+ * are hashed by numThreads threads at once, sorted into their buckets with
+ * a counting sort, and copied into bucket vectors allocated at their final
+ * size, so that each bucket ends up in one piece and the bucket array never
+ * has to grow along the way.  The hash, compare and free functions are
+ * called from all of the threads, and so must be safe to call concurrently
+ * (on different elements).  Open addressing hashsets are reserved for n
+ * elements and then filled by HashSetEnter.
+ *
+ * An assert is raised if the hashset isn't empty, if elems is NULL while
+ * n is positive, if n is negative, or if numThreads isn't positive.
+ */
+
+void HashSetBuildFrom(hashset *h, const void *elems, int n, int numThreads);
+
+/**
+ * Function: HashSetSetIncrementalRehash
+ * -------------------------------------
+ * Chooses how the hashset rehashes when it grows.  By default all of
+ * the elements are moved to the new bucket array at once, which means the
+ * HashSetEnter that triggers the growth takes time proportional to the size
+ * of the hashset.  In incremental mode the old and new bucket arrays are
+ * kept side by side, and every subsequent insertion and removal migrates
+ * a few elements, so no single call ever pays for the whole rehash.
+ * Lookups only read, whichever array each element is in, so addresses
+ * stay valid exactly as long as in the default mode.  Switching
+ * incremental mode off completes any migration that is still in progress.
+ *
+ * Incremental mode trims the worst case, not the total: the growing call
+ * still allocates the new bucket array, and the migration's work is spread
+ * over the calls that follow, which each take a little longer than they
+ * would otherwise.  Hashsets created with HashSetNewOpen or HashSetNewSwiss
+ * ignore this setting.
+ */
+
+void HashSetSetIncrementalRehash(hashset *h, bool incremental);
+
+/**
+ * Function: HashSetSetFullHashFunction
+ * ------------------------------------
+ * Installs a HashSetFullHashFunction that the hashset uses in place of the
+ * hashfn supplied at construction time.  Each element's full hash code is
+ * computed once, when the element is entered, and stored alongside it.
+ * Lookups then compare the stored codes first and only call comparefn on
+ * elements whose codes match exactly, and growing the hashset reuses the
+ * stored codes instead of hashing every element again.  This is worth the
+ * extra 8 bytes per element when comparisons (e.g. strcmp) or the hash
+ * function itself are expensive.
+ *
+ * An assert is raised if the hashset isn't empty or fullhashfn is NULL.
+ */
+
+void HashSetSetFullHashFunction(hashset *h, HashSetFullHashFunction fullhashfn);
+
+/**
+ * Function: HashSetSetBloomFilter
+ * -------------------------------
+ * Puts a blocked Bloom filter of bitsPerElem bits per element in front
+ * of the hashset (or takes it away, if bitsPerElem is 0).  The filter
+ * holds the hash code of every element entered, so HashSetLookup and
+ * HashSetLookupKey turn most keys that aren't in the hashset away after
+ * hashing them and reading one cache line, without touching the table
+ * or calling the compare function.  At 10 bits per element about 1% of
+ * absent keys get past the filter.
+ *
+ * The filter is worth having when most lookups miss, since the ones
+ * that hit pay for it: the key is hashed once for the filter, with the
+ * full hash function or else with hashfn and a numBuckets of INT_MAX,
+ * and again by the table.  The filter is rebuilt whenever the hashset
+ * rehashes, and removed elements stay in it until then, which only
+ * costs the lookups for them a trip to the table.
+ *
+ * An assert is raised if bitsPerElem is negative.
+ */
+
+void HashSetSetBloomFilter(hashset *h, int bitsPerElem);
      
 #endif
@@ -0,0 +1,738 @@
+#include "hashset.h"
+#include "statichashset.h"
+#include "btree.h"
+#include "streamtokenizer.h"
+#include "hashing.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <assert.h>
+
+/**
+ * File: hashsetbench.c
+ * --------------------
+ * Times the hashset on a large collection of C strings.  The words
+ * come from the file named on the command line (anything with words
+ * separated by commas, spaces or newlines, e.g. the thesaurus), or,
+ * without one, from a deterministic pseudo-random word generator.
+ *
+ *     ./hashset-bench [word file [stop words file corpus file...]]
+ *
+ * Given a stop words file and some text to scan, it also times what
+ * rss-news-search does with them: checking every word of the text
+ * against the stop words, which mostly misses.  For example,
+ *
+ *     ./hashset-bench - "../RSS News Feed Aggregation/data/stop-words.txt" \
+ *         "../RSS News Feed Aggregation/data/"test?.txt
+ *
+ * where "-" stands for the generated words.
+ */
+
+static const int kNumGeneratedWords = 500000;
+static const int kInitialNumBuckets = 1009;
+static const int kBloomBits = 10;
+
+/**
+ * Function: StringHash
+ * --------------------
+ * Hashes words with the seeded, case-folding hash from hashing.h,
+ * the one the clients use, so the numbers are representative of
+ * what they see.  Folding costs next to nothing and lets the stop
+ * words, which compare with strcasecmp, share the function.
+ */
+
+static int StringHash(const void *elem, int numBuckets)
+{
+  return HashStringCaseFold(*(const char **) elem, HashSeed()) % numBuckets;
+}
+
+/**
+ * Function: StringFullHash
+ * ------------------------
+ * The same hash without the final reduction, for the hashsets
+ * benchmarked with cached full hash codes.
+ */
+
+static uint64_t StringFullHash(const void *elem)
+{
+  return HashStringCaseFold(*(const char **) elem, HashSeed());
+}
+
+/**
+ * Function: MultiplicativeHash
+ * ----------------------------
+ * The byte-at-a-time multiplicative hash the clients used to share,
+ * kept for comparison.  Anyone can work out which words it sends to
+ * the same bucket.
+ */
+
+static const signed long kHashMultiplier = -1664117991L;
+static uint64_t MultiplicativeHash(const char *s, uint64_t unusedSeed)
+{
+  uint64_t hashcode = 0;
+  for (int i = 0; s[i] != '\0'; i++)
+    hashcode = hashcode * kHashMultiplier + tolower(s[i]);
+  return hashcode;
+}
+
+static int MultiplicativeStringHash(const void *elem, int numBuckets)
+{
+  return MultiplicativeHash(*(const char **) elem, 0) % numBuckets;
+}
+
+static int StringCompare(const void *elem1, const void *elem2)
+{
+  return strcmp(*(const char **) elem1, *(const char **) elem2);
+}
+
+static int StopWordCompare(const void *elem1, const void *elem2)
+{
+  return strcasecmp(*(const char **) elem1, *(const char **) elem2);
+}
+
+static void StringFree(void *elem)
+{
+  free(*(char **) elem);
+}
+
+static double NowNanoseconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int CompareDouble(const void *elem1, const void *elem2)
+{
+  double d1 = *(const double *) elem1, d2 = *(const double *) elem2;
+  return (d1 > d2) - (d1 < d2);
+}
+
+/**
+ * Function: AddWord
+ * -----------------
+ * Appends a copy of word to words unless it's already in seen.  A
+ * new word goes into seen as the caller's buffer and is then swapped
+ * for its copy through the address HashSetFindOrInsert returns, so
+ * each word is looked up only once and only new words get copied.
+ */
+
+static void AddWord(vector *words, hashset *seen, char *word)
+{
+  bool inserted;
+  char **resident = HashSetFindOrInsert(seen, &word, &inserted);
+  if (!inserted) return;
+  *resident = strdup(word);
+  VectorAppend(words, resident);
+}
+
+/**
+ * Function: ReadWords
+ * -------------------
+ * Populates words with distinct dynamically allocated C strings, either
+ * pulled from the named file or generated.  Duplicates in the file are
+ * weeded out so every word is a fresh insertion.
+ */
+
+static void ReadWords(vector *words, const char *filename)
+{
+  hashset seen;
+  HashSetNew(&seen, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  VectorNew(words, sizeof(char *), StringFree, 0);
+
+  if (filename != NULL) {
+    FILE *infile = fopen(filename, "r");
+    if (infile == NULL) {
+      fprintf(stderr, "Could not open word file named \"%s\"\n", filename);
+      exit(1);
+    }
+    streamtokenizer st;
+    char buffer[2048];
+    STNew(&st, infile, ", \t\r\n", true);
+    while (STNextToken(&st, buffer, sizeof(buffer))) {
+      AddWord(words, &seen, buffer);
+    }
+    STDispose(&st);
+    fclose(infile);
+  } else {
+    srand(107);
+    while (VectorLength(words) < kNumGeneratedWords) {
+      char buffer[16];
+      int length = 4 + rand() % 10;
+      for (int i = 0; i < length; i++) buffer[i] = 'a' + rand() % 26;
+      buffer[length] = '\0';
+      AddWord(words, &seen, buffer);
+    }
+  }
+
+  HashSetDispose(&seen);
+}
+
+/**
+ * Function: PrintLatencies
+ * ------------------------
+ * Sorts the per-operation latencies and prints the median, the
+ * tail percentiles, the worst case and the total.
+ */
+
+static void PrintLatencies(const char *label, double latencies[], int n)
+{
+  double total = 0;
+  for (int i = 0; i < n; i++) total += latencies[i];
+  qsort(latencies, n, sizeof(double), CompareDouble);
+  printf("%-28s p50 %7.0f ns  p99 %7.0f ns  p99.9 %9.0f ns  max %11.0f ns  total %7.1f ms\n",
+	 label, latencies[n / 2], latencies[(int)(n * 0.99)], latencies[(int)(n * 0.999)],
+	 latencies[n - 1], total / 1e6);
+}
+
+/**
+ * Function: BenchRehashLatency
+ * ----------------------------
+ * Enters every word into a hashset that starts out with far too few
+ * buckets, looking up a recently entered word after each insertion the
+ * way an interactive loop would, and records how long each enter+lookup
+ * pair takes.  Stop-the-world rehashing shows up in the tail.
+ * Incremental rehashing should take it out of the maximum, at the
+ * cost of a slower median and 99th percentile, since the migration's
+ * work is spread over the insertions that follow each growth.
+ */
+
+static void BenchRehashLatency(vector *words, bool incremental)
+{
+  int n = VectorLength(words);
+  double *latencies = malloc(n * sizeof(double));
+  assert(latencies != NULL);
+
+  hashset h;
+  HashSetNew(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  HashSetSetIncrementalRehash(&h, incremental);
+  for (int i = 0; i < n; i++) {
+    double start = NowNanoseconds();
+    HashSetEnter(&h, VectorNth(words, i));
+    void *found = HashSetLookup(&h, VectorNth(words, i / 2));
+    latencies[i] = NowNanoseconds() - start;
+    assert(found != NULL);
+  }
+  HashSetDispose(&h);
+
+  PrintLatencies(incremental ? "enter+lookup (incremental)" : "enter+lookup (all at once)", latencies, n);
+  free(latencies);
+}
+
+/**
+ * Function: MakeMisses
+ * --------------------
+ * Builds a companion vector of words guaranteed to be absent from
+ * the benchmark set (each word with an extra character tacked on,
+ * provided that isn't itself one of the words).
+ */
+
+static void MakeMisses(vector *words, vector *misses)
+{
+  hashset present;
+  HashSetNew(&present, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  for (int i = 0; i < VectorLength(words); i++)
+    HashSetEnter(&present, VectorNth(words, i));
+
+  VectorNew(misses, sizeof(char *), StringFree, VectorLength(words));
+  for (int i = 0; i < VectorLength(words); i++) {
+    const char *word = *(char **) VectorNth(words, i);
+    char *miss = malloc(strlen(word) + 2);
+    sprintf(miss, "%s#", word);
+    if (HashSetLookup(&present, &miss) != NULL) {
+      free(miss);
+      continue;
+    }
+    VectorAppend(misses, &miss);
+  }
+  HashSetDispose(&present);
+}
+
+typedef void (*HashSetConstructor)(hashset *h, int elemSize, int numBuckets,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn);
+
+/**
+ * Function: BenchLayout
+ * ---------------------
+ * Builds a hashset of every word with the given constructor (and
+ * with StringFullHash installed, if fullHash is true, and a Bloom
+ * filter of bloomBits bits per word), then reports the average cost
+ * of an insertion, a successful lookup and an unsuccessful lookup.
+ */
+
+static void BenchLayout(const char *label, HashSetConstructor newfn, bool fullHash, int bloomBits,
+			vector *words, vector *misses)
+{
+  hashset h;
+  int n = VectorLength(words), numMisses = VectorLength(misses);
+  newfn(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  if (fullHash) HashSetSetFullHashFunction(&h, StringFullHash);
+  HashSetSetBloomFilter(&h, bloomBits);
+
+  double start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    HashSetEnter(&h, VectorNth(words, i));
+  double enterTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    if (HashSetLookup(&h, VectorNth(words, i)) == NULL) assert(false);
+  double hitTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < numMisses; i++)
+    if (HashSetLookup(&h, VectorNth(misses, i)) != NULL) assert(false);
+  double missTime = NowNanoseconds() - start;
+
+  printf("%-28s enter %6.1f ns  hit %6.1f ns  miss %6.1f ns\n",
+	 label, enterTime / n, hitTime / n, missTime / numMisses);
+  HashSetDispose(&h);
+}
+
+/**
+ * Function: BenchBuildFrom
+ * ------------------------
+ * Builds a chained hashset of every word with StringFullHash, once by
+ * entering the words one at a time and once with HashSetBuildFrom on
+ * the given number of threads, and reports the average cost per word.
+ */
+
+static void BenchBuildFrom(vector *words, int numThreads)
+{
+  hashset h;
+  int n = VectorLength(words);
+  HashSetNew(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  HashSetSetFullHashFunction(&h, StringFullHash);
+  double start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    HashSetEnter(&h, VectorNth(words, i));
+  double enterTime = NowNanoseconds() - start;
+  HashSetDispose(&h);
+
+  HashSetNew(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  HashSetSetFullHashFunction(&h, StringFullHash);
+  start = NowNanoseconds();
+  HashSetBuildFrom(&h, VectorNth(words, 0), n, numThreads);
+  double buildTime = NowNanoseconds() - start;
+  assert(HashSetCount(&h) == n);
+  HashSetDispose(&h);
+
+  printf("build from %d word%s on %d thread%s: enter one at a time %6.1f ns  build %6.1f ns\n",
+	 n, n == 1 ? "" : "s", numThreads, numThreads == 1 ? "" : "s", enterTime / n, buildTime / n);
+}
+
+/**
+ * Function: BenchParallelMap
+ * --------------------------
+ * Totals the lengths of every word in a chained hashset, once with
+ * HashSetMap and once with HashSetParallelReduce on the given number of
+ * threads, and reports the average cost per word of each.
+ */
+
+static void AddLength(void *elem, void *auxData)
+{
+  *(long *) auxData += strlen(*(char **) elem);
+}
+
+static void MergeLength(void *accumulator, void *threadAccumulator)
+{
+  *(long *) accumulator += *(long *) threadAccumulator;
+}
+
+static void BenchParallelMap(vector *words, int numThreads)
+{
+  hashset h;
+  int n = VectorLength(words);
+  HashSetNew(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  HashSetBuildFrom(&h, VectorNth(words, 0), n, 1);
+
+  long total = 0;
+  double start = NowNanoseconds();
+  HashSetMap(&h, AddLength, &total);
+  double mapTime = NowNanoseconds() - start;
+
+  long *totals = calloc(numThreads, sizeof(long));
+  start = NowNanoseconds();
+  HashSetParallelReduce(&h, AddLength, totals, sizeof(long), numThreads, MergeLength);
+  double reduceTime = NowNanoseconds() - start;
+  assert(totals[0] == total);
+  free(totals);
+  HashSetDispose(&h);
+
+  printf("map over %d words: serial %6.1f ns  reduce on %d thread%s %6.1f ns\n",
+	 n, mapTime / n, numThreads, numThreads == 1 ? "" : "s", reduceTime / n);
+}
+
+/**
+ * Function: BenchBTree
+ * --------------------
+ * Builds a btree of every word and reports the average cost of an
+ * insertion, a successful lookup and an unsuccessful one, to be set
+ * against BenchLayout's figures, and of visiting a word in order.
+ */
+
+static void CountWord(void *elem, void *auxData)
+{
+  (*(int *) auxData)++;
+}
+
+static void BenchBTree(vector *words, vector *misses)
+{
+  btree t;
+  int n = VectorLength(words), numMisses = VectorLength(misses);
+  BTreeNew(&t, sizeof(char *), StringCompare, NULL);
+
+  double start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    BTreeEnter(&t, VectorNth(words, i));
+  double enterTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    if (BTreeLookup(&t, VectorNth(words, i)) == NULL) assert(false);
+  double hitTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < numMisses; i++)
+    if (BTreeLookup(&t, VectorNth(misses, i)) != NULL) assert(false);
+  double missTime = NowNanoseconds() - start;
+
+  int numVisited = 0;
+  start = NowNanoseconds();
+  BTreeMap(&t, CountWord, &numVisited);
+  double mapTime = NowNanoseconds() - start;
+  assert(numVisited == n);
+
+  printf("%-28s enter %6.1f ns  hit %6.1f ns  miss %6.1f ns  in order %4.1f ns\n",
+	 "btree", enterTime / n, hitTime / n, missTime / numMisses, mapTime / n);
+  BTreeDispose(&t);
+}
+
+/**
+ * Function: BenchFrozen
+ * ---------------------
+ * Builds a chained hashset of every word (with StringFullHash, which
+ * freezing requires), freezes it, and reports the average cost of a
+ * successful and an unsuccessful lookup in the static hashset, to be
+ * set against BenchLayout's figures.
+ */
+
+static void BenchFrozen(vector *words, vector *misses)
+{
+  hashset h;
+  statichashset frozen;
+  int n = VectorLength(words), numMisses = VectorLength(misses);
+  HashSetNew(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  HashSetSetFullHashFunction(&h, StringFullHash);
+  for (int i = 0; i < n; i++)
+    HashSetEnter(&h, VectorNth(words, i));
+
+  double start = NowNanoseconds();
+  HashSetMoveIntoStatic(&h, &frozen);
+  double freezeTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    if (StaticHashSetLookup(&frozen, VectorNth(words, i)) == NULL) assert(false);
+  double hitTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < numMisses; i++)
+    if (StaticHashSetLookup(&frozen, VectorNth(misses, i)) != NULL) assert(false);
+  double missTime = NowNanoseconds() - start;
+
+  printf("%-28s freeze %5.1f ns  hit %6.1f ns  miss %6.1f ns\n",
+	 "frozen (static hashset)", freezeTime / n, hitTime / n, missTime / numMisses);
+  StaticHashSetDispose(&frozen);
+}
+
+/**
+ * Function: BenchLookupBatch
+ * --------------------------
+ * Looks every word up in random order, first one HashSetLookup at a
+ * time and then kQueryBatchSize words per HashSetLookupBatch, and
+ * reports the average cost of a lookup each way.  Random order is
+ * what defeats the cache, and what the batching is meant to help.
+ */
+
+static const int kQueryBatchSize = 64;
+static void BenchLookupBatch(const char *label, HashSetConstructor newfn, vector *words)
+{
+  hashset h;
+  int n = VectorLength(words);
+  char **queries = malloc(n * sizeof(char *));
+  void **results = malloc(n * sizeof(void *));
+  assert(queries != NULL && results != NULL);
+
+  newfn(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  for (int i = 0; i < n; i++) {
+    HashSetEnter(&h, VectorNth(words, i));
+    queries[i] = *(char **) VectorNth(words, i);
+  }
+  srand(1009);
+  for (int i = n - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    char *query = queries[i];
+    queries[i] = queries[j];
+    queries[j] = query;
+  }
+
+  double start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    results[i] = HashSetLookup(&h, &queries[i]);
+  double loopTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < n; i += kQueryBatchSize)
+    HashSetLookupBatch(&h, &queries[i], (n - i < kQueryBatchSize) ? n - i : kQueryBatchSize, &results[i]);
+  double batchTime = NowNanoseconds() - start;
+
+  for (int i = 0; i < n; i++)
+    if (results[i] == NULL) assert(false);
+  printf("%-28s lookup loop %6.1f ns  batched %6.1f ns\n", label, loopTime / n, batchTime / n);
+  HashSetDispose(&h);
+  free(queries);
+  free(results);
+}
+
+/**
+ * Function: ReadTokens
+ * --------------------
+ * Appends every word of the named file to tokens, duplicates and all,
+ * splitting the text wherever rss-news-search does.
+ */
+
+static const char *const kTextDelimiters = " \t\n\r\b!@$%^*()_+={[}]|\\'\":;/?.>,<~`";
+static void ReadTokens(vector *tokens, const char *filename)
+{
+  FILE *infile = fopen(filename, "r");
+  if (infile == NULL) {
+    fprintf(stderr, "Could not open text file named \"%s\"\n", filename);
+    exit(1);
+  }
+  streamtokenizer st;
+  char buffer[1024];
+  STNew(&st, infile, kTextDelimiters, true);
+  while (STNextToken(&st, buffer, sizeof(buffer))) {
+    char *token = strdup(buffer);
+    VectorAppend(tokens, &token);
+  }
+  STDispose(&st);
+  fclose(infile);
+}
+
+/**
+ * Function: BenchStopWords
+ * ------------------------
+ * Checks every token against the stop words, in a chained hashset set
+ * up the way rss-news-search sets its own up (1009 buckets, the same
+ * hash, strcasecmp), enough times over to be timed, with and without a
+ * Bloom filter.  Reports the average cost of a check, how many checks
+ * missed, and how many of the misses got past the filter.
+ */
+
+static const int kNumStopWordChecks = 5000000;
+static void BenchStopWords(const char *label, vector *stopWords, vector *tokens, bool fullHash, int bloomBits)
+{
+  hashset h;
+  int n = VectorLength(tokens), numMisses = 0, numFalsePositives = 0;
+  HashSetNew(&h, sizeof(char *), kInitialNumBuckets, StringHash, StopWordCompare, NULL);
+  if (fullHash) HashSetSetFullHashFunction(&h, StringFullHash);
+  for (int i = 0; i < VectorLength(stopWords); i++)
+    HashSetEnter(&h, VectorNth(stopWords, i));
+  HashSetSetBloomFilter(&h, bloomBits);
+
+  for (int i = 0; i < n; i++) {
+    char **token = VectorNth(tokens, i);
+    if (HashSetLookup(&h, token) != NULL) continue;
+    numMisses++;
+    uint64_t hash = fullHash ? StringFullHash(token) : (uint64_t) StringHash(token, INT_MAX);
+    if (bloomBits != 0 && BloomFilterMayContain(&h.bloom, hash)) numFalsePositives++;
+  }
+
+  int numRounds = kNumStopWordChecks / n + 1, numFound = 0;
+  double start = NowNanoseconds();
+  for (int round = 0; round < numRounds; round++)
+    for (int i = 0; i < n; i++)
+      numFound += (HashSetLookup(&h, VectorNth(tokens, i)) != NULL);
+  double checkTime = NowNanoseconds() - start;
+  assert(numFound == numRounds * (n - numMisses));
+
+  printf("%-28s check %6.1f ns  misses %5.1f%%  false positives %5.2f%%\n", label,
+	 checkTime / ((double) numRounds * n), 100.0 * numMisses / n,
+	 numMisses == 0 ? 0.0 : 100.0 * numFalsePositives / numMisses);
+  HashSetDispose(&h);
+}
+
+/**
+ * Function: BenchRollingWindow
+ * ----------------------------
+ * Slides a window over the words: each word is entered and the one
+ * that entered windowSize words earlier is removed, the way a rolling
+ * index expires old entries.  Reports the average cost of an
+ * enter+remove pair and the largest bucket count along the way.
+ */
+
+static void BenchRollingWindow(const char *label, HashSetConstructor newfn, vector *words, int windowSize)
+{
+  hashset h;
+  int n = VectorLength(words), maxBucketsNum = 0;
+  newfn(&h, sizeof(char *), kInitialNumBuckets, StringHash, StringCompare, NULL);
+  HashSetSetMinLoadFactor(&h, h.max_load / 4);
+
+  double start = NowNanoseconds();
+  for (int i = 0; i < n; i++) {
+    HashSetEnter(&h, VectorNth(words, i));
+    if (i >= windowSize && !HashSetRemove(&h, VectorNth(words, i - windowSize))) assert(false);
+    if (h.buckets_num > maxBucketsNum) maxBucketsNum = h.buckets_num;
+  }
+  double elapsed = NowNanoseconds() - start;
+
+  printf("%-28s enter+remove %6.1f ns  window %d  max buckets %d\n",
+	 label, elapsed / n, windowSize, maxBucketsNum);
+  HashSetDispose(&h);
+}
+
+/**
+ * Function: BenchHashFunction
+ * ---------------------------
+ * Reports the average cost of hashing one of the words.
+ */
+
+typedef uint64_t (*StringHashFunction)(const char *s, uint64_t seed);
+static const int kNumHashRounds = 10;
+static void BenchHashFunction(const char *label, StringHashFunction hashfn, vector *words)
+{
+  int n = VectorLength(words);
+  uint64_t seed = HashSeed(), sum = 0;
+  double start = NowNanoseconds();
+  for (int round = 0; round < kNumHashRounds; round++)
+    for (int i = 0; i < n; i++)
+      sum += hashfn(*(const char **) VectorNth(words, i), seed);
+  double elapsed = NowNanoseconds() - start;
+
+  printf("%-28s hash %6.1f ns  (checksum %04x)\n", label,
+	 elapsed / ((double) kNumHashRounds * n), (unsigned) (sum & 0xffff));
+}
+
+/**
+ * Function: MakeFlood
+ * -------------------
+ * Builds the words a hostile news feed would send a table of
+ * kInitialNumBuckets buckets hashed with MultiplicativeHash: random
+ * words kept only if they land in bucket 0.
+ */
+
+static const int kNumFloodWords = 10000;
+static void MakeFlood(vector *flood)
+{
+  VectorNew(flood, sizeof(char *), StringFree, kNumFloodWords);
+  srand(211);
+  while (VectorLength(flood) < kNumFloodWords) {
+    char buffer[9];
+    for (int i = 0; i < 8; i++) buffer[i] = 'a' + rand() % 26;
+    buffer[8] = '\0';
+    if (MultiplicativeHash(buffer, 0) % kInitialNumBuckets != 0) continue;
+    char *word = strdup(buffer);
+    VectorAppend(flood, &word);
+  }
+}
+
+/**
+ * Function: BenchFlood
+ * --------------------
+ * Enters the flood into a chained hashset that keeps its
+ * kInitialNumBuckets buckets, as rss-news-search's does, and reports
+ * the average cost of an insertion and of a lookup.
+ */
+
+static void BenchFlood(const char *label, HashSetHashFunction hashfn, vector *flood)
+{
+  hashset h;
+  int n = VectorLength(flood);
+  HashSetNew(&h, sizeof(char *), kInitialNumBuckets, hashfn, StringCompare, NULL);
+  HashSetSetMaxLoadFactor(&h, n);
+
+  double start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    HashSetEnter(&h, VectorNth(flood, i));
+  double enterTime = NowNanoseconds() - start;
+
+  start = NowNanoseconds();
+  for (int i = 0; i < n; i++)
+    if (HashSetLookup(&h, VectorNth(flood, i)) == NULL) assert(false);
+  double hitTime = NowNanoseconds() - start;
+
+  printf("%-28s enter %8.1f ns  hit %8.1f ns  (%d words, %d buckets)\n",
+	 label, enterTime / n, hitTime / n, n, h.buckets_num);
+  HashSetDispose(&h);
+}
+
+int main(int argc, char **argv)
+{
+  vector words;
+  ReadWords(&words, (argc > 1 && strcmp(argv[1], "-") != 0) ? argv[1] : NULL);
+  printf("Benchmarking the hashset with %d distinct words.\n", VectorLength(&words));
+
+  BenchHashFunction("multiplicative hash", MultiplicativeHash, &words);
+  BenchHashFunction("HashString", HashString, &words);
+  BenchHashFunction("HashStringCaseFold", HashStringCaseFold, &words);
+
+  vector flood;
+  MakeFlood(&flood);
+  BenchFlood("flood, multiplicative hash", MultiplicativeStringHash, &flood);
+  BenchFlood("flood, seeded hash", StringHash, &flood);
+  VectorDispose(&flood);
+
+  BenchRehashLatency(&words, false);
+  BenchRehashLatency(&words, true);
+
+  vector misses;
+  MakeMisses(&words, &misses);
+  BenchLayout("chained buckets", HashSetNew, false, 0, &words, &misses);
+  BenchLayout("robin hood", HashSetNewOpen, false, 0, &words, &misses);
+  BenchLayout("swiss table", HashSetNewSwiss, false, 0, &words, &misses);
+  BenchLayout("chained + full hashes", HashSetNew, true, 0, &words, &misses);
+  BenchLayout("robin hood + full hashes", HashSetNewOpen, true, 0, &words, &misses);
+  BenchLayout("swiss table + full hashes", HashSetNewSwiss, true, 0, &words, &misses);
+  BenchLayout("chained + bloom", HashSetNew, false, kBloomBits, &words, &misses);
+  BenchLayout("swiss table + bloom", HashSetNewSwiss, false, kBloomBits, &words, &misses);
+  BenchFrozen(&words, &misses);
+  BenchBTree(&words, &misses);
+  BenchBuildFrom(&words, 1);
+  if (ParallelDefaultThreads() > 1) BenchBuildFrom(&words, ParallelDefaultThreads());
+  BenchParallelMap(&words, ParallelDefaultThreads());
+  VectorDispose(&misses);
+
+  BenchLookupBatch("chained buckets", HashSetNew, &words);
+  BenchLookupBatch("robin hood", HashSetNewOpen, &words);
+  BenchLookupBatch("swiss table", HashSetNewSwiss, &words);
+
+  int windowSize = VectorLength(&words) / 10 + 1;
+  BenchRollingWindow("chained buckets", HashSetNew, &words, windowSize);
+  BenchRollingWindow("robin hood", HashSetNewOpen, &words, windowSize);
+  BenchRollingWindow("swiss table", HashSetNewSwiss, &words, windowSize);
+
+  VectorDispose(&words);
+
+  if (argc > 3) {
+    vector stopWords, tokens;
+    ReadWords(&stopWords, argv[2]);
+    VectorNew(&tokens, sizeof(char *), StringFree, 0);
+    for (int i = 3; i < argc; i++)
+      ReadTokens(&tokens, argv[i]);
+    printf("Checking %d words of text against %d stop words.\n", VectorLength(&tokens), VectorLength(&stopWords));
+    BenchStopWords("stop words", &stopWords, &tokens, false, 0);
+    BenchStopWords("stop words + bloom", &stopWords, &tokens, false, kBloomBits);
+    BenchStopWords("stop words, full hashes", &stopWords, &tokens, true, 0);
+    BenchStopWords("  + bloom", &stopWords, &tokens, true, kBloomBits);
+    VectorDispose(&stopWords);
+    VectorDispose(&tokens);
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef _hashsetcounters_
+#define _hashsetcounters_
+#include "hashset.h"
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+/* File: hashsetcounters.h
+ * ------------------------
+ * Private to hashset.c and the layouts behind it.  Clients should never
+ * include this file; what it keeps track of reaches them through
+ * HashSetStats.
+ *
+ * The HASHSET_COUNT macros keep h->counters up to date in builds with
+ * HASHSET_STATS defined, and compile to nothing in all others, where
+ * their arguments aren't evaluated.  HASHSET_COUNT_OPERATIONS starts an
+ * operation of the named kind (lookup or insert), and the comparisons the
+ * layouts then report with HASHSET_COUNT_COMPARES are charged to it until
+ * the next one starts, or until HASHSET_COUNT_NO_COMPARES says the ones
+ * that follow aren't to be counted.  The layouts only ever read through
+ * the pointer, so the macros work on a const hashset too.  Lookups take a
+ * const hashset, and counting them is the one write they make, so
+ * HASHSET_COUNT_OPERATIONS casts the const away; a hashset is never
+ * defined const, as HashSetNew has to write to it.
+ *
+ * StatsAddChain and StatsAddProbe are how the layouts report each of
+ * their buckets and elements to HashSetStats, and BloomCode is what their
+ * batch lookups ask the Bloom filter about.
+ */
+
+#ifdef HASHSET_STATS
+#define HASHSET_COUNT_RESET(h) memset(&(h)->counters, 0, sizeof((h)->counters))
+#define HASHSET_COUNT_OPERATIONS(h, kind, n) \
+	(((hashset *)(h))->counters.kind##s += (n), \
+	 ((hashset *)(h))->counters.compares = &((hashset *)(h))->counters.kind##_compares)
+#define HASHSET_COUNT_NO_COMPARES(h) ((h)->counters.compares = NULL)
+#define HASHSET_COUNT_COMPARES(h, n) \
+	((h)->counters.compares != NULL ? (void)(*(h)->counters.compares += (n)) : (void)0)
+#define HASHSET_COUNT_RESIZE(h) ((h)->counters.resizes++)
+#else
+#define HASHSET_COUNT_RESET(h) ((void)0)
+#define HASHSET_COUNT_OPERATIONS(h, kind, n) ((void)0)
+#define HASHSET_COUNT_NO_COMPARES(h) ((void)0)
+#define HASHSET_COUNT_COMPARES(h, n) ((void)0)
+#define HASHSET_COUNT_RESIZE(h) ((void)0)
+#endif
+
+/* Records a bucket with a chain of chainLen elements.  mean_chain_len
+	holds the total length until HashSetStats divides it out at the end. */
+static inline void StatsAddChain(hashsetstats * stats, int chainLen)
+{
+	stats->buckets_num++;
+	stats->histogram[(chainLen < kHashSetStatsHistogramSize) ? chainLen : kHashSetStatsHistogramSize - 1]++;
+	if (chainLen == 0) return;
+
+	stats->used_buckets++;
+	stats->mean_chain_len += chainLen;
+	if (chainLen > stats->max_chain_len) stats->max_chain_len = chainLen;
+}
+
+/* Records an element found probeLen entries, slots or groups into its
+	search, with mean_probe_len holding the total the same way. */
+static inline void StatsAddProbe(hashsetstats * stats, int probeLen)
+{
+	stats->elems_num++;
+	stats->mean_probe_len += probeLen;
+	if (probeLen > stats->max_probe_len) stats->max_probe_len = probeLen;
+}
+
+/* The code the Bloom filter knows keyAddr by: fullHash, the key's full hash
+	code, if the hashset keeps them, and otherwise its hash code modulo
+	INT_MAX, just as HashSetLookup asks the filter. */
+static inline uint64_t BloomCode(const hashset * h, const void * keyAddr, uint64_t fullHash)
+{
+	if (h->fullHashFn != NULL) return fullHash;
+
+	int hashcode = h->hashFn(keyAddr, INT_MAX);
+	assert(hashcode >= 0);
+	assert(hashcode < INT_MAX);
+	return hashcode;
+}
+
+#endif
@@ -1,9 +1,14 @@
 #include "hashset.h"
+#include "statichashset.h"
+#include "hashing.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <limits.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 const int kNumBuckets = 26;
 
@@ -163,9 +168,1089 @@ static void TestHashTable(void)
   HashSetDispose(&counts);
 }
 
+/**
+ * Function: HashInt
+ * -----------------
+ * Hash function for hashsets of plain ints.  Deliberately as
+ * simple as HashFrequency so the test exercises the hashset
+ * rather than the hash function.
+ */
+
+static int HashInt(const void *elem, int numBuckets)
+{
+  return (unsigned int)*(const int *)elem % numBuckets;
+}
+
+/**
+ * Function: CompareInt
+ * --------------------
+ * Comparator for hashsets of plain ints.
+ */
+
+static int CompareInt(const void *elem1, const void *elem2)
+{
+  return *(const int *)elem1 - *(const int *)elem2;
+}
+
+/**
+ * Function: TestRehash
+ * --------------------
+ * Starts a hashset off with a single bucket and enters many thousands
+ * of ints, which only stays fast if the hashset grows its bucket array
+ * as the load factor climbs.  Confirms that every element survives
+ * the rehashing, and that HashSetReserve and HashSetSetMaxLoadFactor
+ * leave the hashset properly loaded.
+ */
+
+static const int kNumRehashInts = 100000;
+static void TestRehash(void)
+{
+  hashset ints;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the rehash test\n");
+  HashSetNew(&ints, sizeof(int), 1, HashInt, CompareInt, NULL);
+  for (int i = 0; i < kNumRehashInts; i++)
+    HashSetEnter(&ints, &i);
+  for (int i = 0; i < kNumRehashInts; i++)
+    HashSetEnter(&ints, &i);   // entering duplicates shouldn't change anything
+  
+  assert(HashSetCount(&ints) == kNumRehashInts);
+  assert(HashSetCount(&ints) <= ints.max_load * ints.buckets_num);
+  for (int i = 0; i < kNumRehashInts; i++)
+    assert(*(int *)HashSetLookup(&ints, &i) == i);
+  int missing = kNumRehashInts;
+  assert(HashSetLookup(&ints, &missing) == NULL);
+  fprintf(stdout, "Entered %d ints, hashset grew to %d buckets.\n", HashSetCount(&ints), ints.buckets_num);
+  
+  HashSetSetMaxLoadFactor(&ints, 0.25);
+  assert(HashSetCount(&ints) <= ints.max_load * ints.buckets_num);
+  HashSetReserve(&ints, 4 * kNumRehashInts);
+  assert(4 * kNumRehashInts <= ints.max_load * ints.buckets_num);
+  for (int i = 0; i < kNumRehashInts; i++)
+    assert(*(int *)HashSetLookup(&ints, &i) == i);
+  fprintf(stdout, "After reserving room for %d ints at load factor %.2f: %d buckets.\n",
+	  4 * kNumRehashInts, ints.max_load, ints.buckets_num);
+  
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: CountElement
+ * ----------------------
+ * Mapping function that counts the elements it's applied to.
+ * The address of the running count is passed as the client data.
+ */
+
+static void CountElement(void *elem, void *count)
+{
+  (*(int *)count)++;
+}
+
+/**
+ * Function: TestIncrementalRehash
+ * -------------------------------
+ * Same idea as TestRehash, but in incremental mode.  After every
+ * insertion the hashset is checked for everything entered so far,
+ * which exercises lookups (and re-entering) while the old and new
+ * bucket arrays are both live.  HashSetMap must still visit every
+ * element exactly once mid-migration.
+ */
+
+static const int kNumIncrementalInts = 5000;
+static void TestIncrementalRehash(void)
+{
+  hashset ints;
+  bool sawMigration = false;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the incremental rehash test\n");
+  HashSetNew(&ints, sizeof(int), 1, HashInt, CompareInt, NULL);
+  HashSetSetIncrementalRehash(&ints, true);
+  for (int i = 0; i < kNumIncrementalInts; i++) {
+    HashSetEnter(&ints, &i);
+    if (ints.old_data != NULL) {
+      sawMigration = true;
+      int count = 0;
+      HashSetMap(&ints, CountElement, &count);
+      assert(count == HashSetCount(&ints));
+    }
+    int j = i / 2;
+    HashSetEnter(&ints, &j);
+    assert(HashSetCount(&ints) == i + 1);
+    for (j = 0; j <= i; j += 7)
+      assert(*(int *)HashSetLookup(&ints, &j) == j);
+  }
+  
+  assert(sawMigration);
+  HashSetSetIncrementalRehash(&ints, false);
+  assert(ints.old_data == NULL);
+  for (int i = 0; i < kNumIncrementalInts; i++)
+    assert(*(int *)HashSetLookup(&ints, &i) == i);
+  fprintf(stdout, "Entered %d ints incrementally, hashset grew to %d buckets.\n", HashSetCount(&ints), ints.buckets_num);
+  
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: HashToZero
+ * --------------------
+ * Hash function that sends every element to bucket 0, so that bucket's
+ * chain holds the whole hashset and takes many steps to migrate.
+ */
+
+static int HashToZero(const void *elem, int numBuckets)
+{
+  return 0;
+}
+
+/**
+ * Function: TestLookupsLeaveElements
+ * ----------------------------------
+ * Checks that lookups in incremental mode only read: looking everything
+ * up mid-migration doesn't advance the migration, and the address found
+ * for an element still waiting in an old bucket stays where it was.
+ * Then puts every element in one bucket, so that the migration leaves
+ * it partly moved between insertions, and checks after each insertion
+ * and removal that every element is still found, and mapped, once.
+ */
+
+static const int kNumWaitingInts = 1000;
+static const int kNumChainedInts = 300;
+static void TestLookupsLeaveElements(void)
+{
+  hashset ints;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the read-only lookups test\n");
+  HashSetNew(&ints, sizeof(int), 1, HashInt, CompareInt, NULL);
+  HashSetSetIncrementalRehash(&ints, true);
+  int i = 0;
+  for (; i < kNumWaitingInts || ints.old_data == NULL; i++)
+    HashSetEnter(&ints, &i);
+
+  // The int in the last old bucket, which is the last to be migrated
+  int key = ints.old_buckets_num - 1, migratePos = ints.migrate_pos;
+  const int *found = HashSetLookup(&ints, &key);
+  assert(migratePos <= key && *found == key);
+  for (int j = 0; j < 2 * i; j++)
+    assert((HashSetLookup(&ints, &j) != NULL) == (j < i));
+  assert(ints.old_data != NULL && ints.migrate_pos == migratePos);
+  assert(HashSetLookup(&ints, &key) == found && *found == key);
+  HashSetDispose(&ints);
+
+  HashSetNew(&ints, sizeof(int), 1, HashToZero, CompareInt, NULL);
+  HashSetSetIncrementalRehash(&ints, true);
+  bool sawPartlyMigrated = false;
+  for (i = 0; i < kNumChainedInts; i++) {
+    HashSetEnter(&ints, &i);
+    if (i % 3 == 0) {
+      int gone = i / 3;
+      assert(HashSetRemove(&ints, &gone));
+    }
+    if (ints.old_data != NULL && ints.data[0] != NULL && ints.old_data[0] != NULL) sawPartlyMigrated = true;
+
+    int count = 0;
+    HashSetMap(&ints, CountElement, &count);
+    assert(count == HashSetCount(&ints));
+    for (int j = 0; j <= i; j++)
+      assert((HashSetLookup(&ints, &j) != NULL) == (j > i / 3));
+  }
+  assert(sawPartlyMigrated);
+  HashSetDispose(&ints);
+  fprintf(stdout, "Lookups left the migration alone, and found everything in a partly migrated bucket.\n");
+}
+
+/**
+ * Function: HashIntClustered
+ * --------------------------
+ * Deliberately poor hash function that sends runs of eight consecutive
+ * ints to the same home slot, so open addressing has to cope with long
+ * clusters of colliding elements.
+ */
+
+static int HashIntClustered(const void *elem, int numBuckets)
+{
+  return (unsigned int)*(const int *)elem / 8 % numBuckets;
+}
+
+typedef void (*HashSetConstructor)(hashset *h, int elemSize, int numBuckets,
+		HashSetHashFunction hashfn, HashSetCompareFunction comparefn, HashSetFreeFunction freefn);
+
+/**
+ * Function: TestOpenHashSet
+ * -------------------------
+ * Exercises one of the open addressing layouts (whichever the supplied
+ * constructor creates): enters ints that collide in clusters into a
+ * single-slot hashset, re-enters them to test replacement, and checks
+ * lookups for every present and absent value, the load factor bound, and
+ * that HashSetMap visits each element exactly once.
+ */
+
+static const int kNumOpenInts = 50000;
+static void TestOpenHashSet(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset ints;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s test\n", layoutName);
+  newfn(&ints, sizeof(int), 1, HashIntClustered, CompareInt, NULL);
+  for (int i = 0; i < kNumOpenInts; i += 2)
+    HashSetEnter(&ints, &i);
+  for (int i = 0; i < kNumOpenInts; i++)
+    HashSetEnter(&ints, &i);
+  
+  assert(HashSetCount(&ints) == kNumOpenInts);
+  assert(HashSetCount(&ints) <= ints.max_load * ints.buckets_num);
+  for (int i = 0; i < kNumOpenInts; i++)
+    assert(*(int *)HashSetLookup(&ints, &i) == i);
+  for (int i = kNumOpenInts; i < 2 * kNumOpenInts; i++)
+    assert(HashSetLookup(&ints, &i) == NULL);
+  
+  int count = 0;
+  HashSetMap(&ints, CountElement, &count);
+  assert(count == kNumOpenInts);
+  fprintf(stdout, "Entered %d clustered ints, hashset grew to %d slots.\n", HashSetCount(&ints), ints.buckets_num);
+  
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: FullHashString
+ * ------------------------
+ * Full hash function for hashsets of dynamically allocated C strings
+ * (FNV-1a), which counts how many times it's been called in
+ * numFullHashCalls so the test can tell when hash codes are reused.
+ */
+
+static int numFullHashCalls = 0;
+static uint64_t FullHashString(const void *elem)
+{
+  const unsigned char *s = *(const unsigned char **)elem;
+  uint64_t hashcode = 14695981039346656037ULL;
+  numFullHashCalls++;
+  for (int i = 0; s[i] != '\0'; i++)
+    hashcode = (hashcode ^ s[i]) * 1099511628211ULL;
+  return hashcode;
+}
+
+static int HashStringUnused(const void *elem, int numBuckets)
+{
+  assert(false);   // the full hash function should be used instead
+  return 0;
+}
+
+static int CompareString(const void *elem1, const void *elem2)
+{
+  return strcmp(*(const char **)elem1, *(const char **)elem2);
+}
+
+static void FreeString(void *elem)
+{
+  free(*(char **)elem);
+}
+
+/**
+ * Function: TestFullHashFunction
+ * ------------------------------
+ * Gives a hashset of strings a full hash function and enters enough
+ * strings for it to grow several times, then re-enters all of them
+ * (so the free function is levied against the replaced copies).
+ * Checks that lookups find every string and no absent one, and that
+ * each Enter and Lookup hashes exactly once, i.e. growing the hashset
+ * reused the stored hash codes.
+ */
+
+static const int kNumFullHashStrings = 20000;
+static void TestFullHashFunction(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset strings;
+  char buffer[32];
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s full hash test\n", layoutName);
+  newfn(&strings, sizeof(char *), 1, HashStringUnused, CompareString, FreeString);
+  HashSetSetFullHashFunction(&strings, FullHashString);
+  numFullHashCalls = 0;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < kNumFullHashStrings; i++) {
+      sprintf(buffer, "string %d", i);
+      char *copy = strdup(buffer);
+      HashSetEnter(&strings, &copy);
+    }
+  }
+  
+  assert(HashSetCount(&strings) == kNumFullHashStrings);
+  for (int i = 0; i < 2 * kNumFullHashStrings; i++) {
+    sprintf(buffer, "string %d", i);
+    char *key = buffer;
+    char **found = HashSetLookup(&strings, &key);
+    assert(i < kNumFullHashStrings ? found != NULL && strcmp(*found, buffer) == 0 : found == NULL);
+  }
+  assert(numFullHashCalls == 4 * kNumFullHashStrings);
+  fprintf(stdout, "Entered %d strings, hashset grew to %d buckets without rehashing any.\n",
+	  HashSetCount(&strings), strings.buckets_num);
+  
+  HashSetDispose(&strings);
+}
+
+/**
+ * Function: TestFindOrInsert
+ * --------------------------
+ * Uses HashSetFindOrInsert the way an indexer would, counting
+ * occurrences of ints in a hashset that starts out with a single
+ * bucket: the first occurrence of each value inserts it (and the
+ * count is filled in through the returned address, which must be
+ * right even when that insertion made the hashset grow), and each
+ * later one bumps the resident element's count.
+ */
+
+struct occurrence {
+  int value;
+  int count;
+};
+
+static const int kNumIndexedInts = 20000;
+static const int kNumOccurrences = 3;
+static void TestFindOrInsert(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset index;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s find-or-insert test\n", layoutName);
+  newfn(&index, sizeof(struct occurrence), 1, HashInt, CompareInt, NULL);
+  for (int round = 0; round < kNumOccurrences; round++) {
+    for (int i = 0; i < kNumIndexedInts; i++) {
+      struct occurrence key = { i, 0 };
+      bool inserted;
+      struct occurrence *found = HashSetFindOrInsert(&index, &key, &inserted);
+      assert(inserted == (round == 0));
+      assert(found->value == i);
+      found->count++;
+    }
+  }
+  
+  assert(HashSetCount(&index) == kNumIndexedInts);
+  for (int i = 0; i < kNumIndexedInts; i++) {
+    struct occurrence *found = HashSetLookup(&index, &i);
+    assert(found != NULL && found->count == kNumOccurrences);
+  }
+  fprintf(stdout, "Indexed %d occurrences of %d ints.\n", kNumOccurrences * kNumIndexedInts, HashSetCount(&index));
+  
+  HashSetDispose(&index);
+}
+
+/**
+ * Function: HashStringKey
+ * -----------------------
+ * Hash functions and comparator for looking up a hashset of
+ * dynamically allocated C strings by bare C string keys: the key
+ * versions take the characters themselves, the element versions the
+ * address of a char *, and both hash the same way (FNV-1a).
+ */
+
+static uint64_t FullHashStringKey(const void *key)
+{
+  const unsigned char *s = key;
+  uint64_t hashcode = 14695981039346656037ULL;
+  for (int i = 0; s[i] != '\0'; i++)
+    hashcode = (hashcode ^ s[i]) * 1099511628211ULL;
+  return hashcode;
+}
+
+static int HashStringKey(const void *key, int numBuckets)
+{
+  return FullHashStringKey(key) % numBuckets;
+}
+
+static uint64_t FullHashStringElem(const void *elem)
+{
+  return FullHashStringKey(*(const char **)elem);
+}
+
+static int HashStringElem(const void *elem, int numBuckets)
+{
+  return HashStringKey(*(const char **)elem, numBuckets);
+}
+
+static int CompareStringKey(const void *key, const void *elem)
+{
+  return strcmp(key, *(const char **)elem);
+}
+
+/**
+ * Function: TestLookupKey
+ * -----------------------
+ * Fills a hashset of strings (with and without a full hash function)
+ * and then looks every string up with HashSetLookupKey by a bare
+ * C string sitting in a stack buffer, along with as many absent ones.
+ * The chained hashset rehashes incrementally, so the first lookups
+ * also exercise the old bucket array.
+ */
+
+static const int kNumKeyedStrings = 10000;
+static void TestLookupKey(const char *layoutName, HashSetConstructor newfn)
+{
+  char buffer[32];
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s key lookup test\n", layoutName);
+  for (int fullHash = 0; fullHash <= 1; fullHash++) {
+    hashset strings;
+    newfn(&strings, sizeof(char *), 1, HashStringElem, CompareString, FreeString);
+    if (fullHash) HashSetSetFullHashFunction(&strings, FullHashStringElem);
+    if (newfn == HashSetNew) HashSetSetIncrementalRehash(&strings, true);
+    for (int i = 0; i < kNumKeyedStrings; i++) {
+      sprintf(buffer, "key %d", i);
+      char *copy = strdup(buffer);
+      HashSetEnter(&strings, &copy);
+    }
+    
+    for (int i = 0; i < 2 * kNumKeyedStrings; i++) {
+      sprintf(buffer, "key %d", i);
+      char **found = HashSetLookupKey(&strings, buffer, HashStringKey, FullHashStringKey, CompareStringKey);
+      assert(i < kNumKeyedStrings ? found != NULL && strcmp(*found, buffer) == 0 : found == NULL);
+    }
+    fprintf(stdout, "Looked up %d strings by key%s.\n", 2 * kNumKeyedStrings,
+	    fullHash ? " with full hash codes" : "");
+    HashSetDispose(&strings);
+  }
+}
+
+/**
+ * Function: CountFree
+ * -------------------
+ * Free function for hashsets of ints, which have nothing to free,
+ * that counts its calls in numFreed instead.
+ */
+
+static int numFreed = 0;
+static void CountFree(void *elem)
+{
+  numFreed++;
+}
+
+/**
+ * Function: TestRemove
+ * --------------------
+ * Enters clustered ints, removes every other one and checks that
+ * exactly the rest can still be found (removing from the middle of a
+ * cluster is what open addressing finds hardest), that each removal
+ * freed one element, and that removing an absent element does nothing.
+ * Then slides a window of ints through a hashset with a minimum load
+ * factor, many times the window's size, to check that entering and
+ * removing keeps the hashset's size bounded.
+ */
+
+static const int kNumRemovedInts = 20000;
+static const int kRollingWindowSize = 1000;
+static void TestRemove(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset ints;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s remove test\n", layoutName);
+  newfn(&ints, sizeof(int), 1, HashIntClustered, CompareInt, CountFree);
+  for (int i = 0; i < kNumRemovedInts; i++)
+    HashSetEnter(&ints, &i);
+  numFreed = 0;
+  for (int i = 0; i < kNumRemovedInts; i += 2)
+    assert(HashSetRemove(&ints, &i));
+  for (int i = 0; i < kNumRemovedInts; i += 2)
+    assert(!HashSetRemove(&ints, &i));
+  
+  assert(numFreed == kNumRemovedInts / 2);
+  assert(HashSetCount(&ints) == kNumRemovedInts / 2);
+  for (int i = 0; i < kNumRemovedInts; i++) {
+    int *found = HashSetLookup(&ints, &i);
+    assert(i % 2 == 0 ? found == NULL : found != NULL && *found == i);
+  }
+  int count = 0;
+  HashSetMap(&ints, CountElement, &count);
+  assert(count == kNumRemovedInts / 2);
+  HashSetDispose(&ints);
+  
+  newfn(&ints, sizeof(int), 1, HashInt, CompareInt, NULL);
+  HashSetSetMinLoadFactor(&ints, ints.max_load / 4);
+  int maxBucketsNum = 0;
+  for (int i = 0; i < 50 * kRollingWindowSize; i++) {
+    HashSetEnter(&ints, &i);
+    int expired = i - kRollingWindowSize;
+    if (expired >= 0) assert(HashSetRemove(&ints, &expired));
+    if (ints.buckets_num > maxBucketsNum) maxBucketsNum = ints.buckets_num;
+  }
+  assert(HashSetCount(&ints) == kRollingWindowSize);
+  assert(maxBucketsNum <= 4 * kRollingWindowSize);
+  for (int i = 0; i < 50 * kRollingWindowSize; i++) {
+    int expired = i;
+    HashSetRemove(&ints, &expired);
+  }
+  assert(HashSetCount(&ints) == 0);
+  fprintf(stdout, "Rolling window of %d ints never took more than %d buckets, and %d once emptied.\n",
+	  kRollingWindowSize, maxBucketsNum, ints.buckets_num);
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: TestLookupBatch
+ * -------------------------
+ * Enters the even ints below a limit (clustered, so some of the
+ * batched lookups have to probe a long way) and then looks up every
+ * int below the limit with HashSetLookupBatch, in batches of awkward
+ * sizes, checking each answer against HashSetLookup's.  Then does it
+ * all again with a Bloom filter in front, which has to turn away most
+ * of the odd ints without turning away any of the even ones.
+ */
+
+static const int kNumBatchedInts = 10000;
+static void TestLookupBatch(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset ints;
+  int keys[kNumBatchedInts];
+  void *results[kNumBatchedInts];
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s batched lookup test\n", layoutName);
+  newfn(&ints, sizeof(int), 1, HashIntClustered, CompareInt, NULL);
+  for (int i = 0; i < kNumBatchedInts; i += 2)
+    HashSetEnter(&ints, &i);
+  for (int i = 0; i < kNumBatchedInts; i++)
+    keys[i] = (i * 7919) % kNumBatchedInts;   // every int once, out of order
+  
+  for (int bloomBits = 0; bloomBits <= 10; bloomBits += 10) {
+    HashSetSetBloomFilter(&ints, bloomBits);
+    for (int batchSize = 1; batchSize <= 100; batchSize += 33) {
+      for (int start = 0; start < kNumBatchedInts; start += batchSize) {
+	int n = (kNumBatchedInts - start < batchSize) ? kNumBatchedInts - start : batchSize;
+	HashSetLookupBatch(&ints, keys + start, n, results + start);
+      }
+      for (int i = 0; i < kNumBatchedInts; i++) {
+	assert(results[i] == HashSetLookup(&ints, &keys[i]));
+	assert(results[i] == NULL ? keys[i] % 2 == 1 : *(int *)results[i] == keys[i]);
+      }
+    }
+    fprintf(stdout, "Looked up %d ints in batches%s.\n", kNumBatchedInts,
+	    bloomBits == 0 ? "" : " behind a Bloom filter");
+  }
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: TestStats
+ * -------------------
+ * Enters ints that collide in runs of eight into a hashset that starts
+ * with a single bucket, looks every one of them up, and checks that
+ * HashSetStats adds up: the histogram covers every bucket, the chains
+ * cover every element, the runs show up as chains of eight or more, and
+ * the counters (when the library keeps them) match the calls made.
+ */
+
+static const int kNumStatsInts = 4000;
+static void TestStats(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset ints;
+  hashsetstats stats;
+
+  fprintf(stdout, "\n\n ------------------------- Starting the %s stats test\n", layoutName);
+  newfn(&ints, sizeof(int), 1, HashIntClustered, CompareInt, NULL);
+  for (int i = 0; i < kNumStatsInts; i++)
+    HashSetEnter(&ints, &i);
+  for (int i = 0; i < kNumStatsInts; i++)
+    assert(HashSetLookup(&ints, &i) != NULL);
+  HashSetStats(&ints, &stats);
+
+  int numBuckets = 0, numElems = 0;
+  for (int k = 0; k < kHashSetStatsHistogramSize; k++) {
+    numBuckets += stats.histogram[k];
+    if (k < kHashSetStatsHistogramSize - 1) numElems += k * stats.histogram[k];
+  }
+  assert(stats.elems_num == kNumStatsInts);
+  assert(numBuckets == stats.buckets_num);
+  assert(stats.used_buckets == stats.buckets_num - stats.histogram[0]);
+  assert(stats.histogram[kHashSetStatsHistogramSize - 1] > 0 || numElems == kNumStatsInts);
+  assert(stats.max_chain_len >= 8);
+  assert(stats.mean_chain_len * stats.used_buckets > kNumStatsInts - 0.5);
+  assert(stats.mean_chain_len * stats.used_buckets < kNumStatsInts + 0.5);
+  assert(stats.max_probe_len >= 1 && stats.mean_probe_len >= 1);
+  assert(stats.mean_probe_len <= stats.max_probe_len);
+  assert(stats.bytes_allocated >= kNumStatsInts * sizeof(int));
+
+  if (stats.counted) {
+    assert(stats.lookups == kNumStatsInts && stats.inserts == kNumStatsInts);
+    assert(stats.lookup_compares >= kNumStatsInts);
+    assert(stats.resizes > 0);
+  } else assert(stats.lookups == 0 && stats.insert_compares == 0 && stats.resizes == 0);
+
+  fprintf(stdout, "%d ints in %d buckets, %d used: longest chain %d, average %.2f; "
+	  "longest probe %d, average %.2f; %lu bytes.\n", stats.elems_num, stats.buckets_num,
+	  stats.used_buckets, stats.max_chain_len, stats.mean_chain_len, stats.max_probe_len,
+	  stats.mean_probe_len, (unsigned long) stats.bytes_allocated);
+  if (stats.counted)
+    fprintf(stdout, "%.2f compares per lookup, %.2f per insert, %ld resizes.\n",
+	    (double) stats.lookup_compares / stats.lookups, (double) stats.insert_compares / stats.inserts,
+	    stats.resizes);
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: SumInt, CollectInt, MergeCollected
+ * --------------------------------------------
+ * Map and merge functions for TestParallelMap: SumInt adds an int to a
+ * total that every thread shares, so it adds atomically, and CollectInt
+ * appends it to a thread's own vector, which MergeCollected then moves
+ * over to the first thread's vector.
+ */
+
+static void SumInt(void *elem, void *auxData)
+{
+  __atomic_fetch_add((long *) auxData, *(int *) elem, __ATOMIC_RELAXED);
+}
+
+static void CollectInt(void *elem, void *auxData)
+{
+  VectorAppend(auxData, elem);
+}
+
+static void MergeCollected(void *accumulator, void *threadAccumulator)
+{
+  if (VectorLength(threadAccumulator) > 0)
+    VectorAppendN(accumulator, VectorNth(threadAccumulator, 0), VectorLength(threadAccumulator));
+  VectorDispose(threadAccumulator);
+}
+
+/**
+ * Function: TestParallelMap
+ * -------------------------
+ * Maps over a hashset of ints on various numbers of threads (more of
+ * them than there are buckets, even), once adding the ints up with
+ * HashSetParallelMap and once collecting them with HashSetParallelReduce,
+ * and checks that every int was visited exactly once.
+ */
+
+static const int kNumMappedInts = 20000;
+static const int kMapThreads[] = { 1, 3, 64 };
+static void TestParallelMap(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset ints;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s parallel map test\n", layoutName);
+  newfn(&ints, sizeof(int), 1, HashInt, CompareInt, NULL);
+  HashSetSetIncrementalRehash(&ints, true);
+  for (int i = 0; i < kNumMappedInts; i++)
+    HashSetEnter(&ints, &i);
+
+  for (int t = 0; t < sizeof(kMapThreads) / sizeof(kMapThreads[0]); t++) {
+    int numThreads = kMapThreads[t];
+    long sum = 0;
+    HashSetParallelMap(&ints, SumInt, &sum, numThreads);
+    assert(sum == (long) kNumMappedInts * (kNumMappedInts - 1) / 2);
+
+    vector *collected = malloc(numThreads * sizeof(vector));
+    for (int i = 0; i < numThreads; i++)
+      VectorNew(&collected[i], sizeof(int), NULL, 0);
+    HashSetParallelReduce(&ints, CollectInt, collected, sizeof(vector), numThreads, MergeCollected);
+    assert(VectorLength(&collected[0]) == kNumMappedInts);
+    VectorSort(&collected[0], CompareInt);
+    for (int i = 0; i < kNumMappedInts; i++)
+      assert(*(int *) VectorNth(&collected[0], i) == i);
+    VectorDispose(&collected[0]);
+    free(collected);
+    fprintf(stdout, "Mapped over %d ints on %d thread%s.\n", kNumMappedInts, numThreads, numThreads == 1 ? "" : "s");
+  }
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: TestBuildFrom
+ * -----------------------
+ * Builds hashsets of strings out of an array in which the first half of
+ * the strings show up a second time, on one thread and on several, and
+ * checks that the result is what entering the strings in order would
+ * leave behind: every string found, the second copy of each repeated one
+ * kept (and the first freed), the hashset loaded no more than allowed,
+ * and still good for entering more.  Building from nothing is tried too.
+ */
+
+static const int kNumBuiltStrings = 30000;
+static const int kBuildThreads[] = { 1, 4 };
+static void TestBuildFrom(const char *layoutName, HashSetConstructor newfn, bool fullHash)
+{
+  int n = kNumBuiltStrings + kNumBuiltStrings / 2;
+  char **copies = malloc(n * sizeof(char *));
+  char buffer[32];
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s build%s test\n",
+	  layoutName, fullHash ? " (full hashes)" : "");
+  for (int t = 0; t < sizeof(kBuildThreads) / sizeof(kBuildThreads[0]); t++) {
+    hashset strings;
+    newfn(&strings, sizeof(char *), 1, HashStringElem, CompareString, FreeString);
+    if (fullHash) HashSetSetFullHashFunction(&strings, FullHashStringElem);
+    HashSetBuildFrom(&strings, copies, 0, kBuildThreads[t]);
+    assert(HashSetCount(&strings) == 0);
+
+    for (int i = 0; i < n; i++) {
+      sprintf(buffer, "string %d", i % kNumBuiltStrings);
+      copies[i] = strdup(buffer);
+    }
+    HashSetBuildFrom(&strings, copies, n, kBuildThreads[t]);
+    assert(HashSetCount(&strings) == kNumBuiltStrings);
+    assert(HashSetCount(&strings) <= strings.max_load * strings.buckets_num);
+    char *key = buffer;
+    for (int i = 0; i < kNumBuiltStrings; i++) {
+      sprintf(buffer, "string %d", i);  // copies[i] may have been freed
+      char **found = HashSetLookup(&strings, &key);
+      assert(found != NULL && *found == copies[i < n - kNumBuiltStrings ? i + kNumBuiltStrings : i]);
+    }
+
+    char *extra = strdup("one more string");
+    HashSetEnter(&strings, &extra);
+    assert(HashSetCount(&strings) == kNumBuiltStrings + 1);
+    sprintf(buffer, "string %d", kNumBuiltStrings);
+    assert(HashSetLookup(&strings, &key) == NULL);
+    fprintf(stdout, "Built %d strings out of %d on %d thread%s, into %d buckets.\n", HashSetCount(&strings) - 1,
+	    n, kBuildThreads[t], kBuildThreads[t] == 1 ? "" : "s", strings.buckets_num);
+    HashSetDispose(&strings);
+  }
+  free(copies);
+}
+
+/**
+ * Function: TestFreeze
+ * --------------------
+ * Freezes hashsets of strings of a few different sizes, the empty one
+ * included, and checks that the static hashset finds every string (by
+ * element and by bare key) and no absent one, that it holds each string
+ * exactly once, and that it frees the strings it took over.
+ */
+
+static const int kFrozenStringCounts[] = { 0, 1, 670, 20000 };
+static void TestFreeze(void)
+{
+  char buffer[32];
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the freeze test\n");
+  for (int n = 0; n < sizeof(kFrozenStringCounts) / sizeof(kFrozenStringCounts[0]); n++) {
+    int numStrings = kFrozenStringCounts[n];
+    hashset strings;
+    statichashset frozen;
+    HashSetNew(&strings, sizeof(char *), 1, HashStringElem, CompareString, FreeString);
+    HashSetSetFullHashFunction(&strings, FullHashStringElem);
+    for (int i = 0; i < numStrings; i++) {
+      sprintf(buffer, "word %d", i);
+      char *copy = strdup(buffer);
+      HashSetEnter(&strings, &copy);
+    }
+    HashSetMoveIntoStatic(&strings, &frozen);
+    
+    assert(StaticHashSetCount(&frozen) == numStrings);
+    for (int i = 0; i < 2 * numStrings + 1; i++) {
+      sprintf(buffer, "word %d", i);
+      char *key = buffer;
+      char **found = StaticHashSetLookup(&frozen, &key);
+      assert(i < numStrings ? found != NULL && strcmp(*found, buffer) == 0 : found == NULL);
+      assert(found == StaticHashSetLookupKey(&frozen, buffer, FullHashStringKey, CompareStringKey));
+    }
+    int count = 0;
+    StaticHashSetMap(&frozen, CountElement, &count);
+    assert(count == numStrings);
+    fprintf(stdout, "Froze %d strings into %d buckets.\n", numStrings, frozen.buckets_num);
+    StaticHashSetDispose(&frozen);
+  }
+}
+
+/**
+ * Function: SerializeString
+ * -------------------------
+ * Saves a C string as its characters, terminator included.
+ */
+
+static int SerializeString(const void *elem, void *buffer, int bufferSize, void *auxData)
+{
+  const char *s = *(const char **)elem;
+  int size = strlen(s) + 1;
+  if (size <= bufferSize) memcpy(buffer, s, size);
+  return size;
+}
+
+static int CompareStringRecord(const void *key, const void *record)
+{
+  return strcmp(key, record);
+}
+
+static bool StringRecordIsValid(const void *record, size_t recordSize, void *auxData)
+{
+  return memchr(record, '\0', recordSize) != NULL;
+}
+
+/**
+ * Function: TestSaveAndLoad
+ * -------------------------
+ * Saves hashsets of strings of a few different sizes, the empty one and
+ * one with strings too long for the first serialization buffer included,
+ * maps each file back in, and checks that every string is found (at an
+ * 8-byte boundary) and no absent one is, and that the hashset itself was
+ * left alone.  Freezes each hashset and saves it again with
+ * StaticHashSetSave, which must write a file of the same size that maps
+ * back in just as well.  Then checks that the file is turned down when
+ * loaded with another hash identity or when one of its record offsets is
+ * damaged, that a record damaged inside is turned down by the validate
+ * function given to HashSetLoadMapped, and that a file HashSetSave didn't
+ * write, a truncated one, and a missing one are all turned down too.
+ */
+
+static const int kSavedStringCounts[] = { 0, 1, 670, 20000 };
+static const uint64_t kSavedHashId = 0x5a5a0001;
+static void TestSaveAndLoad(void)
+{
+  char buffer[1024], filename[64];
+  size_t offsetsOffset = 0;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the save and load test\n");
+  sprintf(filename, "/tmp/hashset-test-%d.image", (int) getpid());
+  for (int n = 0; n < sizeof(kSavedStringCounts) / sizeof(kSavedStringCounts[0]); n++) {
+    int numStrings = kSavedStringCounts[n];
+    hashset strings;
+    HashSetNew(&strings, sizeof(char *), 1, HashStringElem, CompareString, FreeString);
+    HashSetSetFullHashFunction(&strings, FullHashStringElem);
+    for (int i = 0; i < numStrings; i++) {
+      sprintf(buffer, "word %d%*s", i, (i % 97 == 0) ? 500 : 0, "");
+      char *copy = strdup(buffer);
+      HashSetEnter(&strings, &copy);
+    }
+    assert(HashSetSave(&strings, filename, SerializeString, NULL, kSavedHashId));
+    assert(HashSetCount(&strings) == numStrings);
+
+    mappedhashset mapped;
+    assert(HashSetLoadMapped(&mapped, filename, kSavedHashId, NULL, NULL));
+    assert(MappedHashSetCount(&mapped) == numStrings);
+    for (int i = 0; i < 2 * numStrings + 1; i++) {
+      sprintf(buffer, "word %d%*s", i, (i % 97 == 0) ? 500 : 0, "");
+      const char *found = MappedHashSetLookupKey(&mapped, buffer, FullHashStringKey, CompareStringRecord);
+      assert(i < numStrings ? found != NULL && strcmp(found, buffer) == 0 : found == NULL);
+      assert((uintptr_t) found % 8 == 0);
+      char *key = buffer;
+      assert((found != NULL) == (HashSetLookup(&strings, &key) != NULL));
+    }
+    offsetsOffset = (const char *) mapped.offsets - (const char *) mapped.image;
+    MappedHashSetDispose(&mapped);
+
+    // Saving the frozen hashset writes the same placement, record for record
+    struct stat saved;
+    stat(filename, &saved);
+    statichashset frozen;
+    HashSetMoveIntoStatic(&strings, &frozen);
+    assert(StaticHashSetSave(&frozen, filename, SerializeString, NULL, kSavedHashId));
+    assert(HashSetLoadMapped(&mapped, filename, kSavedHashId, NULL, NULL));
+    assert(mapped.image_size == saved.st_size);
+    for (int i = 0; i < numStrings; i++) {
+      sprintf(buffer, "word %d%*s", i, (i % 97 == 0) ? 500 : 0, "");
+      const char *found = MappedHashSetLookupKey(&mapped, buffer, FullHashStringKey, CompareStringRecord);
+      assert(found != NULL && strcmp(found, buffer) == 0);
+    }
+    MappedHashSetDispose(&mapped);
+    StaticHashSetDispose(&frozen);
+    fprintf(stdout, "Saved and mapped %d strings, from the hashset and frozen.\n", numStrings);
+  }
+
+  // The last file saved is the biggest; it's turned down under another hash identity
+  mappedhashset mapped;
+  assert(!HashSetLoadMapped(&mapped, filename, kSavedHashId + 1, NULL, NULL));
+
+  // It's also turned down with a record offset pointing back at an earlier record, or out of the file
+  const uint64_t kBadOffsets[] = { 8, (uint64_t) 1 << 40 };
+  for (int i = 0; i < sizeof(kBadOffsets) / sizeof(kBadOffsets[0]); i++) {
+    uint64_t goodOffset;
+    FILE *outfile = fopen(filename, "r+");
+    fseek(outfile, offsetsOffset + sizeof(uint64_t), SEEK_SET);
+    fread(&goodOffset, sizeof(goodOffset), 1, outfile);
+    fseek(outfile, offsetsOffset + sizeof(uint64_t), SEEK_SET);
+    fwrite(&kBadOffsets[i], sizeof(kBadOffsets[i]), 1, outfile);
+    fclose(outfile);
+    assert(!HashSetLoadMapped(&mapped, filename, kSavedHashId, NULL, NULL));
+
+    outfile = fopen(filename, "r+");
+    fseek(outfile, offsetsOffset + sizeof(uint64_t), SEEK_SET);
+    fwrite(&goodOffset, sizeof(goodOffset), 1, outfile);
+    fclose(outfile);
+    assert(HashSetLoadMapped(&mapped, filename, kSavedHashId, NULL, NULL));
+    MappedHashSetDispose(&mapped);
+  }
+
+  // A record with its terminator overwritten is turned down by the validate function, and only that one
+  uint64_t recordOffsets[2];
+  FILE *outfile = fopen(filename, "r+");
+  fseek(outfile, offsetsOffset + sizeof(uint64_t), SEEK_SET);
+  fread(recordOffsets, sizeof(uint64_t), 2, outfile);
+  fseek(outfile, recordOffsets[0], SEEK_SET);
+  for (uint64_t i = recordOffsets[0]; i < recordOffsets[1]; i++) fputc('x', outfile);
+  fclose(outfile);
+  assert(HashSetLoadMapped(&mapped, filename, kSavedHashId, StringRecordIsValid, NULL));
+  int numStrings = kSavedStringCounts[sizeof(kSavedStringCounts) / sizeof(kSavedStringCounts[0]) - 1];
+  int numMissing = 0;
+  for (int i = 0; i < numStrings; i++) {
+    sprintf(buffer, "word %d%*s", i, (i % 97 == 0) ? 500 : 0, "");
+    if (MappedHashSetLookupKey(&mapped, buffer, FullHashStringKey, CompareStringRecord) == NULL) numMissing++;
+  }
+  assert(numMissing == 1);
+  MappedHashSetDispose(&mapped);
+
+  outfile = fopen(filename, "r+");
+  fprintf(outfile, "not a hashset");
+  fclose(outfile);
+  assert(!HashSetLoadMapped(&mapped, filename, kSavedHashId, NULL, NULL));
+  truncate(filename, 8);
+  assert(!HashSetLoadMapped(&mapped, filename, kSavedHashId, NULL, NULL));
+  remove(filename);
+  assert(!HashSetLoadMapped(&mapped, filename, kSavedHashId, NULL, NULL));
+  fprintf(stdout, "Turned down a file saved under another hash, ones with bad record offsets, a damaged record, "
+	  "a corrupt file, a truncated one and a missing one.\n");
+}
+
+/**
+ * Function: TestBloomFilter
+ * -------------------------
+ * Puts a Bloom filter in front of a hashset of ints and enters the even
+ * ones below a limit, growing the hashset (and so rebuilding the filter)
+ * several times along the way.  Checks that every even int is found,
+ * that no odd one is, and that the filter spares the compare function
+ * for all but a few of the odd ones.  Then removes every other even int
+ * and checks that the stale filter still gives the right answers, and
+ * that the hashset carries on once the filter is taken away.
+ */
+
+static int numIntCompares;
+static int CompareIntCounted(const void *elem1, const void *elem2)
+{
+  numIntCompares++;
+  return CompareInt(elem1, elem2);
+}
+
+static const int kNumFilteredInts = 20000;
+static void TestBloomFilter(const char *layoutName, HashSetConstructor newfn)
+{
+  hashset ints;
+  
+  fprintf(stdout, "\n\n ------------------------- Starting the %s Bloom filter test\n", layoutName);
+  newfn(&ints, sizeof(int), 1, HashInt, CompareIntCounted, NULL);
+  HashSetSetBloomFilter(&ints, 10);
+  for (int i = 0; i < kNumFilteredInts; i += 2)
+    HashSetEnter(&ints, &i);
+  
+  numIntCompares = 0;
+  for (int i = 1; i < 2 * kNumFilteredInts; i += 2)
+    assert(HashSetLookup(&ints, &i) == NULL);
+  int numMissCompares = numIntCompares;
+  assert(numMissCompares < kNumFilteredInts / 10);
+  for (int i = 0; i < kNumFilteredInts; i += 2)
+    assert(*(int *)HashSetLookup(&ints, &i) == i);
+  
+  for (int i = 0; i < kNumFilteredInts; i += 4)
+    assert(HashSetRemove(&ints, &i));
+  for (int i = 0; i < kNumFilteredInts; i += 2) {
+    int *found = HashSetLookup(&ints, &i);
+    assert(i % 4 == 0 ? found == NULL : *found == i);
+  }
+  
+  HashSetSetBloomFilter(&ints, 0);
+  assert(HashSetCount(&ints) == kNumFilteredInts / 4);
+  for (int i = 0; i < kNumFilteredInts; i++)
+    assert((HashSetLookup(&ints, &i) != NULL) == (i % 4 == 2));
+  fprintf(stdout, "%d lookups for absent ints took %d comparisons.\n", kNumFilteredInts, numMissCompares);
+  HashSetDispose(&ints);
+}
+
+/**
+ * Function: TestHashing
+ * ---------------------
+ * Checks the hash functions of hashing.h: that HashString and HashBytes
+ * agree, that the result doesn't depend on how the bytes are aligned,
+ * that HashStringCaseFold agrees with HashString on lowered strings of
+ * every length up to and past the 48-byte stride, that the seed matters,
+ * and that flipping any one bit of the input changes about half the
+ * bits of the code.  Then spreads strings over buckets with the process
+ * seed and checks that none is badly overloaded.
+ */
+
+static const int kNumSpreadStrings = 20000;
+static const int kNumSpreadBuckets = 1009;
+static void TestHashing(void)
+{
+  char buffer[160], lowered[160], shifted[168];
+  uint64_t seed = HashSeed();
+
+  fprintf(stdout, "\n\n ------------------------- Starting the hashing test\n");
+  assert(seed != 0 && seed == HashSeed());
+  for (int len = 0; len < 150; len++) {
+    for (int i = 0; i < len; i++) {
+      buffer[i] = "aZ-9 Qx\xc9@[`{"[(i * 7 + len) % 12];
+      lowered[i] = tolower(buffer[i]);
+    }
+    buffer[len] = lowered[len] = '\0';
+    uint64_t hashcode = HashString(buffer, seed);
+    assert(hashcode == HashBytes(buffer, len, seed));
+    for (int offset = 1; offset < 8; offset++) {
+      memcpy(shifted + offset, buffer, len);
+      assert(HashBytes(shifted + offset, len, seed) == hashcode);
+    }
+    assert(HashStringCaseFold(buffer, seed) == HashString(lowered, seed));
+    assert(HashString(buffer, seed + 1) != hashcode);
+  }
+
+  int totalFlipped = 0, numFlips = 0;
+  for (int bit = 0; bit < 8 * 24; bit++) {
+    memset(buffer, 'k', 24);
+    uint64_t before = HashBytes(buffer, 24, seed);
+    buffer[bit / 8] ^= 1 << (bit % 8);
+    totalFlipped += __builtin_popcountll(before ^ HashBytes(buffer, 24, seed));
+    numFlips++;
+  }
+  double averageFlipped = (double) totalFlipped / numFlips;
+  assert(averageFlipped > 28 && averageFlipped < 36);
+
+  int counts[kNumSpreadBuckets];
+  int maxCount = 0;
+  memset(counts, 0, sizeof(counts));
+  for (int i = 0; i < kNumSpreadStrings; i++) {
+    sprintf(buffer, "word %d", i);
+    int bucket = HashString(buffer, seed) % kNumSpreadBuckets;
+    if (++counts[bucket] > maxCount) maxCount = counts[bucket];
+  }
+  assert(maxCount < 3 * kNumSpreadStrings / kNumSpreadBuckets);
+  fprintf(stdout, "One flipped bit changes %.1f bits of the code on average.\n", averageFlipped);
+  fprintf(stdout, "%d strings in %d buckets, no more than %d in any one.\n",
+	  kNumSpreadStrings, kNumSpreadBuckets, maxCount);
+}
+
 int main(int ununsed, char **alsoUnused) 
 {
   TestHashTable();	
+  TestRehash();
+  TestIncrementalRehash();
+  TestLookupsLeaveElements();
+  TestOpenHashSet("Robin Hood", HashSetNewOpen);
+  TestOpenHashSet("Swiss table", HashSetNewSwiss);
+  TestFullHashFunction("chained", HashSetNew);
+  TestFullHashFunction("Robin Hood", HashSetNewOpen);
+  TestFullHashFunction("Swiss table", HashSetNewSwiss);
+  TestFindOrInsert("chained", HashSetNew);
+  TestFindOrInsert("Robin Hood", HashSetNewOpen);
+  TestFindOrInsert("Swiss table", HashSetNewSwiss);
+  TestLookupKey("chained", HashSetNew);
+  TestLookupKey("Robin Hood", HashSetNewOpen);
+  TestLookupKey("Swiss table", HashSetNewSwiss);
+  TestRemove("chained", HashSetNew);
+  TestRemove("Robin Hood", HashSetNewOpen);
+  TestRemove("Swiss table", HashSetNewSwiss);
+  TestLookupBatch("chained", HashSetNew);
+  TestLookupBatch("Robin Hood", HashSetNewOpen);
+  TestLookupBatch("Swiss table", HashSetNewSwiss);
+  TestParallelMap("chained", HashSetNew);
+  TestParallelMap("Robin Hood", HashSetNewOpen);
+  TestParallelMap("Swiss table", HashSetNewSwiss);
+  TestStats("chained", HashSetNew);
+  TestStats("Robin Hood", HashSetNewOpen);
+  TestStats("Swiss table", HashSetNewSwiss);
+  TestBuildFrom("chained", HashSetNew, false);
+  TestBuildFrom("chained", HashSetNew, true);
+  TestBuildFrom("Robin Hood", HashSetNewOpen, false);
+  TestBuildFrom("Swiss table", HashSetNewSwiss, true);
+  TestFreeze();
+  TestSaveAndLoad();
+  TestBloomFilter("chained", HashSetNew);
+  TestBloomFilter("Robin Hood", HashSetNewOpen);
+  TestBloomFilter("Swiss table", HashSetNewSwiss);
+  TestHashing();
   return 0;
 }
 
@@ -0,0 +1,59 @@
+#include "parallel.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct
+{
+	pthread_t thread;
+	int start;
+	int end;
+	int index;
+	ParallelForFunction forfn;
+	void * auxData;
+} ParallelRange;
+
+static void * RunRange(void * arg)
+{
+	ParallelRange * range = arg;
+	range->forfn(range->start, range->end, range->index, range->auxData);
+	return NULL;
+}
+
+void ParallelFor(int n, int numThreads, ParallelForFunction forfn, void * auxData)
+{
+	// Check all assert conditions
+	assert(n >= 0);
+	assert(numThreads > 0);
+	assert(forfn != NULL);
+	// Asserts checked
+
+	ParallelRange * ranges = malloc(numThreads * sizeof(ParallelRange));
+	assert(ranges != NULL);
+	for (int i = 0; i < numThreads; i++)
+	{
+		ranges[i].start = (long long)n * i / numThreads;
+		ranges[i].end = (long long)n * (i + 1) / numThreads;
+		ranges[i].index = i;
+		ranges[i].forfn = forfn;
+		ranges[i].auxData = auxData;
+	}
+
+	// The calling thread takes the first range itself
+	for (int i = 1; i < numThreads; i++)
+	{
+		int err = pthread_create(&ranges[i].thread, NULL, RunRange, &ranges[i]);
+		assert(err == 0);
+	}
+	RunRange(&ranges[0]);
+	for (int i = 1; i < numThreads; i++)
+		pthread_join(ranges[i].thread, NULL);
+	free(ranges);
+}
+
+int ParallelDefaultThreads(void)
+{
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	return (processors > 0) ? processors : 1;
+}
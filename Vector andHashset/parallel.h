@@ -0,0 +1,44 @@
+#ifndef _parallel_
+#define _parallel_
+
+/* File: parallel.h
+ * -----------------
+ * Defines a minimal fork-join helper for splitting a loop over several
+ * threads, used by the bulk operations of the hashset and the vector.
+ */
+
+/**
+ * Type: ParallelForFunction
+ * -------------------------
+ * Class of function run by ParallelFor on each of its threads, with the
+ * range [start, end) of loop indices that thread is responsible for, the
+ * index of the thread (from 0 to the number of threads minus 1), and the
+ * auxiliary data passed to ParallelFor.
+ */
+
+typedef void (*ParallelForFunction)(int start, int end, int thread, void *auxData);
+
+/**
+ * Function: ParallelFor
+ * ---------------------
+ * Splits the indices [0, n) into numThreads ranges of nearly equal size,
+ * in order, and runs forfn on each range on a thread of its own, with the
+ * calling thread taking the first.  Returns once every range is done.
+ * Ranges can be empty when there are more threads than indices.
+ *
+ * An assert is raised if n is negative, if numThreads isn't positive, or
+ * if a thread can't be started.
+ */
+
+void ParallelFor(int n, int numThreads, ParallelForFunction forfn, void *auxData);
+
+/**
+ * Function: ParallelDefaultThreads
+ * --------------------------------
+ * Returns the number of processors online, which is a sensible number of
+ * threads for ParallelFor when nothing else is running.
+ */
+
+int ParallelDefaultThreads(void);
+
+#endif
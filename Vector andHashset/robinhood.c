@@ -0,0 +1,287 @@
+#include "robinhood.h"
+#include "hashsetcounters.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int kEmptySlot = 0;
+enum { kRobinHoodBatchSize = 16 };
+
+static void * SlotAt(const hashset * h, int pos)
+{
+	return (char *)h->slots + (size_t)pos * h->elem_size;
+}
+
+static int NextSlot(const hashset * h, int pos)
+{
+	return (pos + 1 == h->buckets_num) ? 0 : pos + 1;
+}
+
+/* The key's full hash code, when the hashset keeps them in h->hashes. */
+static uint64_t FullHash(const hashset * h, const void * keyAddr, HashSetFullHashFunction fullhashfn)
+{
+	return (h->hashes != NULL) ? fullhashfn(keyAddr) : 0;
+}
+
+static int HomeSlot(const hashset * h, const void * keyAddr, HashSetHashFunction hashfn, uint64_t hash)
+{
+	if (h->hashes != NULL) return hash % h->buckets_num;
+
+	int home_pos = hashfn(keyAddr, h->buckets_num);
+	assert(home_pos >= 0);
+	assert(home_pos < h->buckets_num);
+	return home_pos;
+}
+
+/* Walks the probe sequence of keyAddr.  Elements along the way are ordered
+	by distance from home, so the search stops at the first slot whose element
+	is closer to home than we are.  Only elements exactly as far from home as
+	we are share our home slot, and only those are worth comparing against
+	(and, with stored hash codes, only those whose codes match).  Returns the
+	matching slot, or -1 with *insertPos and *probeLen describing where the
+	element would go. */
+static int RobinHoodFind(const hashset * h, const void * keyAddr, int homePos,
+		uint64_t hash, HashSetCompareFunction cmpfn, int * insertPos, int * probeLen)
+{
+	int pos = homePos;
+	int probe_len = 1;
+
+	while (h->probe_lens[pos] >= probe_len)
+	{
+		if (h->probe_lens[pos] == probe_len && (h->hashes == NULL || h->hashes[pos] == hash))
+		{
+			HASHSET_COUNT_COMPARES(h, 1);
+			if (cmpfn(keyAddr, SlotAt(h, pos)) == 0) return pos;
+		}
+		pos = NextSlot(h, pos);
+		probe_len++;
+	}
+
+	if (insertPos != NULL) *insertPos = pos;
+	if (probeLen != NULL) *probeLen = probe_len;
+	return -1;
+}
+
+/* Places the element at pos, pushing the occupant (and then each occupant
+	after it that sits closer to its home) one step further along. */
+static void RobinHoodPlace(hashset * h, const void * elemAddr, uint64_t hash, int pos, int probeLen)
+{
+	void * carry = h->scratch;
+	void * swap = (char *)h->scratch + h->elem_size;
+	memcpy(carry, elemAddr, h->elem_size);
+
+	while (h->probe_lens[pos] != kEmptySlot)
+	{
+		if (h->probe_lens[pos] < probeLen)
+		{
+			void * slot = SlotAt(h, pos);
+			memcpy(swap, slot, h->elem_size);
+			memcpy(slot, carry, h->elem_size);
+			memcpy(carry, swap, h->elem_size);
+			if (h->hashes != NULL)
+			{
+				uint64_t displaced_hash = h->hashes[pos];
+				h->hashes[pos] = hash;
+				hash = displaced_hash;
+			}
+
+			int displaced_len = h->probe_lens[pos];
+			h->probe_lens[pos] = probeLen;
+			probeLen = displaced_len;
+		}
+		pos = NextSlot(h, pos);
+		probeLen++;
+		assert(probeLen <= USHRT_MAX);
+	}
+
+	memcpy(SlotAt(h, pos), carry, h->elem_size);
+	h->probe_lens[pos] = probeLen;
+	if (h->hashes != NULL) h->hashes[pos] = hash;
+}
+
+/* Allocates an empty table of numSlots slots, with room for a hash code
+	per slot if the hashset has a full hash function. */
+static void RobinHoodAllocate(hashset * h, int numSlots)
+{
+	h->buckets_num = numSlots;
+	h->slots = malloc((size_t)numSlots * h->elem_size);
+	h->probe_lens = calloc(numSlots, sizeof(unsigned short));
+	assert(h->slots != NULL);
+	assert(h->probe_lens != NULL);
+
+	h->hashes = NULL;
+	if (h->fullHashFn != NULL)
+	{
+		h->hashes = malloc((size_t)numSlots * sizeof(uint64_t));
+		assert(h->hashes != NULL);
+	}
+}
+
+void RobinHoodNew(hashset * h, int numSlots)
+{
+	RobinHoodAllocate(h, numSlots);
+	h->scratch = malloc(2 * h->elem_size);
+	assert(h->scratch != NULL);
+}
+
+void RobinHoodDispose(hashset * h)
+{
+	if (h->freeFn != NULL)
+	{
+		for (int i = 0; i < h->buckets_num; i++)
+			if (h->probe_lens[i] != kEmptySlot) h->freeFn(SlotAt(h, i));
+	}
+	free(h->slots);
+	free(h->probe_lens);
+	free(h->hashes);
+	free(h->scratch);
+}
+
+void * RobinHoodLookup(const hashset * h, const void * keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn, HashSetCompareFunction cmpfn)
+{
+	uint64_t hash = FullHash(h, keyAddr, fullhashfn);
+	int pos = RobinHoodFind(h, keyAddr, HomeSlot(h, keyAddr, hashfn, hash), hash, cmpfn, NULL, NULL);
+	if (pos == -1) return NULL;
+	return SlotAt(h, pos);
+}
+
+/* Each key's home slot is worked out (and its probe length, slot and hash
+	code prefetched) for a whole batch of keys before any of them is searched,
+	so the cache misses overlap instead of being taken one lookup at a time.
+	Keys the Bloom filter rules out are dropped as they're hashed, and are
+	never prefetched or searched for. */
+void RobinHoodLookupBatch(const hashset * h, const void * keys, int n, void ** results)
+{
+	uint64_t hashes[kRobinHoodBatchSize];
+	int home_pos[kRobinHoodBatchSize];
+	bool ruled_out[kRobinHoodBatchSize];
+
+	for (int start = 0; start < n; start += kRobinHoodBatchSize)
+	{
+		int end = (n - start < kRobinHoodBatchSize) ? n : start + kRobinHoodBatchSize;
+		for (int i = start; i < end; i++)
+		{
+			const void * key = (const char *)keys + (size_t)i * h->elem_size;
+			uint64_t hash = FullHash(h, key, h->fullHashFn);
+			ruled_out[i - start] = h->bloom_bits != 0 && !BloomFilterMayContain(&h->bloom, BloomCode(h, key, hash));
+			if (ruled_out[i - start]) continue;
+			int pos = HomeSlot(h, key, h->hashFn, hash);
+			__builtin_prefetch(&h->probe_lens[pos]);
+			__builtin_prefetch(SlotAt(h, pos));
+			if (h->hashes != NULL) __builtin_prefetch(&h->hashes[pos]);
+			hashes[i - start] = hash;
+			home_pos[i - start] = pos;
+		}
+
+		for (int i = start; i < end; i++)
+		{
+			const void * key = (const char *)keys + (size_t)i * h->elem_size;
+			if (ruled_out[i - start])
+			{
+				results[i] = NULL;
+				continue;
+			}
+			int pos = RobinHoodFind(h, key, home_pos[i - start], hashes[i - start], h->cmpFn, NULL, NULL);
+			results[i] = (pos == -1) ? NULL : SlotAt(h, pos);
+		}
+	}
+}
+
+/* The new element always lands in insert_pos itself: whatever was there
+	is either nothing or closer to home, and gets pushed along instead. */
+void * RobinHoodFindOrInsert(hashset * h, const void * elemAddr, bool * inserted)
+{
+	int insert_pos, probe_len;
+	uint64_t hash = FullHash(h, elemAddr, h->fullHashFn);
+	int home_pos = HomeSlot(h, elemAddr, h->hashFn, hash);
+	int pos = RobinHoodFind(h, elemAddr, home_pos, hash, h->cmpFn, &insert_pos, &probe_len);
+
+	*inserted = (pos == -1);
+	if (pos != -1) return SlotAt(h, pos);
+
+	RobinHoodPlace(h, elemAddr, hash, insert_pos, probe_len);
+	return SlotAt(h, insert_pos);
+}
+
+/* Backward-shift deletion: every element following the removed one that
+	isn't already in its home slot moves back one step, which leaves the
+	table exactly as if the removed element had never been entered. */
+bool RobinHoodRemove(hashset * h, const void * elemAddr)
+{
+	uint64_t hash = FullHash(h, elemAddr, h->fullHashFn);
+	int pos = RobinHoodFind(h, elemAddr, HomeSlot(h, elemAddr, h->hashFn, hash), hash, h->cmpFn, NULL, NULL);
+	if (pos == -1) return false;
+
+	if (h->freeFn != NULL) h->freeFn(SlotAt(h, pos));
+
+	int next_pos = NextSlot(h, pos);
+	while (h->probe_lens[next_pos] > 1)
+	{
+		memcpy(SlotAt(h, pos), SlotAt(h, next_pos), h->elem_size);
+		h->probe_lens[pos] = h->probe_lens[next_pos] - 1;
+		if (h->hashes != NULL) h->hashes[pos] = h->hashes[next_pos];
+		pos = next_pos;
+		next_pos = NextSlot(h, next_pos);
+	}
+	h->probe_lens[pos] = kEmptySlot;
+	return true;
+}
+
+void RobinHoodMap(hashset * h, HashSetMapFunction mapfn, void * auxData)
+{
+	RobinHoodMapSlots(h, 0, h->buckets_num, mapfn, auxData);
+}
+
+void RobinHoodMapSlots(hashset * h, int start, int end, HashSetMapFunction mapfn, void * auxData)
+{
+	for (int i = start; i < end; i++)
+		if (h->probe_lens[i] != kEmptySlot) mapfn(SlotAt(h, i), auxData);
+}
+
+/* Every element sits probe_lens - 1 slots past its home, which is how the
+	home slots' chains are counted up without hashing anything. */
+void RobinHoodStats(const hashset * h, hashsetstats * stats)
+{
+	int * chain_lens = calloc(h->buckets_num, sizeof(int));
+	assert(chain_lens != NULL);
+	for (int i = 0; i < h->buckets_num; i++)
+	{
+		if (h->probe_lens[i] == kEmptySlot) continue;
+		int home_pos = i - (h->probe_lens[i] - 1);
+		if (home_pos < 0) home_pos += h->buckets_num;
+		chain_lens[home_pos]++;
+		StatsAddProbe(stats, h->probe_lens[i]);
+	}
+	for (int i = 0; i < h->buckets_num; i++)
+		StatsAddChain(stats, chain_lens[i]);
+	free(chain_lens);
+
+	size_t slot_size = h->elem_size + sizeof(unsigned short) + ((h->hashes != NULL) ? sizeof(uint64_t) : 0);
+	stats->bytes_allocated += (size_t)h->buckets_num * slot_size + 2 * h->elem_size;
+}
+
+void RobinHoodRehash(hashset * h, int newSlotsNum)
+{
+	void * old_slots = h->slots;
+	unsigned short * old_probe_lens = h->probe_lens;
+	uint64_t * old_hashes = h->hashes;
+	int old_slots_num = h->buckets_num;
+
+	RobinHoodAllocate(h, newSlotsNum);
+
+	/* Elements are distinct already, so they go straight in without searching,
+		and stored hash codes are reused rather than computed again. */
+	for (int i = 0; i < old_slots_num; i++)
+	{
+		if (old_probe_lens[i] == kEmptySlot) continue;
+		void * elem = (char *)old_slots + (size_t)i * h->elem_size;
+		uint64_t hash = (old_hashes != NULL) ? old_hashes[i] : 0;
+		RobinHoodPlace(h, elem, hash, HomeSlot(h, elem, h->hashFn, hash), 1);
+	}
+
+	free(old_slots);
+	free(old_probe_lens);
+	free(old_hashes);
+}
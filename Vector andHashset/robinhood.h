@@ -0,0 +1,31 @@
+#ifndef _robinhood_
+#define _robinhood_
+#include "hashset.h"
+
+/* File: robinhood.h
+ * ------------------
+ * Private interface between hashset.c and the open addressing
+ * (Robin Hood) layout behind HashSetNewOpen.  Clients should never
+ * include this file; everything here is reached through hashset.h.
+ *
+ * The slots of the table live in h->slots (h->buckets_num of them,
+ * h->elem_size bytes apiece), and h->probe_lens records for each slot
+ * its element's distance from its home slot plus one, so a 0 marks an
+ * empty slot.  If the hashset has a full hash function, h->hashes holds
+ * each slot's element's full hash code, which picks the home slot.  Growth
+ * is decided by hashset.c, which calls RobinHoodRehash.
+ */
+
+void RobinHoodNew(hashset *h, int numSlots);
+void RobinHoodDispose(hashset *h);
+void *RobinHoodLookup(const hashset *h, const void *keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn, HashSetCompareFunction cmpfn);
+void RobinHoodLookupBatch(const hashset *h, const void *keys, int n, void **results);
+void *RobinHoodFindOrInsert(hashset *h, const void *elemAddr, bool *inserted);
+bool RobinHoodRemove(hashset *h, const void *elemAddr);
+void RobinHoodMap(hashset *h, HashSetMapFunction mapfn, void *auxData);
+void RobinHoodMapSlots(hashset *h, int start, int end, HashSetMapFunction mapfn, void *auxData);
+void RobinHoodStats(const hashset *h, hashsetstats *stats);
+void RobinHoodRehash(hashset *h, int newSlotsNum);
+
+#endif
@@ -0,0 +1,549 @@
+#include "statichashset.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const int kAverageBucketSize = 5;
+static const uint32_t kMaxDisplacement = 1u << 24;
+static const uint64_t kSeedIncrement = 0x9E3779B97F4A7C15ULL;
+static const int kMaxSeeds = 64;
+static const size_t kElemsAlignment = 16;
+static const size_t kRecordAlignment = 8;
+static const char kImageMagic[8] = "HSETIMG";
+static const uint32_t kImageVersion = 2;
+static const uint32_t kImageByteOrder = 0x01020304;
+
+/* An element of the hashset being frozen, along with its full hash code. */
+typedef struct
+{
+	uint64_t hash;
+	const void * elem;
+} FrozenKey;
+
+typedef struct
+{
+	const hashset * h;
+	FrozenKey * keys;
+	int keys_num;
+} FrozenKeys;
+
+typedef struct
+{
+	int bucket;
+	int size;
+} BucketSize;
+
+/* The start of a file written by HashSetSave.  The sizes of the arrays
+	that follow can all be worked out from the counts (see LayoutImage). */
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t seed;
+	uint64_t hash_id;
+	uint32_t buckets_num;
+	uint32_t elems_num;
+	uint64_t image_size;
+} ImageHeader;
+
+/* Where each part of a saved file starts, from the start of the file. */
+typedef struct
+{
+	size_t displacements_offset;
+	size_t fingerprints_offset;
+	size_t offsets_offset;
+	size_t records_offset;
+} ImageLayout;
+
+/* The finalizer of splitmix64, which makes every bit of the result depend
+	on every bit of x. */
+static uint64_t Mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/* Maps a hash onto [0, n) with a multiply rather than a division. */
+static int Reduce(uint64_t hash, int n)
+{
+	return ((hash >> 32) * (uint64_t)n) >> 32;
+}
+
+static int BucketOf(const statichashset * s, uint64_t hash)
+{
+	return Reduce(Mix(hash ^ s->seed), s->buckets_num);
+}
+
+/* Taken from the low bits of the mix whose high bits pick the bucket. */
+static uint16_t FingerprintOf(const statichashset * s, uint64_t hash)
+{
+	return Mix(hash ^ s->seed);
+}
+
+/* Each displacement gives the elements of a bucket an independent shot at
+	a slot. */
+static int SlotOf(const statichashset * s, uint64_t hash, uint32_t displacement)
+{
+	return Reduce(Mix(hash ^ s->seed ^ ((uint64_t)displacement + 1) * kSeedIncrement), s->elems_num);
+}
+
+static size_t RoundUp(size_t n, size_t alignment)
+{
+	return (n + alignment - 1) & ~(alignment - 1);
+}
+
+static void * SlotAt(const statichashset * s, int pos)
+{
+	return (char *)s->elems + (size_t)pos * s->elem_size;
+}
+
+static void CollectKey(void * elemAddr, void * auxData)
+{
+	FrozenKeys * keys = auxData;
+	FrozenKey * key = &keys->keys[keys->keys_num++];
+	key->hash = keys->h->fullHashFn(elemAddr);
+	key->elem = elemAddr;
+}
+
+static int CompareKeyHashes(const void * elem1, const void * elem2)
+{
+	uint64_t hash1 = ((const FrozenKey *)elem1)->hash, hash2 = ((const FrozenKey *)elem2)->hash;
+	return (hash1 > hash2) - (hash1 < hash2);
+}
+
+static int CompareBucketSizes(const void * elem1, const void * elem2)
+{
+	return ((const BucketSize *)elem2)->size - ((const BucketSize *)elem1)->size;
+}
+
+/* Looks for a displacement that sends the numKeys keys at order to free
+	and distinct slots, and claims the slots if it finds one. */
+static bool PlaceBucket(statichashset * s, const FrozenKey * keys, const int * order, int numKeys,
+		int bucket, bool * taken, int * keySlots)
+{
+	for (uint32_t displacement = 0; displacement < kMaxDisplacement; displacement++)
+	{
+		bool placed = true;
+		for (int i = 0; i < numKeys && placed; i++)
+		{
+			int slot = SlotOf(s, keys[order[i]].hash, displacement);
+			placed = !taken[slot];
+			for (int j = 0; j < i && placed; j++)
+				placed = (keySlots[order[j]] != slot);
+			keySlots[order[i]] = slot;
+		}
+		if (!placed) continue;
+
+		for (int i = 0; i < numKeys; i++)
+			taken[keySlots[order[i]]] = true;
+		s->displacements[bucket] = displacement;
+		return true;
+	}
+	return false;
+}
+
+/* Tries to give every key a slot of its own with the current seed, filling
+	in keySlots.  The keys are grouped by bucket with a counting sort, and
+	the biggest buckets are placed first, while most slots are still free.
+	Returns false if some bucket couldn't be placed, and a new seed is needed. */
+static bool PlaceKeys(statichashset * s, const FrozenKey * keys, int * keySlots)
+{
+	int * starts = calloc(s->buckets_num + 1, sizeof(int));
+	int * order = malloc(s->elems_num * sizeof(int));
+	BucketSize * sizes = malloc(s->buckets_num * sizeof(BucketSize));
+	bool * taken = calloc(s->elems_num, sizeof(bool));
+	assert(starts != NULL && (order != NULL || s->elems_num == 0) && sizes != NULL);
+	assert(taken != NULL || s->elems_num == 0);
+
+	for (int i = 0; i < s->elems_num; i++)
+		starts[BucketOf(s, keys[i].hash) + 1]++;
+	for (int b = 0; b < s->buckets_num; b++)
+	{
+		sizes[b].bucket = b;
+		sizes[b].size = starts[b + 1];
+		starts[b + 1] += starts[b];
+	}
+	for (int i = 0; i < s->elems_num; i++)
+		order[starts[BucketOf(s, keys[i].hash)]++] = i;
+	qsort(sizes, s->buckets_num, sizeof(BucketSize), CompareBucketSizes);
+
+	// starts[b] is now where bucket b ends, and so where bucket b + 1 starts
+	bool placed = true;
+	for (int i = 0; i < s->buckets_num && placed && sizes[i].size > 0; i++)
+	{
+		int bucket = sizes[i].bucket;
+		int first = starts[bucket] - sizes[i].size;
+		placed = PlaceBucket(s, keys, order + first, sizes[i].size, bucket, taken, keySlots);
+	}
+
+	free(starts);
+	free(order);
+	free(sizes);
+	free(taken);
+	return placed;
+}
+
+static void SizeFor(statichashset * s, const hashset * h)
+{
+	s->elems_num = HashSetCount(h);
+	s->buckets_num = s->elems_num / kAverageBucketSize + 1;
+}
+
+/* Gives every element of h a slot of its own, reseeding until all of them
+	fit, and fills in s's seed and displacements.  Returns the elements with
+	their full hash codes, and the slot of each in *keySlots; the caller
+	frees both.  Keys with the same hash can't be told apart by any seed, so
+	they're ruled out up front, once, by sorting the keys by hash.  With
+	distinct hashes a handful of seeds always does, and running out of them
+	means something is badly wrong with the hash function. */
+static FrozenKey * PlaceElements(statichashset * s, const hashset * h, int ** keySlots)
+{
+	FrozenKeys keys = { h, malloc(s->elems_num * sizeof(FrozenKey)), 0 };
+	*keySlots = malloc(s->elems_num * sizeof(int));
+	assert((keys.keys != NULL && *keySlots != NULL) || s->elems_num == 0);
+	HashSetMap((hashset *)h, CollectKey, &keys);
+
+	qsort(keys.keys, s->elems_num, sizeof(FrozenKey), CompareKeyHashes);
+	for (int i = 1; i < s->elems_num; i++)
+		assert(keys.keys[i].hash != keys.keys[i - 1].hash);
+
+	s->seed = 0;
+	for (int seeds = 1; !PlaceKeys(s, keys.keys, *keySlots); seeds++)
+	{
+		if (seeds == kMaxSeeds)
+		{
+			fprintf(stderr, "statichashset: no perfect hash found in %d seeds; do two elements share a full hash code?\n", kMaxSeeds);
+			abort();
+		}
+		s->seed += kSeedIncrement;
+	}
+	return keys.keys;
+}
+
+void HashSetMoveIntoStatic(hashset * h, statichashset * s)
+{
+	// Check all assert conditions
+	assert(h->fullHashFn != NULL);
+	// Asserts checked
+
+	SizeFor(s, h);
+	s->elem_size = h->elem_size;
+	s->freeFn = h->freeFn;
+	s->fullHashFn = h->fullHashFn;
+	s->cmpFn = h->cmpFn;
+
+	// The displacements, the fingerprints and then the elements, all in one block
+	size_t fingerprints_offset = s->buckets_num * sizeof(uint32_t);
+	size_t elems_offset = RoundUp(fingerprints_offset + s->elems_num * sizeof(uint16_t), kElemsAlignment);
+	s->block = calloc(1, elems_offset + (size_t)s->elems_num * s->elem_size);
+	assert(s->block != NULL);
+	s->displacements = s->block;
+	s->fingerprints = (uint16_t *)((char *)s->block + fingerprints_offset);
+	s->elems = (char *)s->block + elems_offset;
+
+	int * key_slots;
+	FrozenKey * keys = PlaceElements(s, h, &key_slots);
+	for (int i = 0; i < s->elems_num; i++)
+	{
+		s->fingerprints[key_slots[i]] = FingerprintOf(s, keys[i].hash);
+		memcpy(SlotAt(s, key_slots[i]), keys[i].elem, s->elem_size);
+	}
+	free(keys);
+	free(key_slots);
+
+	// The elements belong to the static hashset now
+	h->freeFn = NULL;
+	HashSetDispose(h);
+}
+
+void StaticHashSetDispose(statichashset * s)
+{
+	if (s->freeFn != NULL)
+	{
+		for (int i = 0; i < s->elems_num; i++)
+			s->freeFn(SlotAt(s, i));
+	}
+	free(s->block);
+}
+
+int StaticHashSetCount(const statichashset * s)
+{
+	return s->elems_num;
+}
+
+/* Every key leads to exactly one slot, so one comparison settles it, and
+	the slot's fingerprint spares nearly every absent key even that.  Returns
+	the slot, or -1 if the fingerprint rules the key out. */
+static int FindSlot(const statichashset * s, uint64_t hash)
+{
+	if (s->elems_num == 0) return -1;
+	int slot = SlotOf(s, hash, s->displacements[BucketOf(s, hash)]);
+	return (s->fingerprints[slot] == FingerprintOf(s, hash)) ? slot : -1;
+}
+
+static void * StaticHashSetFind(const statichashset * s, const void * keyAddr,
+		uint64_t hash, HashSetCompareFunction cmpfn)
+{
+	int slot = FindSlot(s, hash);
+	if (slot < 0) return NULL;
+	void * elem = SlotAt(s, slot);
+	return (cmpfn(keyAddr, elem) == 0) ? elem : NULL;
+}
+
+void * StaticHashSetLookup(const statichashset * s, const void * elemAddr)
+{
+	assert(elemAddr != NULL);
+	return StaticHashSetFind(s, elemAddr, s->fullHashFn(elemAddr), s->cmpFn);
+}
+
+void * StaticHashSetLookupKey(const statichashset * s, const void * keyAddr,
+		HashSetFullHashFunction keyfullhashfn, HashSetCompareFunction keycmpfn)
+{
+	// Check all assert conditions
+	assert(keyAddr != NULL);
+	assert(keyfullhashfn != NULL);
+	assert(keycmpfn != NULL);
+	// Asserts checked
+
+	return StaticHashSetFind(s, keyAddr, keyfullhashfn(keyAddr), keycmpfn);
+}
+
+void StaticHashSetMap(statichashset * s, HashSetMapFunction mapfn, void * auxData)
+{
+	assert(mapfn != NULL);
+	for (int i = 0; i < s->elems_num; i++)
+		mapfn(SlotAt(s, i), auxData);
+}
+
+static ImageLayout LayoutImage(size_t bucketsNum, size_t elemsNum)
+{
+	ImageLayout layout;
+	layout.displacements_offset = sizeof(ImageHeader);
+	layout.fingerprints_offset = layout.displacements_offset + bucketsNum * sizeof(uint32_t);
+	layout.offsets_offset = RoundUp(layout.fingerprints_offset + elemsNum * sizeof(uint16_t), kRecordAlignment);
+	layout.records_offset = layout.offsets_offset + (elemsNum + 1) * sizeof(uint64_t);
+	return layout;
+}
+
+/* Writes the records in slot order, each padded to kRecordAlignment, from
+	the records offset on, and notes where each one starts in offsets (plus
+	where the last one ends).  Returns false if a write fails. */
+static bool WriteRecords(FILE * outfile, int elemsNum, const void * const * slotElems, uint64_t * offsets,
+		size_t recordsOffset, HashSetSerializeFunction serializefn, void * auxData)
+{
+	int buffer_size = 256;
+	char * buffer = malloc(buffer_size + kRecordAlignment);
+	assert(buffer != NULL);
+	bool written = (fseek(outfile, recordsOffset, SEEK_SET) == 0);
+	uint64_t offset = recordsOffset;
+	for (int slot = 0; slot < elemsNum && written; slot++)
+	{
+		const void * elem = slotElems[slot];
+		int size = serializefn(elem, buffer, buffer_size, auxData);
+		if (size > buffer_size)
+		{
+			buffer_size = 2 * size;
+			buffer = realloc(buffer, buffer_size + kRecordAlignment);
+			assert(buffer != NULL);
+			size = serializefn(elem, buffer, buffer_size, auxData);
+			assert(size <= buffer_size);
+		}
+		size_t padded_size = RoundUp(size, kRecordAlignment);
+		memset(buffer + size, 0, padded_size - size);
+		offsets[slot] = offset;
+		written = (fwrite(buffer, 1, padded_size, outfile) == padded_size);
+		offset += padded_size;
+	}
+	offsets[elemsNum] = offset;
+	free(buffer);
+	return written;
+}
+
+/* Saves the placement s has already worked out, with slotElems[i] the
+	element in slot i, which is all HashSetSave and StaticHashSetSave need
+	to differ in.  The header and the arrays are built in memory and written
+	after the records, and the whole file under a temporary name. */
+static bool WriteImage(const statichashset * s, const void * const * slotElems, const char * filename,
+		HashSetSerializeFunction serializefn, void * auxData, uint64_t hashId)
+{
+	ImageLayout layout = LayoutImage(s->buckets_num, s->elems_num);
+	char * arrays = calloc(1, layout.records_offset);
+	assert(arrays != NULL);
+	ImageHeader * header = (ImageHeader *)arrays;
+	memcpy(arrays + layout.displacements_offset, s->displacements, s->buckets_num * sizeof(uint32_t));
+	memcpy(arrays + layout.fingerprints_offset, s->fingerprints, s->elems_num * sizeof(uint16_t));
+	uint64_t * offsets = (uint64_t *)(arrays + layout.offsets_offset);
+
+	char * tempname = malloc(strlen(filename) + sizeof(".tmp"));
+	assert(tempname != NULL);
+	sprintf(tempname, "%s.tmp", filename);
+	FILE * outfile = fopen(tempname, "wb");
+	bool written = (outfile != NULL) &&
+		WriteRecords(outfile, s->elems_num, slotElems, offsets, layout.records_offset, serializefn, auxData);
+
+	memcpy(header->magic, kImageMagic, sizeof(header->magic));
+	header->version = kImageVersion;
+	header->byte_order = kImageByteOrder;
+	header->seed = s->seed;
+	header->hash_id = hashId;
+	header->buckets_num = s->buckets_num;
+	header->elems_num = s->elems_num;
+	header->image_size = offsets[s->elems_num];
+	written = written && fseek(outfile, 0, SEEK_SET) == 0 &&
+		fwrite(arrays, 1, layout.records_offset, outfile) == layout.records_offset;
+	if (outfile != NULL && fclose(outfile) != 0) written = false;
+	written = written && rename(tempname, filename) == 0;
+	if (!written && outfile != NULL) remove(tempname);
+
+	free(tempname);
+	free(arrays);
+	return written;
+}
+
+bool HashSetSave(hashset * h, const char * filename, HashSetSerializeFunction serializefn, void * auxData,
+		uint64_t hashId)
+{
+	// Check all assert conditions
+	assert(h->fullHashFn != NULL);
+	assert(serializefn != NULL);
+	// Asserts checked
+
+	// Placed just as HashSetMoveIntoStatic would, but without moving the elements
+	statichashset s;
+	SizeFor(&s, h);
+	int slots = (s.elems_num > 0) ? s.elems_num : 1;
+	s.displacements = calloc(s.buckets_num, sizeof(uint32_t));
+	s.fingerprints = malloc(slots * sizeof(uint16_t));
+	const void ** slot_elems = malloc(slots * sizeof(void *));
+	assert(s.displacements != NULL && s.fingerprints != NULL && slot_elems != NULL);
+
+	int * key_slots;
+	FrozenKey * keys = PlaceElements(&s, h, &key_slots);
+	for (int i = 0; i < s.elems_num; i++)
+	{
+		slot_elems[key_slots[i]] = keys[i].elem;
+		s.fingerprints[key_slots[i]] = FingerprintOf(&s, keys[i].hash);
+	}
+	bool written = WriteImage(&s, slot_elems, filename, serializefn, auxData, hashId);
+
+	free(slot_elems);
+	free(keys);
+	free(key_slots);
+	free(s.displacements);
+	free(s.fingerprints);
+	return written;
+}
+
+bool StaticHashSetSave(const statichashset * s, const char * filename, HashSetSerializeFunction serializefn,
+		void * auxData, uint64_t hashId)
+{
+	assert(serializefn != NULL);
+
+	int slots = (s->elems_num > 0) ? s->elems_num : 1;
+	const void ** slot_elems = malloc(slots * sizeof(void *));
+	assert(slot_elems != NULL);
+	for (int i = 0; i < s->elems_num; i++)
+		slot_elems[i] = SlotAt(s, i);
+	bool written = WriteImage(s, slot_elems, filename, serializefn, auxData, hashId);
+	free(slot_elems);
+	return written;
+}
+
+/* Makes sure the mapped file is one HashSetSave wrote with the same hash
+	function, and that everything the header says is in it fits.  Lookups
+	trust the record offsets, so every one of them is checked: aligned,
+	never going back, and starting a record within the file. */
+static bool ImageIsValid(const void * image, size_t imageSize, uint64_t hashId)
+{
+	const ImageHeader * header = image;
+	if (imageSize < sizeof(ImageHeader)) return false;
+	if (memcmp(header->magic, kImageMagic, sizeof(header->magic)) != 0) return false;
+	if (header->version != kImageVersion || header->byte_order != kImageByteOrder) return false;
+	if (header->hash_id != hashId) return false;
+	if (header->image_size != imageSize || header->buckets_num == 0) return false;
+	if (header->buckets_num > INT_MAX || header->elems_num > INT_MAX) return false;
+
+	ImageLayout layout = LayoutImage(header->buckets_num, header->elems_num);
+	if (layout.records_offset > imageSize) return false;
+	const uint64_t * offsets = (const uint64_t *)((const char *)image + layout.offsets_offset);
+	uint64_t previous = layout.records_offset;
+	for (uint32_t i = 0; i < header->elems_num; i++)
+	{
+		if (offsets[i] < previous || offsets[i] >= imageSize || offsets[i] % kRecordAlignment != 0) return false;
+		previous = offsets[i];
+	}
+	return offsets[header->elems_num] == imageSize;
+}
+
+bool HashSetLoadMapped(mappedhashset * m, const char * filename, uint64_t hashId,
+		HashSetValidateFunction validatefn, void * auxData)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void * image = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping keeps the file open
+	if (image == MAP_FAILED) return false;
+	if (!ImageIsValid(image, st.st_size, hashId))
+	{
+		munmap(image, st.st_size);
+		return false;
+	}
+
+	const ImageHeader * header = image;
+	ImageLayout layout = LayoutImage(header->buckets_num, header->elems_num);
+	m->image = image;
+	m->image_size = st.st_size;
+	m->offsets = (const uint64_t *)((char *)image + layout.offsets_offset);
+	m->validateFn = validatefn;
+	m->aux_data = auxData;
+
+	// The index is a static hashset with no elements of its own, only slots
+	memset(&m->index, 0, sizeof(m->index));
+	m->index.displacements = (uint32_t *)((char *)image + layout.displacements_offset);
+	m->index.fingerprints = (uint16_t *)((char *)image + layout.fingerprints_offset);
+	m->index.buckets_num = header->buckets_num;
+	m->index.elems_num = header->elems_num;
+	m->index.seed = header->seed;
+	return true;
+}
+
+void MappedHashSetDispose(mappedhashset * m)
+{
+	munmap(m->image, m->image_size);
+}
+
+int MappedHashSetCount(const mappedhashset * m)
+{
+	return m->index.elems_num;
+}
+
+const void * MappedHashSetLookupKey(const mappedhashset * m, const void * keyAddr,
+		HashSetFullHashFunction keyfullhashfn, HashSetCompareFunction keycmpfn)
+{
+	// Check all assert conditions
+	assert(keyAddr != NULL);
+	assert(keyfullhashfn != NULL);
+	assert(keycmpfn != NULL);
+	// Asserts checked
+
+	int slot = FindSlot(&m->index, keyfullhashfn(keyAddr));
+	if (slot < 0) return NULL;
+	// Offsets never go back, so a record runs up to where the next one starts
+	const void * record = (const char *)m->image + m->offsets[slot];
+	size_t record_size = m->offsets[slot + 1] - m->offsets[slot];
+	if (m->validateFn != NULL && !m->validateFn(record, record_size, m->aux_data)) return NULL;
+	return (keycmpfn(keyAddr, record) == 0) ? record : NULL;
+}
@@ -0,0 +1,296 @@
+#ifndef _statichashset_
+#define _statichashset_
+#include "hashset.h"
+#include <stddef.h>
+
+/* File: statichashset.h
+ * ----------------------
+ * Defines the interface for the static hashset, a read-only hashset
+ * frozen out of an ordinary one once all of its elements have been
+ * entered.  It suits sets that are loaded once and then only ever
+ * searched, e.g. a list of stop words probed for every token read.
+ *
+ * Freezing is a move, as HashSetMoveIntoStatic's name says: the elements
+ * leave the ordinary hashset for the static one, and the ordinary hashset
+ * is disposed of along the way, so the caller must not use or dispose of
+ * it afterwards.  To keep the hashset and still get a file to map, save it
+ * with HashSetSave instead, which leaves it as it was.
+ *
+ * The static hashset is built around a minimal perfect hash function
+ * (compress, hash and displace): every element gets a slot of its own,
+ * and there are exactly as many slots as elements, so the elements sit
+ * packed in one array with no empty slots between them.  A lookup hashes
+ * the key once, reads one small displacement, and compares the key with
+ * the one element in the slot that it leads to, so it never probes and
+ * never follows a chain.  Each slot also keeps a 16-bit fingerprint of
+ * its element's hash, which turns away almost every absent key without
+ * a comparison.  Beyond the elements themselves, the static hashset takes
+ * under three bytes per element.
+ *
+ * The same arrangement can be saved to a file (see HashSetSave) and mapped
+ * back into memory by a later run (see HashSetLoadMapped), which can then
+ * search it without reading or building anything first.
+ */
+
+/**
+ * Type: statichashset
+ * -------------------
+ * The concrete representation of the static hashset.  As with the
+ * hashset, the client should treat it as opaque and interact with it
+ * only through the functions described below.
+ *
+ * The elements are split into buckets of about five by their full hash
+ * codes.  Each bucket has a displacement, chosen when the hashset is
+ * frozen, that sends every element in the bucket to a distinct free slot
+ * when mixed into its hash code.  The displacements are followed by the
+ * fingerprints and then the elements, all in one block of memory.
+ */
+
+typedef struct
+{
+  void * block;
+  uint32_t * displacements;
+  uint16_t * fingerprints;
+  void * elems;
+  int buckets_num;
+  int elems_num;
+  int elem_size;
+  uint64_t seed;
+
+  void (*freeFn)(void *);
+  uint64_t (*fullHashFn)(const void *);
+  int (*cmpFn)(const void *, const void *);
+} statichashset;
+
+/**
+ * Function: HashSetMoveIntoStatic
+ * --------------------------------
+ * Moves all of the elements of the specified hashset, which must have a
+ * full hash function (see HashSetSetFullHashFunction), into the identified
+ * static hashset, initializing it, and disposes of the hashset.  The elements
+ * are moved rather than copied: they now belong to the static hashset, so
+ * the hashset's free function, which the static hashset takes over along
+ * with its full hash and compare functions, isn't applied to them.  The
+ * hashset should then be treated as disposed of.
+ *
+ * Freezing takes time roughly proportional to the number of elements.
+ * Distinct elements must have distinct full hash codes, which any decent
+ * 64-bit hash function all but guarantees.
+ *
+ * An assert is raised if the hashset has no full hash function, or if
+ * two of its elements share a full hash code.  In a build without
+ * asserts, elements sharing a full hash code make freezing fail after a
+ * bounded number of attempts, with a message and a call to abort.
+ */
+
+void HashSetMoveIntoStatic(hashset *h, statichashset *s);
+
+/**
+ * Function: StaticHashSetDispose
+ * ------------------------------
+ * Disposes of the static hashset, applying the free function taken over
+ * from the hashset (if any) to every element.
+ */
+
+void StaticHashSetDispose(statichashset *s);
+
+/**
+ * Function: StaticHashSetCount
+ * ----------------------------
+ * Returns the number of elements in the static hashset.
+ */
+
+int StaticHashSetCount(const statichashset *s);
+
+/**
+ * Function: StaticHashSetLookup
+ * -----------------------------
+ * Returns the address of the stored element matching the one at elemAddr,
+ * or NULL if there's none, just like HashSetLookup.  Since the static
+ * hashset never changes, the address stays valid until it's disposed of.
+ *
+ * An assert is raised if elemAddr is NULL.
+ */
+
+void *StaticHashSetLookup(const statichashset *s, const void *elemAddr);
+
+/**
+ * Function: StaticHashSetLookupKey
+ * --------------------------------
+ * Same as StaticHashSetLookup, except that what resides at keyAddr is a
+ * key of the client's choosing, hashed with keyfullhashfn and compared
+ * with keycmpfn, just as HashSetLookupKey does for the hashset.
+ *
+ * An assert is raised if keyAddr, keyfullhashfn or keycmpfn is NULL.
+ */
+
+void *StaticHashSetLookupKey(const statichashset *s, const void *keyAddr,
+			     HashSetFullHashFunction keyfullhashfn, HashSetCompareFunction keycmpfn);
+
+/**
+ * Function: StaticHashSetMap
+ * --------------------------
+ * Applies mapfn to every element, as HashSetMap does.  The elements may be
+ * changed in place, provided that doesn't change how they hash or compare.
+ *
+ * An assert is raised if mapfn is NULL.
+ */
+
+void StaticHashSetMap(statichashset *s, HashSetMapFunction mapfn, void *auxData);
+
+
+/**
+ * Type: HashSetSerializeFunction
+ * ------------------------------
+ * Class of function that writes a self-contained copy of the element at
+ * elemAddr (a record) into the bufferSize bytes at buffer, for HashSetSave.
+ * A record can't hold pointers, since it will be read back at some other
+ * address in some other process: anything the element points to has to
+ * be copied into the record, and found again by its offset from the start
+ * of the record.  The buffer is aligned for any type.
+ *
+ * Returns the size of the record.  If that's more than bufferSize, nothing
+ * need be written: the function is called again with a large enough buffer.
+ */
+
+typedef int (*HashSetSerializeFunction)(const void *elemAddr, void *buffer, int bufferSize, void *auxData);
+
+/**
+ * Type: HashSetValidateFunction
+ * -----------------------------
+ * Class of function a mapped hashset checks each record with before a
+ * lookup compares it, given the record's address, its size in bytes
+ * (padding included) and the client data passed to HashSetLoadMapped.
+ * It returns true if the record can be read safely, which means that
+ * every count, offset and string in it stays within recordSize bytes of
+ * the record's start; the compare function and the client are then free
+ * to trust it.
+ */
+
+typedef bool (*HashSetValidateFunction)(const void *record, size_t recordSize, void *auxData);
+
+/**
+ * Type: mappedhashset
+ * -------------------
+ * A static hashset read straight out of a file saved by HashSetSave, as
+ * the client's records rather than its elements.  The file is mapped into
+ * memory read-only and nothing is copied out of it, so it's ready to be
+ * searched as soon as it's loaded, and only the parts of it that are
+ * searched are ever read from disk.
+ *
+ * The file holds the displacements and the fingerprints of the static
+ * hashset, then the offset of the record in each slot, then the records,
+ * each at a multiple of eight bytes from the start of the file.
+ */
+
+typedef struct
+{
+  statichashset index;
+  const uint64_t * offsets;
+  void * image;
+  size_t image_size;
+  HashSetValidateFunction validateFn;
+  void * aux_data;
+} mappedhashset;
+
+/**
+ * Function: HashSetSave
+ * ---------------------
+ * Writes every element of the hashset, which must have a full hash
+ * function, to the named file as a record (see HashSetSerializeFunction),
+ * arranged as a static hashset that HashSetLoadMapped can search in place.
+ * The hashset is left as it was.  The file is written under a temporary
+ * name and then renamed, so a process loading it never sees half of it.
+ *
+ * The saved file is searched with the codes of the full hash function, so
+ * the function has to give every element the same code in every process
+ * that will load the file: it can't use a per-process seed like HashSeed.
+ * The file is only meant to be read on the kind of machine that wrote it.
+ *
+ * hashId identifies the full hash function (seed and all), and is saved
+ * in the file: HashSetLoadMapped turns the file down unless it's given the
+ * same hashId, since a file searched with a different function would just
+ * miss every key.  The full hash of some fixed key makes a good hashId, as
+ * it changes along with the function or its seed.
+ *
+ * Returns false if the file couldn't be written.  An assert is raised if
+ * the hashset has no full hash function, if serializefn is NULL, or if two
+ * of the elements share a full hash code.
+ * Like HashSetMoveIntoStatic, it aborts in a build without asserts if two
+ * elements share a full hash code.
+ */
+
+bool HashSetSave(hashset *h, const char *filename, HashSetSerializeFunction serializefn, void *auxData,
+		 uint64_t hashId);
+
+/**
+ * Function: StaticHashSetSave
+ * ---------------------------
+ * Same as HashSetSave, but for a hashset that's already been frozen: the
+ * file is written straight from the static hashset's own placement, so
+ * the perfect hash isn't worked out a second time.  The file is the same
+ * kind of file, loaded with HashSetLoadMapped.
+ *
+ * Returns false if the file couldn't be written.  An assert is raised if
+ * serializefn is NULL.
+ */
+
+bool StaticHashSetSave(const statichashset *s, const char *filename, HashSetSerializeFunction serializefn,
+		       void *auxData, uint64_t hashId);
+
+/**
+ * Function: HashSetLoadMapped
+ * ---------------------------
+ * Initializes the identified mapped hashset with the file that HashSetSave
+ * wrote under the specified name, mapping it into memory.  None of the
+ * records are read, but the offset of each one is checked, so a damaged
+ * file can't place a record outside of the mapping; that takes time
+ * proportional to the number of records.
+ *
+ * What's inside a record is up to the client, so only validatefn can
+ * tell whether a damaged record would send a reader past its end.  A
+ * lookup calls it on a record before comparing it, and a record it turns
+ * down is treated as absent, so only the records that are looked up are
+ * ever read.  With validatefn NULL, records are trusted as they are.
+ *
+ * Returns false, and leaves nothing to dispose of, if the file can't be
+ * opened, wasn't written by HashSetSave (on this kind of machine), is
+ * damaged, or was saved with a hashId other than the specified one.
+ */
+
+bool HashSetLoadMapped(mappedhashset *m, const char *filename, uint64_t hashId,
+		       HashSetValidateFunction validatefn, void *auxData);
+
+/**
+ * Function: MappedHashSetDispose
+ * ------------------------------
+ * Unmaps the file, after which none of the records can be used.
+ */
+
+void MappedHashSetDispose(mappedhashset *m);
+
+/**
+ * Function: MappedHashSetCount
+ * ----------------------------
+ * Returns the number of records in the mapped hashset.
+ */
+
+int MappedHashSetCount(const mappedhashset *m);
+
+/**
+ * Function: MappedHashSetLookupKey
+ * --------------------------------
+ * Returns the address of the record matching the key at keyAddr, or NULL
+ * if there's none.  The key is hashed with keyfullhashfn, which must agree
+ * with the full hash function of the saved hashset, and compared with each
+ * candidate record by keycmpfn (the key first, then the record), once the
+ * validate function given to HashSetLoadMapped has passed it.  Records
+ * are read-only and stay valid until the mapped hashset is disposed of.
+ *
+ * An assert is raised if keyAddr, keyfullhashfn or keycmpfn is NULL.
+ */
+
+const void *MappedHashSetLookupKey(const mappedhashset *m, const void *keyAddr,
+				   HashSetFullHashFunction keyfullhashfn, HashSetCompareFunction keycmpfn);
+
+#endif
@@ -0,0 +1,322 @@
+#include "swisstable.h"
+#include "hashsetcounters.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const signed char kSwissEmpty = -128;
+static const signed char kSwissDeleted = -2;
+enum { kSwissBatchSize = 16 };
+
+/* The client hash functions reduce their hash code modulo numBuckets, so
+	asking for the hash code modulo the largest prime an int can hold gets
+	us (nearly) all of it.  The multiply spreads those bits out, so the top
+	bits choose the group and the bottom seven make the control byte.  A full
+	hash function, when there is one, is used instead and gets the same mix. */
+static const int kSwissHashRange = INT_MAX;
+static const uint64_t kSwissHashMultiplier = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t MixHash(uint64_t code)
+{
+	return (code + 1) * kSwissHashMultiplier;
+}
+
+static uint64_t SwissHash(const hashset * h, const void * keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn)
+{
+	if (h->fullHashFn != NULL) return MixHash(fullhashfn(keyAddr));
+
+	int hashcode = hashfn(keyAddr, kSwissHashRange);
+	assert(hashcode >= 0);
+	assert(hashcode < kSwissHashRange);
+	return MixHash(hashcode);
+}
+
+static signed char ControlByte(uint64_t hash)
+{
+	return hash & 0x7F;
+}
+
+static int FirstGroup(const hashset * h, uint64_t hash)
+{
+	int num_groups = h->buckets_num / kSwissGroupSize;
+	return (hash >> 32) & (num_groups - 1);
+}
+
+static void * SlotAt(const hashset * h, int pos)
+{
+	return (char *)h->slots + (size_t)pos * h->elem_size;
+}
+
+/* Bit i of the result is set if byte i of the group equals ctrl. */
+static unsigned MatchByte(const signed char * group, signed char ctrl)
+{
+#ifdef __SSE2__
+	__m128i bytes = _mm_loadu_si128((const __m128i *)group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < kSwissGroupSize; i++)
+		if (group[i] == ctrl) mask |= 1u << i;
+	return mask;
+#endif
+}
+
+/* Bit i of the result is set if slot i of the group is available, which is
+	what a set high bit means, unlike in every full control byte. */
+static unsigned MatchAvailable(const signed char * group)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < kSwissGroupSize; i++)
+		if (group[i] < 0) mask |= 1u << i;
+	return mask;
+#endif
+}
+
+/* Groups are probed triangularly (1, 2, 3... groups further along each
+	time), which visits every group when the group count is a power of two. */
+static int NextGroup(const hashset * h, int group, int step)
+{
+	int num_groups = h->buckets_num / kSwissGroupSize;
+	return (group + step) & (num_groups - 1);
+}
+
+static int SwissTableFind(const hashset * h, const void * keyAddr, uint64_t hash, HashSetCompareFunction cmpfn)
+{
+	signed char ctrl = ControlByte(hash);
+	int group = FirstGroup(h, hash);
+
+	for (int step = 1; ; step++)
+	{
+		const signed char * group_ctrl = h->ctrl + group * kSwissGroupSize;
+		for (unsigned mask = MatchByte(group_ctrl, ctrl); mask != 0; mask &= mask - 1)
+		{
+			int pos = group * kSwissGroupSize + __builtin_ctz(mask);
+			if (h->hashes != NULL && h->hashes[pos] != hash) continue;
+			HASHSET_COUNT_COMPARES(h, 1);
+			if (cmpfn(keyAddr, SlotAt(h, pos)) == 0) return pos;
+		}
+
+		// An empty slot in the group means the element was never pushed past it
+		if (MatchByte(group_ctrl, kSwissEmpty) != 0) return -1;
+		group = NextGroup(h, group, step);
+	}
+}
+
+/* Finds the first available slot along the element's probe sequence. */
+static int SwissTableFindAvailable(const hashset * h, uint64_t hash)
+{
+	int group = FirstGroup(h, hash);
+	for (int step = 1; ; step++)
+	{
+		unsigned mask = MatchAvailable(h->ctrl + group * kSwissGroupSize);
+		if (mask != 0) return group * kSwissGroupSize + __builtin_ctz(mask);
+		group = NextGroup(h, group, step);
+	}
+}
+
+int SwissTableRoundCapacity(int numSlots)
+{
+	int capacity = kSwissGroupSize;
+	while (capacity < numSlots)
+	{
+		assert(capacity <= INT_MAX / 2);
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+/* Stores the element and its hash in the (available) slot at pos. */
+static void SwissTableFill(hashset * h, int pos, const void * elemAddr, uint64_t hash)
+{
+	if (h->ctrl[pos] == kSwissDeleted) h->deleted_num--;
+	memcpy(SlotAt(h, pos), elemAddr, h->elem_size);
+	h->ctrl[pos] = ControlByte(hash);
+	if (h->hashes != NULL) h->hashes[pos] = hash;
+}
+
+void SwissTableNew(hashset * h, int numSlots)
+{
+	h->buckets_num = SwissTableRoundCapacity(numSlots);
+	h->slots = malloc((size_t)h->buckets_num * h->elem_size);
+	h->ctrl = malloc(h->buckets_num);
+	assert(h->slots != NULL);
+	assert(h->ctrl != NULL);
+	memset(h->ctrl, kSwissEmpty, h->buckets_num);
+	h->deleted_num = 0;
+
+	// With a full hash function the whole (mixed) hash of each element is kept
+	h->hashes = NULL;
+	if (h->fullHashFn != NULL)
+	{
+		h->hashes = malloc((size_t)h->buckets_num * sizeof(uint64_t));
+		assert(h->hashes != NULL);
+	}
+}
+
+void SwissTableDispose(hashset * h)
+{
+	if (h->freeFn != NULL)
+	{
+		for (int i = 0; i < h->buckets_num; i++)
+			if (h->ctrl[i] >= 0) h->freeFn(SlotAt(h, i));
+	}
+	free(h->slots);
+	free(h->ctrl);
+	free(h->hashes);
+}
+
+void * SwissTableLookup(const hashset * h, const void * keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn, HashSetCompareFunction cmpfn)
+{
+	int pos = SwissTableFind(h, keyAddr, SwissHash(h, keyAddr, hashfn, fullhashfn), cmpfn);
+	if (pos == -1) return NULL;
+	return SlotAt(h, pos);
+}
+
+/* Hashes a whole batch of keys, prefetching the control bytes and slots of
+	each one's first group, before searching for any of them.  The code
+	SwissHash mixes is the one the Bloom filter knows the key by, so the
+	filter is asked about it first, and keys it rules out go no further. */
+void SwissTableLookupBatch(const hashset * h, const void * keys, int n, void ** results)
+{
+	uint64_t hashes[kSwissBatchSize];
+	bool ruled_out[kSwissBatchSize];
+
+	for (int start = 0; start < n; start += kSwissBatchSize)
+	{
+		int end = (n - start < kSwissBatchSize) ? n : start + kSwissBatchSize;
+		for (int i = start; i < end; i++)
+		{
+			const void * key = (const char *)keys + (size_t)i * h->elem_size;
+			uint64_t code = BloomCode(h, key, (h->fullHashFn != NULL) ? h->fullHashFn(key) : 0);
+			ruled_out[i - start] = h->bloom_bits != 0 && !BloomFilterMayContain(&h->bloom, code);
+			if (ruled_out[i - start]) continue;
+			uint64_t hash = MixHash(code);
+			int pos = FirstGroup(h, hash) * kSwissGroupSize;
+			__builtin_prefetch(h->ctrl + pos);
+			__builtin_prefetch(SlotAt(h, pos));
+			if (h->hashes != NULL) __builtin_prefetch(&h->hashes[pos]);
+			hashes[i - start] = hash;
+		}
+
+		for (int i = start; i < end; i++)
+		{
+			const void * key = (const char *)keys + (size_t)i * h->elem_size;
+			if (ruled_out[i - start])
+			{
+				results[i] = NULL;
+				continue;
+			}
+			int pos = SwissTableFind(h, key, hashes[i - start], h->cmpFn);
+			results[i] = (pos == -1) ? NULL : SlotAt(h, pos);
+		}
+	}
+}
+
+void * SwissTableFindOrInsert(hashset * h, const void * elemAddr, bool * inserted)
+{
+	uint64_t hash = SwissHash(h, elemAddr, h->hashFn, h->fullHashFn);
+	int pos = SwissTableFind(h, elemAddr, hash, h->cmpFn);
+
+	*inserted = (pos == -1);
+	if (pos == -1)
+	{
+		pos = SwissTableFindAvailable(h, hash);
+		SwissTableFill(h, pos, elemAddr, hash);
+	}
+	return SlotAt(h, pos);
+}
+
+/* A search only moves past a group that has no empty slots, and a group
+	that's been without one since the last rehash stays that way, since a
+	slot is only emptied here when its group has an empty slot already.  So
+	if the group has one, no search has ever gone past it and the slot can
+	simply be emptied; otherwise it's marked deleted, which searches step
+	over and insertions reuse. */
+bool SwissTableRemove(hashset * h, const void * elemAddr)
+{
+	uint64_t hash = SwissHash(h, elemAddr, h->hashFn, h->fullHashFn);
+	int pos = SwissTableFind(h, elemAddr, hash, h->cmpFn);
+	if (pos == -1) return false;
+
+	if (h->freeFn != NULL) h->freeFn(SlotAt(h, pos));
+
+	const signed char * group_ctrl = h->ctrl + pos / kSwissGroupSize * kSwissGroupSize;
+	if (MatchByte(group_ctrl, kSwissEmpty) != 0) h->ctrl[pos] = kSwissEmpty;
+		else {
+			h->ctrl[pos] = kSwissDeleted;
+			h->deleted_num++;
+		}
+	return true;
+}
+
+void SwissTableMap(hashset * h, HashSetMapFunction mapfn, void * auxData)
+{
+	SwissTableMapSlots(h, 0, h->buckets_num, mapfn, auxData);
+}
+
+void SwissTableMapSlots(hashset * h, int start, int end, HashSetMapFunction mapfn, void * auxData)
+{
+	for (int i = start; i < end; i++)
+		if (h->ctrl[i] >= 0) mapfn(SlotAt(h, i), auxData);
+}
+
+/* Each element's chain starts at its first group, and its probe length is
+	the number of groups its search visits on the way to the one it's in. */
+void SwissTableStats(const hashset * h, hashsetstats * stats)
+{
+	int num_groups = h->buckets_num / kSwissGroupSize;
+	int * chain_lens = calloc(num_groups, sizeof(int));
+	assert(chain_lens != NULL);
+	for (int i = 0; i < h->buckets_num; i++)
+	{
+		if (h->ctrl[i] < 0) continue;
+		uint64_t hash = (h->hashes != NULL) ? h->hashes[i] : SwissHash(h, SlotAt(h, i), h->hashFn, h->fullHashFn);
+		int group = FirstGroup(h, hash);
+		chain_lens[group]++;
+
+		int probe_len = 1;
+		for (int step = 1; group != i / kSwissGroupSize; step++, probe_len++)
+			group = NextGroup(h, group, step);
+		StatsAddProbe(stats, probe_len);
+	}
+	for (int i = 0; i < num_groups; i++)
+		StatsAddChain(stats, chain_lens[i]);
+	free(chain_lens);
+
+	size_t slot_size = h->elem_size + sizeof(signed char) + ((h->hashes != NULL) ? sizeof(uint64_t) : 0);
+	stats->bytes_allocated += (size_t)h->buckets_num * slot_size;
+}
+
+void SwissTableRehash(hashset * h, int newSlotsNum)
+{
+	void * old_slots = h->slots;
+	signed char * old_ctrl = h->ctrl;
+	uint64_t * old_hashes = h->hashes;
+	int old_slots_num = h->buckets_num;
+
+	SwissTableNew(h, newSlotsNum);
+
+	/* Elements are distinct already, so they go straight into the first free
+		slot, and stored hashes are reused rather than computed again. */
+	for (int i = 0; i < old_slots_num; i++)
+	{
+		if (old_ctrl[i] < 0) continue;
+		void * elem = (char *)old_slots + (size_t)i * h->elem_size;
+		uint64_t hash = (old_hashes != NULL) ? old_hashes[i] : SwissHash(h, elem, h->hashFn, h->fullHashFn);
+		SwissTableFill(h, SwissTableFindAvailable(h, hash), elem, hash);
+	}
+
+	free(old_slots);
+	free(old_ctrl);
+	free(old_hashes);
+}
@@ -0,0 +1,36 @@
+#ifndef _swisstable_
+#define _swisstable_
+#include "hashset.h"
+
+/* File: swisstable.h
+ * -------------------
+ * Private interface between hashset.c and the group-probed layout
+ * behind HashSetNewSwiss.  Clients should never include this file;
+ * everything here is reached through hashset.h.
+ *
+ * The h->buckets_num slots (always a power of two, and at least one
+ * group of kSwissGroupSize) live in h->slots, and h->ctrl holds one
+ * control byte per slot: negative for an empty or deleted slot or,
+ * for a full slot, the low 7 bits of its element's hash.  If the
+ * hashset has a full hash function, h->hashes holds each full slot's
+ * whole hash too.  h->deleted_num counts the deleted slots, which
+ * hashset.c counts towards the load.  Growth is decided by hashset.c,
+ * which calls SwissTableRehash.
+ */
+
+enum { kSwissGroupSize = 16 };
+
+int SwissTableRoundCapacity(int numSlots);
+void SwissTableNew(hashset *h, int numSlots);
+void SwissTableDispose(hashset *h);
+void *SwissTableLookup(const hashset *h, const void *keyAddr,
+		HashSetHashFunction hashfn, HashSetFullHashFunction fullhashfn, HashSetCompareFunction cmpfn);
+void SwissTableLookupBatch(const hashset *h, const void *keys, int n, void **results);
+void *SwissTableFindOrInsert(hashset *h, const void *elemAddr, bool *inserted);
+bool SwissTableRemove(hashset *h, const void *elemAddr);
+void SwissTableMap(hashset *h, HashSetMapFunction mapfn, void *auxData);
+void SwissTableMapSlots(hashset *h, int start, int end, HashSetMapFunction mapfn, void *auxData);
+void SwissTableStats(const hashset *h, hashsetstats *stats);
+void SwissTableRehash(hashset *h, int newSlotsNum);
+
+#endif
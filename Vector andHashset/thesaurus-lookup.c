@@ -1,12 +1,15 @@
 #include "bool.h"
 #include "hashset.h"
+#include "statichashset.h"
 #include "vector.h"
+#include "typedvector.h"
 #include "streamtokenizer.h"
+#include "hashing.h"
 #include <stdlib.h>  // for malloc, free, etc
 #include <string.h>  // for strcmp
 #include <strings.h>
-#include <ctype.h>   // for tolower
 #include <time.h>    // for time
+#include <sys/stat.h> // for stat
 
 /**
  * Convenience struct used to bundle a word (expressed 
@@ -21,9 +24,67 @@ typedef struct {
 } thesaurusEntry;
 
 /**
- * Hash function provided by the goddess of lecturing,
- * Julie Zelenski.  I'm not sure where it came from, but
- * I'm guessing the multiplier is standard.
+ * Typed access to the synonym vectors, which hold nothing
+ * but char *s: StringVectorAppend, StringVectorGet and the
+ * like, which go straight to the elements.
+ */
+
+DEFINE_TYPED_VECTOR(StringVector, char *)
+
+/**
+ * Hashes a word with HashString.  The thesaurus is saved
+ * to disk as a static hashset, so every run has to hash
+ * the same way, with a fixed seed rather than HashSeed.
+ * That's safe here: the words come from our own file,
+ * and a static hashset makes one comparison per lookup
+ * whatever words it's asked about.  Words compare with
+ * strcmp, so there's no need to fold case.
+ *
+ * @param key the address of the first of a series of
+ *            characters making up a C string.
+ * @return the full 64-bit hashcode of that C string.
+ */
+
+static const uint64_t kWordHashSeed = 0x7468657361757275ULL;
+static uint64_t WordFullHash(const void *key)
+{
+  return HashString(key, kWordHashSeed);
+}
+
+/**
+ * Identifies WordFullHash in the saved image of the thesaurus,
+ * as the hashcode of a fixed word: if either the function or
+ * its seed changes, so does this, and the image saved with the
+ * old one is turned down rather than searched with the new.
+ *
+ * @return the hash identity to save and load the image with.
+ */
+
+static uint64_t WordHashId(void)
+{
+  return WordFullHash("thesaurus");
+}
+
+/**
+ * Reduces WordFullHash's hashcode to the specified number
+ * of buckets, so that StringHash hashes words the same
+ * way WordFullHash does.
+ *
+ * @param key the address of the first character of a C string.
+ * @param numBuckets the number of buckets in the hash table.
+ * @return the hashcode of the C string, in [0, numBuckets).
+ */
+
+static int WordHash(const void *key, int numBuckets)
+{
+  return WordFullHash(key) % numBuckets;
+}
+
+/**
+ * Hashes the word of a thesaurusEntry (or anything else
+ * that begins with a char *) with WordHash, so the words
+ * entered into the thesaurus hash exactly as bare C strings
+ * looked up by WordHash do.
  *
  * @param elem a void * which is understood to be the address
  *             of a char *, which itself addresses the first of
@@ -32,14 +93,25 @@ typedef struct {
  * @return the hashcode of the C string addressed by elem.
  */
 
-static const signed long kHashMultiplier = -1664117991L;
 static int StringHash(const void *elem, int numBuckets)
 {
-  char *s = *(char **) elem;
-  unsigned long hashcode = 0;
-  for (int i = 0; i < strlen(s); i++)  
-    hashcode = hashcode * kHashMultiplier + tolower(s[i]);  
-  return hashcode % numBuckets;                                  
+  return WordHash(*(char **) elem, numBuckets);
+}
+
+/**
+ * Full-width version of StringHash, installed with
+ * HashSetSetFullHashFunction so every word is hashed once,
+ * when it's entered, rather than again each time the
+ * thesaurus grows.  The stored codes also let lookups skip
+ * the strcmp for all but the matching word.
+ *
+ * @param elem the address of a char *, just like StringHash's.
+ * @return the 64-bit hashcode of the C string addressed by elem.
+ */
+
+static uint64_t StringFullHash(const void *elem)
+{
+  return WordFullHash(*(char **) elem);
 }
 
 /**
@@ -61,6 +133,20 @@ static int StringCompare(const void *elem1, const void *elem2)
   return strcmp(*(const char **) elem1, *(const char **) elem2);
 }
 
+/**
+ * Compares a bare C string against the word of the
+ * thesaurusEntry at the specified address.
+ *
+ * @param key the address of the first character of a C string.
+ * @param elem the address of a thesaurusEntry.
+ * @return the strcmp of the C string and the entry's word.
+ */
+
+static int WordCompare(const void *key, const void *elem)
+{
+  return strcmp(key, ((const thesaurusEntry *) elem)->word);
+}
+
 /**
  * Properly disposes of the thesaurusEntry understood to
  * sit at the specified address.  Note that the synonyms
@@ -91,6 +177,94 @@ static void StringFree(void *elem)
   free(*(void **)elem);
 }
 
+/**
+ * A thesaurusEntry as it's saved to disk, with offsets
+ * in place of pointers: the number of synonyms, the offset
+ * of each one from the start of the record, and then the
+ * word followed by the synonyms, each of them null-terminated.
+ */
+
+typedef struct {
+  uint32_t numSynonyms;
+  uint32_t synonymOffsets[];
+} thesaurusRecord;
+
+static const char *RecordWord(const thesaurusRecord *record)
+{
+  return (const char *) &record->synonymOffsets[record->numSynonyms];
+}
+
+/**
+ * Writes the thesaurusEntry at the specified address into
+ * buffer as a thesaurusRecord, provided it fits.
+ *
+ * @param elem the address of a thesaurusEntry.
+ * @param buffer the address where the record should go.
+ * @param bufferSize the number of bytes available at buffer.
+ * @return the size of the record, whether or not it fit.
+ */
+
+static int SerializeEntry(const void *elem, void *buffer, int bufferSize, void *auxData)
+{
+  const thesaurusEntry *entry = elem;
+  int numSynonyms = StringVectorLength(&entry->synonyms);
+  int size = sizeof(thesaurusRecord) + numSynonyms * sizeof(uint32_t) + strlen(entry->word) + 1;
+  for (int i = 0; i < numSynonyms; i++)
+    size += strlen(StringVectorGet(&entry->synonyms, i)) + 1;
+  if (size > bufferSize) return size;
+
+  thesaurusRecord *record = buffer;
+  record->numSynonyms = numSynonyms;
+  char *text = stpcpy((char *) RecordWord(record), entry->word) + 1;
+  for (int i = 0; i < numSynonyms; i++) {
+    record->synonymOffsets[i] = text - (char *) record;
+    text = stpcpy(text, StringVectorGet(&entry->synonyms, i)) + 1;
+  }
+  return size;
+}
+
+/**
+ * Compares a bare C string against the word of the
+ * thesaurusRecord at the specified address.
+ *
+ * @param key the address of the first character of a C string.
+ * @param record the address of a thesaurusRecord.
+ * @return the strcmp of the C string and the record's word.
+ */
+
+static int RecordCompare(const void *key, const void *record)
+{
+  return strcmp(key, RecordWord(record));
+}
+
+/**
+ * Confirms that the thesaurusRecord at the specified address
+ * can be read without straying past its end: its synonym
+ * offsets fit, each one points past them, and the word and
+ * every synonym are null-terminated within the record.
+ *
+ * @param record the address of a thesaurusRecord in a mapped image.
+ * @param recordSize the number of bytes the record spans.
+ * @return true if RecordCompare and MappedRelatedWord can trust it.
+ */
+
+static bool RecordIsValid(const void *record, size_t recordSize, void *auxData)
+{
+  const thesaurusRecord *r = record;
+  const char *text = record;
+  if (recordSize < sizeof(thesaurusRecord)) return false;
+  if ((uint64_t) r->numSynonyms * sizeof(uint32_t) >= recordSize - sizeof(thesaurusRecord)) return false;
+
+  size_t wordOffset = RecordWord(r) - text;
+  if (memchr(text + wordOffset, '\0', recordSize - wordOffset) == NULL) return false;
+  for (uint32_t i = 0; i < r->numSynonyms; i++) {
+    size_t offset = r->synonymOffsets[i];
+    if (offset < wordOffset || offset >= recordSize) return false;
+    if (memchr(text + offset, '\0', recordSize - offset) == NULL) return false;
+  }
+  return true;
+}
+
 /**
  * Tokenizes the flat text thesaurus underneath the specified streamtokenizer,
  * and builds up the specified thesaurus out of the information.  Each
@@ -119,12 +293,12 @@ static void TokenizeAndBuildThesaurus(hashset *thesaurus, streamtokenizer *st)
   while (STNextToken(st, buffer, sizeof(buffer))) {
     thesaurusEntry entry;
     entry.word = strdup(buffer);
-    VectorNew(&entry.synonyms, sizeof(char *), StringFree, 4);
+    StringVectorNew(&entry.synonyms, StringFree, 4);
     while (STNextToken(st, buffer, sizeof(buffer)) && (buffer[0] == ',')) {
       STNextToken(st, buffer, sizeof(buffer));
-      char *synonym = strdup(buffer);
-      VectorAppend(&entry.synonyms, &synonym);
+      StringVectorAppend(&entry.synonyms, strdup(buffer));
     }
+    VectorShrinkToFit(&entry.synonyms);
     HashSetEnter(thesaurus, &entry);
     if (HashSetCount(thesaurus) % 1000 == 0) {
       printf(".");
@@ -185,31 +359,67 @@ static int RandomInteger(int low, int high)
   return low + offset;
 }
 
+/**
+ * Looks up a word in one kind of thesaurus or another, and
+ * returns whether it's there, setting *synonym to one of its
+ * synonyms at random, or to NULL if it has none.
+ */
+
+typedef bool (*RelatedWordFunction)(const void *thesaurus, const char *word, const char **synonym);
+
+static bool HashedRelatedWord(const void *thesaurus, const char *word, const char **synonym)
+{
+  const thesaurusEntry *found = HashSetLookup(thesaurus, &word);
+  if (found == NULL) return false;
+  int numSynonyms = StringVectorLength(&found->synonyms);
+  *synonym = (numSynonyms == 0) ? NULL : StringVectorGet(&found->synonyms, RandomInteger(0, numSynonyms - 1));
+  return true;
+}
+
+static bool FrozenRelatedWord(const void *thesaurus, const char *word, const char **synonym)
+{
+  const thesaurusEntry *found = StaticHashSetLookupKey(thesaurus, word, WordFullHash, WordCompare);
+  if (found == NULL) return false;
+  int numSynonyms = StringVectorLength(&found->synonyms);
+  *synonym = (numSynonyms == 0) ? NULL : StringVectorGet(&found->synonyms, RandomInteger(0, numSynonyms - 1));
+  return true;
+}
+
+static bool MappedRelatedWord(const void *thesaurus, const char *word, const char **synonym)
+{
+  const thesaurusRecord *found = MappedHashSetLookupKey(thesaurus, word, WordFullHash, RecordCompare);
+  if (found == NULL) return false;
+  *synonym = (found->numSynonyms == 0) ? NULL :
+    (const char *) found + found->synonymOffsets[RandomInteger(0, found->numSynonyms - 1)];
+  return true;
+}
+
 /**
  * Simple question loop that prompts the user for a word, and
  * then looks up the word in the thesaurus.  If present, it
  * selects one of the its synonyms at random, printing it along
  * with the user supplied word.
  *
- * @param thesuarus the address of the hashset housing all of the
- *                  synonyms sets of a large collection of English
- *                  words and phrases.
+ * @param thesuarus the address of the static or mapped hashset
+ *                  housing all of the synonyms sets of a large
+ *                  collection of English words and phrases.
+ * @param relatedfn the function that knows how to search it.
  */
 
-static void QueryThesaurus(hashset *thesaurus)
+static void QueryThesaurus(const void *thesaurus, RelatedWordFunction relatedfn)
 {
   char response[1024];
-  char *responsep = response;
   while (true) {
     printf("Go ahead and enter a word: ");
     fgets(response, sizeof(response), stdin);
     response[strlen(response) - 1] = '\0';
     if (strlen(response) == 0) return;
-    thesaurusEntry *found = HashSetLookup(thesaurus, &responsep);
-    if (found != NULL) {
-      int numSynonyms = VectorLength(&found->synonyms);
-      char *synonym = *(char **) VectorNth(&found->synonyms, RandomInteger(0, numSynonyms - 1));
-      printf("We found \"%s\" in the thesaurus! Its related word of the day is \"%s\".\n", response, synonym);
+    const char *synonym;
+    if (relatedfn(thesaurus, response, &synonym)) {
+      if (synonym != NULL)
+	printf("We found \"%s\" in the thesaurus! Its related word of the day is \"%s\".\n", response, synonym);
+      else
+	printf("We found \"%s\" in the thesaurus! It has no related words, though.\n", response);
     } else {
       printf("My apologies, but I know of no such word spelled \"%s\".\n", response);
     }
@@ -217,18 +427,110 @@ static void QueryThesaurus(hashset *thesaurus)
 }
 
 /**
- * Provides the enty point to the program.
+ * Prints what HashSetStats has to say about the thesaurus: how
+ * evenly its words spread over the buckets, how far a search goes,
+ * and, if the hashset library was built with HASHSET_STATS, what
+ * reading the thesaurus cost in comparisons and resizes.
+ *
+ * @param thesaurus the address of the hashset of thesaurusEntry records.
+ */
+
+static void PrintThesaurusStats(const hashset *thesaurus)
+{
+  hashsetstats stats;
+  HashSetStats(thesaurus, &stats);
+  printf("%d words in %d buckets (%d used, %.1f MB allocated).\n", stats.elems_num,
+	 stats.buckets_num, stats.used_buckets, stats.bytes_allocated / 1048576.0);
+  printf("Chains: longest %d, average %.2f.  Probes: longest %d, average %.2f.\n",
+	 stats.max_chain_len, stats.mean_chain_len, stats.max_probe_len, stats.mean_probe_len);
+  printf("Buckets by chain length:");
+  for (int k = 0; k < kHashSetStatsHistogramSize; k++)
+    if (stats.histogram[k] != 0)
+      printf(" %d%s: %d", k, (k == kHashSetStatsHistogramSize - 1) ? "+" : "", stats.histogram[k]);
+  printf("\n");
+  if (stats.counted)
+    printf("%ld inserts at %.2f comparisons apiece, %ld lookups at %.2f, %ld resizes.\n",
+	   stats.inserts, stats.inserts ? (double) stats.insert_compares / stats.inserts : 0.0,
+	   stats.lookups, stats.lookups ? (double) stats.lookup_compares / stats.lookups : 0.0,
+	   stats.resizes);
+}
+
+/**
+ * Confirms that the saved image of the thesaurus exists and
+ * is at least as new as the flat text file it was built from
+ * (if that's still around).
+ *
+ * @param imageFileName the name of the saved image.
+ * @param textFileName the name of the flat text thesaurus.
+ * @return true if the image can be used in place of the text.
+ */
+
+static bool ImageIsCurrent(const char *imageFileName, const char *textFileName)
+{
+  struct stat image, text;
+  if (stat(imageFileName, &image) != 0) return false;
+  return stat(textFileName, &text) != 0 || text.st_mtime <= image.st_mtime;
+}
+
+/**
+ * Provides the enty point to the program.  The thesaurus is
+ * read into a hashset and queried there.  With --save-image it's
+ * frozen into a static hashset first, which takes a good deal
+ * longer than reading it, and saved next to the flat text file
+ * (as thesaurus.txt.image, say); later runs map that saved
+ * image instead of reading the text, and can answer the first
+ * query right away.
+ *
+ *     ./thesaurus-lookup [--stats] [--save-image] [thesaurus file]
+ *
+ * With --stats the text is always read, and the hashset it's
+ * read into is described (see PrintThesaurusStats) before
+ * the first query.
  */
 
 static const int kApproximateWordCount = (1 << 19) - 1; // six-digit Marsenne prime
 int main(int argc, const char *argv[])
 {
-  hashset thesaurus;
-  HashSetNew(&thesaurus, sizeof(thesaurusEntry), kApproximateWordCount, StringHash, StringCompare, ThesEntryFree);
+  bool printStats = false, saveImage = false;
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--stats") == 0) printStats = true;
+    else if (strcmp(argv[1], "--save-image") == 0) saveImage = true;
+    else fprintf(stderr, "Ignoring unknown option \"%s\".\n", argv[1]);
+    argc--;
+    argv++;
+  }
   const char *thesaurusFileName = (argc == 1) ? 
     "/usr/class/cs107/assignments/assn-3-vector-hashset-data/thesaurus.txt" : argv[1];
+  char imageFileName[1024];
+  bool imageNamed = snprintf(imageFileName, sizeof(imageFileName), "%s.image", thesaurusFileName) <
+    (int) sizeof(imageFileName);
+
+  mappedhashset mappedThesaurus;
+  if (!printStats && imageNamed && ImageIsCurrent(imageFileName, thesaurusFileName) &&
+      HashSetLoadMapped(&mappedThesaurus, imageFileName, WordHashId(), RecordIsValid, NULL)) {
+    QueryThesaurus(&mappedThesaurus, MappedRelatedWord);
+    MappedHashSetDispose(&mappedThesaurus);
+    return 0;
+  }
+
+  hashset thesaurus;
+  HashSetNew(&thesaurus, sizeof(thesaurusEntry), kApproximateWordCount, StringHash, StringCompare, ThesEntryFree);
+  HashSetSetFullHashFunction(&thesaurus, StringFullHash);
   ReadThesaurus(&thesaurus, thesaurusFileName);
-  QueryThesaurus(&thesaurus);
-  HashSetDispose(&thesaurus);
+  if (printStats) PrintThesaurusStats(&thesaurus);
+  if (!saveImage) {
+    QueryThesaurus(&thesaurus, HashedRelatedWord);
+    HashSetDispose(&thesaurus);
+    return 0;
+  }
+
+  statichashset frozenThesaurus;
+  HashSetMoveIntoStatic(&thesaurus, &frozenThesaurus);
+  if (imageNamed && StaticHashSetSave(&frozenThesaurus, imageFileName, SerializeEntry, NULL, WordHashId()))
+    printf("Saved the thesaurus as \"%s\".\n", imageFileName);
+  else
+    fprintf(stderr, "Could not save the thesaurus image; carrying on without it.\n");
+  QueryThesaurus(&frozenThesaurus, FrozenRelatedWord);
+  StaticHashSetDispose(&frozenThesaurus);
   return 0;
 }
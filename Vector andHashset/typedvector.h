@@ -0,0 +1,92 @@
+/**
+ * File: typedvector.h
+ * --------------------
+ * Defines DEFINE_TYPED_VECTOR, which generates type-specialized access
+ * functions for vectors whose elements are all of one C type.
+ *
+ * The generated functions work on an ordinary vector, with exactly the
+ * same memory layout, so a typed vector can still be handed to any of the
+ * functions in vector.h (VectorSort, VectorMap, VectorDispose and so on)
+ * and to any other code that takes a vector *.  What they add is that the
+ * element size is known at compile time: they're inline, take and return
+ * elements by value, and index the storage as an array of the type, so
+ * an append or a lookup in a hot loop compiles to a plain store or load
+ * instead of a multiplication by elem_size and a call to memcpy.
+ *
+ * For example, after
+ *
+ *     DEFINE_TYPED_VECTOR(StringVector, char *)
+ *
+ * a vector of C strings can be used like this:
+ *
+ *     vector words;
+ *     StringVectorNew(&words, StringFree, 0);
+ *     StringVectorAppend(&words, strdup("hello"));
+ *     printf("%s\n", StringVectorGet(&words, 0));
+ *     VectorDispose(&words);
+ *
+ * The generated functions are:
+ *
+ *     void nameNew(vector *v, VectorFreeFunction freefn, int initialAllocation);
+ *     int nameLength(const vector *v);
+ *     type *nameNth(const vector *v, int position);
+ *     type nameGet(const vector *v, int position);
+ *     void nameAppend(vector *v, type elem);
+ *     void nameInsert(vector *v, type elem, int position);
+ *
+ * and each one behaves (and asserts) just like its counterpart in vector.h,
+ * except that they also assert that the vector's elements really are the
+ * size of the type.
+ */
+
+#ifndef _typedvector_
+#define _typedvector_
+
+#include "vector.h"
+#include <assert.h>
+#include <string.h>
+
+#define DEFINE_TYPED_VECTOR(name, type)					\
+									\
+static inline void name##New(vector * v, VectorFreeFunction freefn, int initialAllocation) \
+{									\
+	VectorNew(v, sizeof(type), freefn, initialAllocation);		\
+}									\
+									\
+static inline int name##Length(const vector * v)			\
+{									\
+	assert(v->elem_size == sizeof(type));				\
+	return v->log_len;						\
+}									\
+									\
+static inline type * name##Nth(const vector * v, int position)		\
+{									\
+	assert(v->elem_size == sizeof(type));				\
+	assert(position >= 0 && position < v->log_len);			\
+	return (type *)v->elems + position;				\
+}									\
+									\
+static inline type name##Get(const vector * v, int position)		\
+{									\
+	return *name##Nth(v, position);					\
+}									\
+									\
+static inline void name##Append(vector * v, type elem)			\
+{									\
+	assert(v->elem_size == sizeof(type));				\
+	if (v->log_len == v->alloc_len) VectorGrow(v);			\
+	((type *)v->elems)[v->log_len++] = elem;			\
+}									\
+									\
+static inline void name##Insert(vector * v, type elem, int position)	\
+{									\
+	assert(v->elem_size == sizeof(type));				\
+	assert(position >= 0 && position <= v->log_len);		\
+	if (v->log_len == v->alloc_len) VectorGrow(v);			\
+	type * elems = v->elems;					\
+	memmove(elems + position + 1, elems + position, (size_t)(v->log_len - position) * sizeof(type)); \
+	elems[position] = elem;						\
+	v->log_len++;							\
+}
+
+#endif
@@ -1,8 +1,40 @@
 #include "vector.h"
+#include "parallel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <search.h>
+#include <limits.h>
+#include <stdint.h>
+
+static const double kDefaultGrowthFactor = 2.0;
+
+/* The allocated length one step of the growth policy takes the vector to:
+	alloc_len times the growth factor, but at least one and at most
+	max_growth elements more. */
+static int GrownAllocLen(const vector * v)
+{
+	assert(v->alloc_len < INT_MAX);
+
+	double grown = v->alloc_len * v->growth_factor;
+	int growth = (grown >= INT_MAX) ? INT_MAX - v->alloc_len : (int)grown - v->alloc_len;
+	if (growth < 1) growth = 1;
+	if (v->max_growth > 0 && growth > v->max_growth) growth = v->max_growth;
+	return v->alloc_len + growth;
+}
+
+/* Reallocates the elements to room for exactly allocLen of them, which has
+	to be at least the logical length. */
+static void VectorResize(vector * v, int allocLen)
+{
+	assert(allocLen >= v->log_len && allocLen > 0);
+
+	void * elems = realloc(v->elems, (size_t)allocLen * v->elem_size);
+	assert(elems != NULL);
+	v->elems = elems;
+	v->alloc_len = allocLen;
+}
 
 void VectorNew(vector * v, int elemSize, VectorFreeFunction freeFn, int initialAllocation)
 {
@@ -18,6 +50,8 @@ void VectorNew(vector * v, int elemSize, VectorFreeFunction freeFn, int initialA
 	v->log_len = 0;
 	v->alloc_len = initialAllocation;
 	v->freeFn = freeFn;
+	v->growth_factor = kDefaultGrowthFactor;
+	v->max_growth = 0;
 
 	v->elem_size = elemSize;
 	v->elems = malloc(v->elem_size * v->alloc_len);
@@ -83,65 +117,88 @@ void VectorReplace(vector * v, const void * elemAddr, int position)
 }
 
 void VectorInsert(vector * v, const void * elemAddr, int position)
+{
+	// Inserting one element is inserting a range of one
+	VectorInsertRange(v, elemAddr, 1, position);
+}
+
+void VectorInsertRange(vector * v, const void * elemsAddr, int n, int position)
 {
 	// Check all assert conditions
 	assert(v != NULL);
 	assert(v->elems != NULL);
+	assert(n >= 0);
+	assert(n == 0 || elemsAddr != NULL);
 	assert(position >= 0);
 	assert(position <= v->log_len);
+	assert(n <= INT_MAX - v->log_len);
 	// Asserts checked
 
-	// If there is no space for another variable, grow vector
-	if (v->log_len == v->alloc_len) VectorGrow(v);
+	if (n == 0) return;
+
+	// If there is no space for the new elements, grow vector once, by a policy step or to fit them all
+	if (v->log_len + n > v->alloc_len)
+	{
+		int alloc_len = GrownAllocLen(v);
+		VectorResize(v, (v->log_len + n > alloc_len) ? v->log_len + n : alloc_len);
+	}
 
 	// Find out insert position
-	char * insert_pos_ptr = (char *)v->elems + position * v->elem_size;
+	char * insert_pos_ptr = (char *)v->elems + (size_t)position * v->elem_size;
+	size_t insert_bytes_num = (size_t)n * v->elem_size;
 	
 	/* If insert position isn't the last one,
-		then move all elements after position of insert elemen. */
+		then move all elements after position of insert over in one go. */
 	if (position != v->log_len)
 	{
-		char * dest_ptr = insert_pos_ptr + v->elem_size;
-		char * end_ptr = (char *)v->elems + v->log_len * v->elem_size;
-
-		int move_bytes_num = end_ptr - insert_pos_ptr;
-		memmove(dest_ptr, insert_pos_ptr, move_bytes_num);
+		size_t move_bytes_num = (size_t)(v->log_len - position) * v->elem_size;
+		memmove(insert_pos_ptr + insert_bytes_num, insert_pos_ptr, move_bytes_num);
 	}
 
-	// Copy element in the vector and increase logical length
-	memcpy(insert_pos_ptr, elemAddr, v->elem_size);
-	v->log_len++;
+	// Copy elements in the vector and increase logical length
+	memcpy(insert_pos_ptr, elemsAddr, insert_bytes_num);
+	v->log_len += n;
 }
 
 void VectorAppend(vector * v, const void * elemAddr)
 {
 	// Append is equal to inserting element to the position - v->log_len
-	VectorInsert(v, elemAddr, v->log_len);
+	VectorInsertRange(v, elemAddr, 1, v->log_len);
+}
+
+void VectorAppendN(vector * v, const void * elemsAddr, int n)
+{
+	// Same goes for appending a range
+	VectorInsertRange(v, elemsAddr, n, v->log_len);
 }
 
 void VectorDelete(vector * v, int position)
+{
+	// Deleting one element is deleting a range of one
+	VectorDeleteRange(v, position, 1);
+}
+
+void VectorDeleteRange(vector * v, int position, int n)
 {
 	// Check all assert conditions
 	assert(v != NULL);
 	assert(v->elems != NULL);
+	assert(n >= 0);
 	assert(position >= 0);
-	assert(position < v->log_len);
+	assert(position <= v->log_len - n);
 	// Asserts checked
 
+	char * delete_ptr = (char *)v->elems + (size_t)position * v->elem_size;
 	if (v->freeFn != NULL)
 	{
-		void * delete_ptr = (char *)v->elems + position * v->elem_size;
-		v->freeFn(delete_ptr);
+		for (int i = 0; i < n; i++)
+			v->freeFn(delete_ptr + (size_t)i * v->elem_size);
 	}
 
-	// Change positions of the elements of -1 after the position of deleted variable
-	for (int i = position; i < v->log_len; i++)
-	{
-		void * dest_ptr = (char *)v->elems + i * v->elem_size; 
-		void * src_ptr = dest_ptr + sizeof(char) * v->elem_size; 
-		memcpy(dest_ptr, src_ptr, v->elem_size); 
-	}
-	v->log_len--;
+	// Move the elements after the deleted ones back over the gap in one go
+	size_t move_bytes_num = (size_t)(v->log_len - position - n) * v->elem_size;
+	memmove(delete_ptr, delete_ptr + (size_t)n * v->elem_size, move_bytes_num);
+	v->log_len -= n;
 }
 
 void VectorSort(vector * v, VectorCompareFunction compare)
@@ -156,6 +213,285 @@ void VectorSort(vector * v, VectorCompareFunction compare)
 	qsort(v->elems, v->log_len, v->elem_size, compare);
 }
 
+/* Below this many elements, sorting on several threads costs more in
+	starting them than it saves, so VectorParallelSort stays on one.  The
+	stable sort insertion sorts blocks of kInsertionSortLen elements before
+	it starts merging. */
+static const int kParallelSortThreshold = 16384;
+static const int kInsertionSortLen = 16;
+
+/* Finds how many of the first k elements of the stable merge of a (m
+	elements long) and b (n long) come from a.  Ties go to a, so a's
+	elements come before equal elements of b. */
+static int MergeSplit(const char * a, int m, const char * b, int n, int k,
+		int elemSize, VectorCompareFunction compare)
+{
+	int low = (k > n) ? k - n : 0, high = (k < m) ? k : m;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (compare(a + (size_t)mid * elemSize, b + (size_t)(k - mid - 1) * elemSize) <= 0) low = mid + 1;
+			else high = mid;
+	}
+	return low;
+}
+
+/* Writes count elements of the stable merge of a and b to out, starting
+	from a's element i and b's element j. */
+static void MergeCount(const char * a, int m, int i, const char * b, int n, int j, char * out, int count,
+		int elemSize, VectorCompareFunction compare)
+{
+	for (; count > 0; count--, out += elemSize)
+	{
+		const char * next;
+		if (j == n || (i < m && compare(a + (size_t)i * elemSize, b + (size_t)j * elemSize) <= 0))
+			next = a + (size_t)i++ * elemSize;
+			else next = b + (size_t)j++ * elemSize;
+		memcpy(out, next, elemSize);
+	}
+}
+
+/* Stable sorts the n elements at base, using the n elements at scratch as
+	room to merge into: insertion sorts short blocks, then merges them in
+	pairs, back and forth between base and scratch. */
+static void StableSort(char * base, char * scratch, int n, int elemSize, VectorCompareFunction compare)
+{
+	char * held = malloc(elemSize);
+	assert(held != NULL);
+	for (int start = 0; start < n; start += kInsertionSortLen)
+	{
+		int end = (n - start < kInsertionSortLen) ? n : start + kInsertionSortLen;
+		for (int i = start + 1; i < end; i++)
+		{
+			int j = i;
+			memcpy(held, base + (size_t)i * elemSize, elemSize);
+			for (; j > start && compare(base + (size_t)(j - 1) * elemSize, held) > 0; j--)
+				memcpy(base + (size_t)j * elemSize, base + (size_t)(j - 1) * elemSize, elemSize);
+			memcpy(base + (size_t)j * elemSize, held, elemSize);
+		}
+	}
+	free(held);
+
+	char * src = base, * dst = scratch;
+	for (int width = kInsertionSortLen; width < n; width *= 2)
+	{
+		for (int start = 0; start < n; start += 2 * width)
+		{
+			int m = (n - start < width) ? n - start : width;
+			int k = (n - start - m < width) ? n - start - m : width;
+			MergeCount(src + (size_t)start * elemSize, m, 0, src + (size_t)(start + m) * elemSize, k, 0,
+				dst + (size_t)start * elemSize, m + k, elemSize, compare);
+		}
+		char * swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != base) memcpy(base, src, (size_t)n * elemSize);
+}
+
+/* The state shared by the threads of a parallel sort.  The elements sit in
+	runs, run r running from bounds[r] up to bounds[r + 1], which every
+	round merges in pairs from src into dst, halving the number of runs. */
+typedef struct
+{
+	char * src;
+	char * dst;
+	int * bounds;
+	int runs;
+	int elem_size;
+	VectorCompareFunction compare;
+	bool stable;
+} SortState;
+
+static void SortRun(int start, int end, int thread, void * auxData)
+{
+	SortState * state = auxData;
+	int lo = state->bounds[thread], n = state->bounds[thread + 1] - lo;
+	char * run = state->src + (size_t)lo * state->elem_size;
+	if (state->stable) StableSort(run, state->dst + (size_t)lo * state->elem_size, n, state->elem_size, state->compare);
+		else qsort(run, n, state->elem_size, state->compare);
+}
+
+/* Each thread writes the part [start, end) of the round's output, which
+	can take in the ends of several pairs of runs, or a piece out of the
+	middle of one.  MergeSplit finds where in the pair that piece starts. */
+static void MergeRound(int start, int end, int thread, void * auxData)
+{
+	SortState * state = auxData;
+	int elem_size = state->elem_size;
+	for (int r = 0; r < state->runs && start < end; r += 2)
+	{
+		// A run left over without a partner is merged with nothing, which copies it
+		int lo = state->bounds[r], mid = state->bounds[r + 1];
+		int hi = (r + 1 < state->runs) ? state->bounds[r + 2] : mid;
+		if (start >= hi) continue;
+
+		int count = ((end < hi) ? end : hi) - start;
+		const char * a = state->src + (size_t)lo * elem_size, * b = state->src + (size_t)mid * elem_size;
+		int i = MergeSplit(a, mid - lo, b, hi - mid, start - lo, elem_size, state->compare);
+		MergeCount(a, mid - lo, i, b, hi - mid, start - lo - i, state->dst + (size_t)start * elem_size, count,
+			elem_size, state->compare);
+		start += count;
+	}
+}
+
+static void CopyRange(int start, int end, int thread, void * auxData)
+{
+	SortState * state = auxData;
+	memcpy(state->dst + (size_t)start * state->elem_size, state->src + (size_t)start * state->elem_size,
+		(size_t)(end - start) * state->elem_size);
+}
+
+void VectorParallelSort(vector * v, VectorCompareFunction compare, int numThreads, bool stable)
+{
+	// Check all assert conditions
+	assert(v != NULL);
+	assert(v->elems != NULL);
+	assert(compare != NULL);
+	assert(numThreads > 0);
+	// Asserts checked
+
+	int n = v->log_len;
+	if (n < 2) return;
+	if (n < kParallelSortThreshold) numThreads = 1;
+	if (numThreads == 1 && !stable)
+	{
+		qsort(v->elems, n, v->elem_size, compare);
+		return;
+	}
+
+	// Split the elements into one run per thread and sort each of them on its own thread
+	SortState state = { v->elems, malloc((size_t)n * v->elem_size), malloc((numThreads + 1) * sizeof(int)),
+		numThreads, v->elem_size, compare, stable };
+	assert(state.dst != NULL && state.bounds != NULL);
+	for (int r = 0; r <= numThreads; r++)
+		state.bounds[r] = (long long)n * r / numThreads;
+	ParallelFor(n, numThreads, SortRun, &state);
+
+	// Then merge the runs in pairs, with all the threads sharing the work of every round
+	while (state.runs > 1)
+	{
+		ParallelFor(n, numThreads, MergeRound, &state);
+		int runs = (state.runs + 1) / 2;
+		for (int r = 0; r < runs; r++)
+			state.bounds[r] = state.bounds[2 * r];
+		state.bounds[runs] = n;
+		state.runs = runs;
+
+		char * swap = state.src;
+		state.src = state.dst;
+		state.dst = swap;
+	}
+
+	// The sorted elements end up in whichever buffer the last round wrote to
+	char * scratch = state.dst;
+	if (state.src != v->elems)
+	{
+		scratch = state.src;
+		state.dst = v->elems;
+		ParallelFor(n, numThreads, CopyRange, &state);
+	}
+	free(scratch);
+	free(state.bounds);
+}
+
+/* The radix sort goes a byte of the key at a time. */
+static const int kRadixBits = 8;
+enum { kRadixBuckets = 256, kRadixMaxPasses = 8 };
+
+/* Reads the keyWidth-byte integer key at keyAddr into a 64-bit unsigned
+	one that orders the same way: the sign bit of a signed key is flipped,
+	so negative keys come first, and a descending key is complemented. */
+static uint64_t RadixKey(const char * keyAddr, int keyWidth, bool isSigned, bool descending)
+{
+	uint64_t key;
+	switch (keyWidth)
+	{
+		case 1: { uint8_t k; memcpy(&k, keyAddr, 1); key = k; break; }
+		case 2: { uint16_t k; memcpy(&k, keyAddr, 2); key = k; break; }
+		case 4: { uint32_t k; memcpy(&k, keyAddr, 4); key = k; break; }
+		default: memcpy(&key, keyAddr, 8); break;
+	}
+
+	int bits = keyWidth * 8;
+	if (isSigned) key ^= (uint64_t)1 << (bits - 1);
+	if (descending) key = ~key;
+	return (bits == 64) ? key : key & (((uint64_t)1 << bits) - 1);
+}
+
+void VectorRadixSort(vector * v, int keyOffset, int keyWidth, bool isSigned, bool descending)
+{
+	// Check all assert conditions
+	assert(v != NULL);
+	assert(v->elems != NULL);
+	assert(keyWidth == 1 || keyWidth == 2 || keyWidth == 4 || keyWidth == 8);
+	assert(keyOffset >= 0);
+	assert(keyOffset + keyWidth <= v->elem_size);
+	// Asserts checked
+
+	int n = v->log_len;
+	if (n < 2) return;
+
+	/* Pull the keys out of the elements once, next to the positions they
+		came from, and count every byte of them in the same pass. */
+	uint64_t * keys = malloc(2 * (size_t)n * sizeof(uint64_t));
+	int * order = malloc(2 * (size_t)n * sizeof(int));
+	int (* counts)[kRadixBuckets] = calloc(kRadixMaxPasses, sizeof(*counts));
+	assert(keys != NULL && order != NULL && counts != NULL);
+	for (int i = 0; i < n; i++)
+	{
+		keys[i] = RadixKey((char *)v->elems + (size_t)i * v->elem_size + keyOffset, keyWidth, isSigned, descending);
+		order[i] = i;
+		for (int pass = 0; pass < keyWidth; pass++)
+			counts[pass][(keys[i] >> (pass * kRadixBits)) & (kRadixBuckets - 1)]++;
+	}
+
+	/* Sort the keys and positions a byte at a time, least significant
+		first, each pass a stable counting sort into the other half of the
+		buffers.  A byte all the keys share can't change the order, and its
+		pass is skipped. */
+	uint64_t * src_keys = keys, * dst_keys = keys + n;
+	int * src_order = order, * dst_order = order + n;
+	for (int pass = 0; pass < keyWidth; pass++)
+	{
+		int shift = pass * kRadixBits;
+		int * count = counts[pass];
+		if (count[(src_keys[0] >> shift) & (kRadixBuckets - 1)] == n) continue;
+
+		for (int digit = 0, start = 0; digit < kRadixBuckets; digit++)
+		{
+			int digit_count = count[digit];
+			count[digit] = start;
+			start += digit_count;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			int slot = count[(src_keys[i] >> shift) & (kRadixBuckets - 1)]++;
+			dst_keys[slot] = src_keys[i];
+			dst_order[slot] = src_order[i];
+		}
+
+		uint64_t * swap_keys = src_keys;
+		src_keys = dst_keys;
+		dst_keys = swap_keys;
+		int * swap_order = src_order;
+		src_order = dst_order;
+		dst_order = swap_order;
+	}
+
+	// Move the elements only once, into new storage in sorted order
+	char * elems = malloc((size_t)v->alloc_len * v->elem_size);
+	assert(elems != NULL);
+	for (int i = 0; i < n; i++)
+		memcpy(elems + (size_t)i * v->elem_size, (char *)v->elems + (size_t)src_order[i] * v->elem_size, v->elem_size);
+	free(v->elems);
+	v->elems = elems;
+
+	free(keys);
+	free(order);
+	free(counts);
+}
+
 void VectorMap(vector * v, VectorMapFunction mapFn, void * auxData)
 {
 	// Check all assert conditions
@@ -208,7 +544,40 @@ void VectorGrow(vector * v)
 	assert(v->elems != NULL);
 	// Asserts checked
 
-	// Double value of alloc_len and realloc elements
-	v->alloc_len *= 2;
-	v->elems = realloc(v->elems, v->alloc_len * v->elem_size);
-}
\ No newline at end of file
+	VectorResize(v, GrownAllocLen(v));
+}
+
+void VectorSetGrowthPolicy(vector * v, double growthFactor, int maxGrowth)
+{
+	// Check all assert conditions
+	assert(v != NULL);
+	assert(growthFactor > 1.0);
+	assert(maxGrowth >= 0);
+	// Asserts checked
+
+	v->growth_factor = growthFactor;
+	v->max_growth = maxGrowth;
+}
+
+void VectorReserve(vector * v, int capacity)
+{
+	// Check all assert conditions
+	assert(v != NULL);
+	assert(v->elems != NULL);
+	assert(capacity >= 0);
+	// Asserts checked
+
+	if (capacity > v->alloc_len) VectorResize(v, capacity);
+}
+
+void VectorShrinkToFit(vector * v)
+{
+	// Check all assert conditions
+	assert(v != NULL);
+	assert(v->elems != NULL);
+	// Asserts checked
+
+	// Keep room for one element, so elems is never a zero-byte allocation
+	int fit = (v->log_len > 0) ? v->log_len : 1;
+	if (fit < v->alloc_len) VectorResize(v, fit);
+}
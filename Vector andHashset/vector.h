@@ -73,6 +73,8 @@ typedef struct
   int elem_size;
   int log_len;
   int alloc_len;
+  double growth_factor;
+  int max_growth;
   void (*freeFn)(void*);
 } vector;
 
@@ -97,23 +99,17 @@ typedef struct
  * NULL for the ArrayFreeFunction if the elements don't require any special handling.
  *
  * The initialAllocation parameter specifies the initial allocated length 
- * of the vector, as well as the dynamic reallocation increment for those times when the 
- * vector needs to grow.  Rather than growing the vector one element at a time as 
- * elements are added (inefficient), you will grow the vector 
- * in chunks of initialAllocation size.  The allocated length is the number
- * of elements for which space has been allocated: the logical length 
- * is the number of those slots currently being used.
+ * of the vector.  The allocated length is the number of elements for which
+ * space has been allocated: the logical length is the number of those slots
+ * currently being used.
  * 
  * A new vector pre-allocates space for initialAllocation elements, but the
  * logical length is zero.  As elements are added, those allocated slots fill
- * up, and when the initial allocation is all used, grow the vector by another 
- * initialAllocation elements.  You will continue growing the vector in chunks
- * like this as needed.  Thus the allocated length will always be a multiple
- * of initialAllocation.  Don't worry about using realloc to shrink the vector's 
- * allocation if a bunch of elements get deleted.  It turns out that 
- * many implementations of realloc don't even pay attention to such a request, 
- * so there is little point in asking.  Just leave the vector over-allocated and no
- * one will care.
+ * up, and when the allocation is all used, the vector grows according to its
+ * growth policy, which doubles the allocated length unless the client picks
+ * another with VectorSetGrowthPolicy.  The vector never shrinks its allocation
+ * on its own when elements get deleted; a client that's done adding to a vector
+ * can hand back the spare slots with VectorShrinkToFit.
  *
  * The initialAllocation is the client's opportunity to tune the resizing
  * behavior for his/her particular needs.  Clients who expect their vectors to
@@ -192,6 +188,32 @@ void VectorInsert(vector * v, const void * elemAddr, int position);
  */
 
 void VectorAppend(vector * v, const void * elemAddr);
+
+/**
+ * Function: VectorInsertRange
+ * ---------------------------
+ * Inserts n new elements into the specified vector, placing the first of
+ * them at the specified position.  The elements are copied from the n
+ * consecutive elements starting at elemsAddr (an array of them, say).
+ * The vector grows at most once and shifts the elements after the position
+ * over just once, however many elements are inserted, so this is much
+ * faster than inserting them one at a time.  An assert is raised if n is
+ * less than 0, if elemsAddr is NULL and n isn't 0, or if position is less
+ * than 0 or greater than the logical length.  elemsAddr mustn't point into
+ * the vector itself.
+ */
+
+void VectorInsertRange(vector * v, const void * elemsAddr, int n, int position);
+
+/**
+ * Function: VectorAppendN
+ * -----------------------
+ * Appends n new elements to the end of the specified vector, copying them
+ * from the n consecutive elements starting at elemsAddr, just as
+ * VectorInsertRange does with the logical length as the position.
+ */
+
+void VectorAppendN(vector * v, const void * elemsAddr, int n);
   
 /**
  * Function: VectorReplace
@@ -223,6 +245,20 @@ void VectorReplace(vector * v, const void * elemAddr, int position);
  */
 
 void VectorDelete(vector * v, int position);
+
+/**
+ * Function: VectorDeleteRange
+ * ---------------------------
+ * Deletes the n elements starting at the specified position from the
+ * vector, calling the VectorFreeFunction on each of them first.  The
+ * elements after them are shifted over to fill the gap just once, so this
+ * runs in time linear in the length of the vector however many elements
+ * are deleted.  An assert is raised if n is less than 0, or if the range
+ * doesn't lie within the vector.  Like VectorDelete, it doesn't shrink the
+ * allocated size of the vector.
+ */
+
+void VectorDeleteRange(vector * v, int position, int n);
   
 /* 
  * Function: VectorSearch
@@ -258,6 +294,51 @@ int VectorSearch(const vector * v, const void * key, VectorCompareFunction searc
 
 void VectorSort(vector *v, VectorCompareFunction comparefn);
 
+/**
+ * Function: VectorParallelSort
+ * ----------------------------
+ * Sorts the vector into ascending order just as VectorSort does, but on
+ * numThreads threads at once: each thread sorts a slice of the vector of
+ * its own, and then all of them share the work of merging the sorted
+ * slices together, pair by pair, in a buffer the size of the vector.
+ * Vectors too short to be worth the threads are sorted on the calling
+ * thread alone.  The comparator is called from all of the threads, and so
+ * must be safe to call concurrently.
+ *
+ * If stable is true, elements the comparator considers equal keep the
+ * order they had before the sort (which VectorSort, built on qsort, doesn't
+ * promise); otherwise their order is unspecified.
+ *
+ * An assert is raised if the comparator is NULL or numThreads isn't
+ * positive.
+ */
+
+void VectorParallelSort(vector *v, VectorCompareFunction comparefn, int numThreads, bool stable);
+
+/**
+ * Function: VectorRadixSort
+ * -------------------------
+ * Sorts the vector by an integer key embedded in every element, without
+ * calling a comparator at all.  The key is the keyWidth-byte integer
+ * (1, 2, 4 or 8 bytes, in the machine's own byte order, like any int
+ * field) keyOffset bytes into each element; offsetof is the natural way
+ * to come up with keyOffset.  isSigned says whether the key is signed,
+ * and descending sorts the largest keys first.  The sort is stable, so
+ * elements with equal keys keep their order, which means sorting by a
+ * secondary key first and then the primary one sorts by both.
+ *
+ * Runs in time linear in the length of the vector: it reads the keys out
+ * once, sorts them a byte at a time (skipping the bytes every key shares),
+ * and then moves each element just once, into new storage, so it needs
+ * that much again in memory while it runs.  For sorts by an int field,
+ * this is much faster than VectorSort.
+ *
+ * An assert is raised if keyWidth isn't 1, 2, 4 or 8, or if the key
+ * doesn't lie within the element.
+ */
+
+void VectorRadixSort(vector *v, int keyOffset, int keyWidth, bool isSigned, bool descending);
+
 /**
  * Method: VectorMap
  * -----------------
@@ -270,6 +351,54 @@ void VectorSort(vector *v, VectorCompareFunction comparefn);
  */
 
 void VectorMap(vector * v, VectorMapFunction mapfn, void * auxData);
+
+/**
+ * Function: VectorSetGrowthPolicy
+ * Usage: VectorSetGrowthPolicy(&postings, 1.5, 0);
+ *        VectorSetGrowthPolicy(&hugeLog, 2.0, 1 << 20);
+ * -------------------------------
+ * Sets how the vector grows once its allocation is full.  The allocated
+ * length is multiplied by growthFactor, but grows by at least one element
+ * and, if maxGrowth is positive, by at most maxGrowth elements, so a vector
+ * doubles while it's small and then grows linearly.  A new vector doubles
+ * with no limit.  A smaller factor or a limit wastes less memory in a large
+ * vector at the cost of more reallocations along the way.
+ *
+ * An assert is raised if growthFactor isn't greater than 1 or maxGrowth is
+ * less than 0.
+ */
+
+void VectorSetGrowthPolicy(vector * v, double growthFactor, int maxGrowth);
+
+/**
+ * Function: VectorGrow
+ * --------------------
+ * Grows the vector's allocation by one step of its growth policy.  The
+ * vector calls this itself whenever it's full, so clients rarely need to.
+ */
+
 void VectorGrow(vector * v);
 
+/**
+ * Function: VectorReserve
+ * -----------------------
+ * Makes sure the vector has room for at least capacity elements, so that
+ * it can grow to that length without any further reallocation.  A client
+ * that knows how many elements are coming should reserve room for them
+ * first.  Does nothing if the allocation is already big enough.  An
+ * assert is raised if capacity is less than 0.
+ */
+
+void VectorReserve(vector * v, int capacity);
+
+/**
+ * Function: VectorShrinkToFit
+ * ---------------------------
+ * Reallocates the vector's storage to hold just its current elements (or
+ * one element, if it's empty), handing the spare slots back.  Like any
+ * reallocation, this invalidates pointers returned by VectorNth.
+ */
+
+void VectorShrinkToFit(vector * v);
+
 #endif
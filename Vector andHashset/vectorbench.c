@@ -0,0 +1,203 @@
+#include "vector.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+/**
+ * File: vectorbench.c
+ * -------------------
+ * Times the vector's sorts against one another on vectors keyed by
+ * integers: VectorSort's qsort, VectorParallelSort and VectorRadixSort.
+ * The length of the vectors can be given on the command line.
+ *
+ *     ./vector-bench [number of elements]
+ *
+ * The elements are pseudo-random, from a fixed seed, so every run sorts
+ * the same vectors.
+ */
+
+static const int kDefaultNumElems = 1000000;
+static const int kNumSortRounds = 3;
+
+static double NowNanoseconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Function: NextRandom
+ * --------------------
+ * A xorshift generator, so the numbers don't depend on the C library's
+ * rand and come 64 bits at a time.
+ */
+
+static uint64_t NextRandom(uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/**
+ * Type: article
+ * -------------
+ * The record rss-news-search keeps for every article a word appears in,
+ * which it sorts by the number of times the word appears, most first.
+ */
+
+typedef struct {
+  const char *title;
+  const char *server_name;
+  const char *url_name;
+  int cnt;
+} article;
+
+static int CompareLong(const void *elem1, const void *elem2)
+{
+  long l1 = *(const long *) elem1, l2 = *(const long *) elem2;
+  return (l1 > l2) - (l1 < l2);
+}
+
+static int CompareCountDescending(const void *elem1, const void *elem2)
+{
+  return ((const article *) elem2)->cnt - ((const article *) elem1)->cnt;
+}
+
+/**
+ * Type: sortSpec, SortMethod
+ * --------------------------
+ * The ways of sorting a vector the benchmarks compare, each of them
+ * handed the vector and a sortSpec describing how its elements are
+ * ordered, both by comparator and by integer key.
+ */
+
+typedef struct {
+  VectorCompareFunction comparefn;
+  int keyOffset;
+  int keyWidth;
+  bool isSigned;
+  bool descending;
+} sortSpec;
+
+typedef void (*SortMethod)(vector *v, const sortSpec *spec);
+
+static void QuickSort(vector *v, const sortSpec *spec)
+{
+  VectorSort(v, spec->comparefn);
+}
+
+static void StableMergeSort(vector *v, const sortSpec *spec)
+{
+  VectorParallelSort(v, spec->comparefn, 1, true);
+}
+
+static void ParallelMergeSort(vector *v, const sortSpec *spec)
+{
+  VectorParallelSort(v, spec->comparefn, ParallelDefaultThreads(), true);
+}
+
+static void RadixSort(vector *v, const sortSpec *spec)
+{
+  VectorRadixSort(v, spec->keyOffset, spec->keyWidth, spec->isSigned, spec->descending);
+}
+
+/**
+ * Function: BenchSort
+ * -------------------
+ * Sorts copies of the unsorted vector with the given method a few times
+ * over, checks that each comes out sorted, and reports the best average
+ * cost per element.
+ */
+
+static void BenchSort(const char *label, SortMethod sortfn, const vector *unsorted, const sortSpec *spec)
+{
+  int n = VectorLength(unsorted);
+  double best = 0;
+  for (int round = 0; round < kNumSortRounds; round++) {
+    vector v;
+    VectorNew(&v, unsorted->elem_size, NULL, n);
+    VectorAppendN(&v, VectorNth(unsorted, 0), n);
+    double start = NowNanoseconds();
+    sortfn(&v, spec);
+    double elapsed = NowNanoseconds() - start;
+    if (round == 0 || elapsed < best) best = elapsed;
+
+    for (int i = 1; i < n; i++)
+      assert(spec->comparefn(VectorNth(&v, i - 1), VectorNth(&v, i)) <= 0);
+    VectorDispose(&v);
+  }
+  printf("  %-28s %7.1f ns per element\n", label, best / n);
+}
+
+static void BenchSorts(const vector *unsorted, const sortSpec *spec)
+{
+  BenchSort("VectorSort", QuickSort, unsorted, spec);
+  BenchSort("VectorParallelSort, 1 thread", StableMergeSort, unsorted, spec);
+  if (ParallelDefaultThreads() > 1)
+    BenchSort("VectorParallelSort, all cpus", ParallelMergeSort, unsorted, spec);
+  BenchSort("VectorRadixSort", RadixSort, unsorted, spec);
+}
+
+/**
+ * Function: BenchLongs
+ * --------------------
+ * Sorts n random longs, spread across the whole range, by value.
+ */
+
+static void BenchLongs(int n)
+{
+  vector longs;
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  VectorNew(&longs, sizeof(long), NULL, n);
+  for (int i = 0; i < n; i++) {
+    long l = (long) NextRandom(&state);
+    VectorAppend(&longs, &l);
+  }
+
+  sortSpec spec = { CompareLong, 0, sizeof(long), true, false };
+  printf("Sorting %d random longs:\n", n);
+  BenchSorts(&longs, &spec);
+  VectorDispose(&longs);
+}
+
+/**
+ * Function: BenchArticles
+ * -----------------------
+ * Sorts n articles by count, most first, the way rss-news-search orders
+ * the articles it finds for a word.  The counts are small, as word counts
+ * are, so there are plenty of ties and only the low bytes of the key vary.
+ */
+
+static const int kMaxArticleCount = 1000;
+static void BenchArticles(int n)
+{
+  vector articles;
+  uint64_t state = 0x2545f4914f6cdd1dULL;
+  VectorNew(&articles, sizeof(article), NULL, n);
+  for (int i = 0; i < n; i++) {
+    article a = { "title", "server", "url", (int) (NextRandom(&state) % kMaxArticleCount) + 1 };
+    VectorAppend(&articles, &a);
+  }
+
+  sortSpec spec = { CompareCountDescending, offsetof(article, cnt), sizeof(int), true, true };
+  printf("Sorting %d articles by count, most first:\n", n);
+  BenchSorts(&articles, &spec);
+  VectorDispose(&articles);
+}
+
+int main(int argc, char **argv)
+{
+  int n = (argc > 1) ? atoi(argv[1]) : kDefaultNumElems;
+  assert(n > 0);
+  BenchLongs(n);
+  BenchArticles(n);
+  return 0;
+}
@@ -1,10 +1,13 @@
 #include "vector.h"
+#include "typedvector.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 
 #define YES_OR_NO(value) (value != 0 ? "Yes" : "No")
@@ -322,6 +325,337 @@ static void ChallengingTest()
   VectorDispose(&lotsOfNumbers);
 }
 
+/**
+ * Function: CountReallocations
+ * ----------------------------
+ * Appends n longs to the vector, checking after every append that the
+ * allocation never grows by more than maxGrowth at a time (when there's
+ * a limit), and returns the number of times the allocation had to grow.
+ */
+
+static int CountReallocations(vector *v, long n, int maxGrowth)
+{
+  int reallocations = 0;
+  for (long i = 0; i < n; i++) {
+    int allocLen = v->alloc_len;
+    VectorAppend(v, &i);
+    if (v->alloc_len != allocLen) {
+      reallocations++;
+      assert(maxGrowth == 0 || v->alloc_len - allocLen <= maxGrowth);
+    }
+  }
+  return reallocations;
+}
+
+/**
+ * Function: GrowthTest
+ * --------------------
+ * Fills vectors with the same numbers under different growth policies,
+ * and checks that reserving room up front means no reallocations at all,
+ * that a gentler policy reallocates more often in exchange for a bound on
+ * the unused part of the allocation, and that shrinking to fit hands back the spare slots
+ * without disturbing the elements.
+ */
+
+static const long kNumGrowthElems = 1000000;
+static const int kLinearGrowth = 65536;
+static void GrowthTest()
+{
+  vector doubling, gentle, linear, reserved;
+  fprintf(stdout, "\n\n------------------------- Starting the growth tests...\n");
+
+  VectorNew(&doubling, sizeof(long), NULL, 0);
+  VectorNew(&gentle, sizeof(long), NULL, 0);
+  VectorSetGrowthPolicy(&gentle, 1.5, 0);
+  VectorNew(&linear, sizeof(long), NULL, 0);
+  VectorSetGrowthPolicy(&linear, 2.0, kLinearGrowth);
+  VectorNew(&reserved, sizeof(long), NULL, 0);
+  VectorReserve(&reserved, kNumGrowthElems);
+  VectorReserve(&reserved, 10);
+  assert(reserved.alloc_len == kNumGrowthElems);
+
+  int doublingReallocs = CountReallocations(&doubling, kNumGrowthElems, 0);
+  int gentleReallocs = CountReallocations(&gentle, kNumGrowthElems, 0);
+  int linearReallocs = CountReallocations(&linear, kNumGrowthElems, kLinearGrowth);
+  assert(CountReallocations(&reserved, kNumGrowthElems, 0) == 0);
+  assert(gentleReallocs > doublingReallocs && linearReallocs > doublingReallocs);
+  assert(doubling.alloc_len < 2 * kNumGrowthElems && gentle.alloc_len < 1.5 * kNumGrowthElems);
+  assert(linear.alloc_len < kNumGrowthElems + kLinearGrowth);
+  fprintf(stdout, "Appending %ld longs took %d reallocations doubling (%d slots), %d growing by half (%d slots), "
+	  "%d doubling up to %d at a time (%d slots), and none after reserving room.\n", kNumGrowthElems,
+	  doublingReallocs, doubling.alloc_len, gentleReallocs, gentle.alloc_len, linearReallocs, kLinearGrowth,
+	  linear.alloc_len);
+
+  VectorShrinkToFit(&doubling);
+  assert(doubling.alloc_len == kNumGrowthElems);
+  for (long i = 0; i < kNumGrowthElems; i++)
+    assert(*(long *) VectorNth(&doubling, i) == i);
+  while (VectorLength(&doubling) > 0) VectorDelete(&doubling, VectorLength(&doubling) - 1);
+  VectorShrinkToFit(&doubling);
+  assert(doubling.alloc_len == 1);
+  long last = kNumGrowthElems;
+  VectorAppend(&doubling, &last);
+  VectorAppend(&doubling, &last);
+  assert(VectorLength(&doubling) == 2 && *(long *) VectorNth(&doubling, 1) == last);
+  fprintf(stdout, "Shrinking to fit, emptying out, shrinking again and refilling all went fine.\n");
+
+  VectorDispose(&doubling);
+  VectorDispose(&gentle);
+  VectorDispose(&linear);
+  VectorDispose(&reserved);
+}
+
+/**
+ * Function: CountFree
+ * -------------------
+ * Free function for vectors of ints that just counts the elements it's
+ * handed, in the global below.
+ */
+
+static int numFreed;
+static void CountFree(void *elemAddr)
+{
+  numFreed++;
+}
+
+/**
+ * Function: RangeTest
+ * -------------------
+ * Builds a vector of ints in chunks with VectorAppendN, splices a block
+ * into the middle of it and then one onto the front with
+ * VectorInsertRange, and deletes ranges from the middle, the front and
+ * the end with VectorDeleteRange, checking the contents after every step
+ * and that each deleted element was freed exactly once.
+ */
+
+static const int kNumRangeInts = 100000;
+static const int kRangeChunk = 777;
+static void RangeTest()
+{
+  vector ints;
+  int chunk[kRangeChunk];
+  fprintf(stdout, "\n\n------------------------- Starting the range tests...\n");
+  VectorNew(&ints, sizeof(int), CountFree, 0);
+
+  for (int start = 0; start < kNumRangeInts; start += kRangeChunk) {
+    int n = (kNumRangeInts - start < kRangeChunk) ? kNumRangeInts - start : kRangeChunk;
+    for (int i = 0; i < n; i++) chunk[i] = start + i;
+    VectorAppendN(&ints, chunk, n);
+  }
+  VectorAppendN(&ints, NULL, 0);
+  assert(VectorLength(&ints) == kNumRangeInts);
+  for (int i = 0; i < kNumRangeInts; i++) assert(*(int *) VectorNth(&ints, i) == i);
+
+  for (int i = 0; i < kRangeChunk; i++) chunk[i] = -i;
+  VectorInsertRange(&ints, chunk, kRangeChunk, kNumRangeInts / 2);
+  VectorInsertRange(&ints, chunk, kRangeChunk, 0);
+  assert(VectorLength(&ints) == kNumRangeInts + 2 * kRangeChunk);
+  for (int i = 0; i < VectorLength(&ints); i++) {
+    int expected = (i < kRangeChunk) ? -i : i - kRangeChunk;
+    if (i >= kRangeChunk + kNumRangeInts / 2) expected = (i < 2 * kRangeChunk + kNumRangeInts / 2) ?
+      -(i - kRangeChunk - kNumRangeInts / 2) : i - 2 * kRangeChunk;
+    assert(*(int *) VectorNth(&ints, i) == expected);
+  }
+  fprintf(stdout, "Appended %d ints in chunks of %d and spliced in two more chunks.\n", kNumRangeInts, kRangeChunk);
+
+  numFreed = 0;
+  VectorDeleteRange(&ints, kRangeChunk + kNumRangeInts / 2, kRangeChunk);
+  VectorDeleteRange(&ints, 0, kRangeChunk);
+  VectorDeleteRange(&ints, 10, 0);
+  assert(numFreed == 2 * kRangeChunk && VectorLength(&ints) == kNumRangeInts);
+  for (int i = 0; i < kNumRangeInts; i++) assert(*(int *) VectorNth(&ints, i) == i);
+  VectorDeleteRange(&ints, kNumRangeInts - kRangeChunk, kRangeChunk);
+  VectorDeleteRange(&ints, 100, kNumRangeInts - 2 * kRangeChunk);
+  assert(VectorLength(&ints) == kRangeChunk && numFreed == kNumRangeInts + kRangeChunk);
+  for (int i = 0; i < kRangeChunk; i++)
+    assert(*(int *) VectorNth(&ints, i) == (i < 100 ? i : i - 100 + kNumRangeInts - 2 * kRangeChunk + 100));
+  fprintf(stdout, "Deleted ranges from the middle, the front and the end, and freed each element once.\n");
+
+  VectorDispose(&ints);
+  assert(numFreed == kNumRangeInts + 2 * kRangeChunk);
+}
+
+/**
+ * Function: TypedTest
+ * -------------------
+ * Fills a vector of longs through the typed functions DEFINE_TYPED_VECTOR
+ * generates, inserting at the front, the middle and the end, and checks
+ * that the plain vector functions see the same elements and vice versa:
+ * that VectorSort and VectorSearch work on it, and LongVectorGet sees
+ * what they leave behind.
+ */
+
+DEFINE_TYPED_VECTOR(LongVector, long)
+
+static const int kNumTypedLongs = 100000;
+static void TypedTest()
+{
+  vector longs;
+  fprintf(stdout, "\n\n------------------------- Starting the typed vector tests...\n");
+  LongVectorNew(&longs, NULL, 0);
+  for (long i = 1; i < kNumTypedLongs - 1; i++)
+    LongVectorAppend(&longs, kNumTypedLongs - 1 - i);
+  LongVectorInsert(&longs, kNumTypedLongs - 1, 0);
+  LongVectorInsert(&longs, 0, LongVectorLength(&longs));
+  assert(LongVectorLength(&longs) == kNumTypedLongs && VectorLength(&longs) == kNumTypedLongs);
+  for (int i = 0; i < kNumTypedLongs; i++)
+    assert(LongVectorGet(&longs, i) == *(long *) VectorNth(&longs, i) && LongVectorGet(&longs, i) == kNumTypedLongs - 1 - i);
+
+  VectorSort(&longs, LongCompare);
+  long middle = kNumTypedLongs / 2;
+  LongVectorInsert(&longs, middle, middle);
+  int found = VectorSearch(&longs, &middle, LongCompare, 0, true);
+  assert(found == middle || found == middle + 1);
+  for (int i = 0; i < LongVectorLength(&longs); i++)
+    assert(*LongVectorNth(&longs, i) == i - (i > middle));
+  fprintf(stdout, "Built, sorted and searched %d longs through both the typed and the plain functions.\n",
+	  LongVectorLength(&longs));
+  VectorDispose(&longs);
+}
+
+/**
+ * Function: CompareKeys
+ * ---------------------
+ * Orders keyedInts by key alone, ignoring the sequence numbers, so that
+ * plenty of them compare equal.
+ */
+
+typedef struct {
+  int key;
+  int seq;
+} keyedInt;
+
+static int CompareKeys(const void *elemA, const void *elemB)
+{
+  return ((const keyedInt *) elemA)->key - ((const keyedInt *) elemB)->key;
+}
+
+/**
+ * Function: ParallelSortTest
+ * --------------------------
+ * Sorts vectors of keyedInts, numbered in the order they're appended and
+ * with only a few hundred distinct keys among them, on various numbers of
+ * threads, both stably and not, and checks that they come out sorted,
+ * that no element went missing, and that the stable sorts kept equal keys
+ * in their original order.  The short vectors are sorted on one thread
+ * whatever it's asked, and the empty one isn't sorted at all.
+ */
+
+static const int kParallelSortLengths[] = { 0, 1, 1000, 16384, 300007 };
+static const int kParallelSortThreads[] = { 1, 3, 8 };
+static const int kNumKeys = 397;
+static void ParallelSortTest()
+{
+  fprintf(stdout, "\n\n------------------------- Starting the parallel sort tests...\n");
+  for (int l = 0; l < sizeof(kParallelSortLengths) / sizeof(kParallelSortLengths[0]); l++) {
+    for (int t = 0; t < sizeof(kParallelSortThreads) / sizeof(kParallelSortThreads[0]); t++) {
+      for (int stable = 0; stable <= 1; stable++) {
+	vector keyed;
+	int n = kParallelSortLengths[l];
+	VectorNew(&keyed, sizeof(keyedInt), NULL, n);
+	for (int i = 0; i < n; i++) {
+	  keyedInt elem = { (int) ((long) i * kLargePrime % kNumKeys), i };
+	  VectorAppend(&keyed, &elem);
+	}
+
+	VectorParallelSort(&keyed, CompareKeys, kParallelSortThreads[t], stable);
+	long seqSum = 0;
+	for (int i = 0; i < n; i++) {
+	  const keyedInt *elem = VectorNth(&keyed, i);
+	  seqSum += elem->seq;
+	  if (i == 0) continue;
+	  const keyedInt *prev = VectorNth(&keyed, i - 1);
+	  assert(prev->key <= elem->key);
+	  assert(!stable || prev->key < elem->key || prev->seq < elem->seq);
+	}
+	assert(VectorLength(&keyed) == n && seqSum == (long) n * (n - 1) / 2);
+	VectorDispose(&keyed);
+      }
+      fprintf(stdout, "Sorted %d elements on %d thread%s, stably and not.\n", kParallelSortLengths[l],
+	      kParallelSortThreads[t], kParallelSortThreads[t] == 1 ? "" : "s");
+    }
+  }
+}
+
+/**
+ * Function: RadixCompare
+ * ----------------------
+ * Compares the width-byte integer keys at offset into two elements the
+ * same way VectorRadixSort is asked to order them, widened to long longs
+ * (when they're signed) or unsigned long longs, so keys of all widths
+ * can be compared the same way.  Returns -1, 0 or 1, like strcmp.
+ */
+
+typedef struct {
+  int8_t tiny;
+  uint16_t small;
+  int32_t medium;
+  uint64_t large;
+  int64_t signedLarge;
+  int seq;
+} radixElem;
+
+static int RadixCompare(const radixElem *elemA, const radixElem *elemB, int offset, int width, bool isSigned)
+{
+  const char *a = (const char *) elemA + offset, *b = (const char *) elemB + offset;
+  long long signedA, signedB;
+  unsigned long long unsignedA, unsignedB;
+  switch (width) {
+    case 1: signedA = *(int8_t *) a; signedB = *(int8_t *) b; unsignedA = *(uint8_t *) a; unsignedB = *(uint8_t *) b; break;
+    case 2: signedA = *(int16_t *) a; signedB = *(int16_t *) b; unsignedA = *(uint16_t *) a; unsignedB = *(uint16_t *) b; break;
+    case 4: signedA = *(int32_t *) a; signedB = *(int32_t *) b; unsignedA = *(uint32_t *) a; unsignedB = *(uint32_t *) b; break;
+    default: signedA = *(int64_t *) a; signedB = *(int64_t *) b; unsignedA = *(uint64_t *) a; unsignedB = *(uint64_t *) b; break;
+  }
+  if (isSigned) return (signedA > signedB) - (signedA < signedB);
+  return (unsignedA > unsignedB) - (unsignedA < unsignedB);
+}
+
+/**
+ * Function: RadixSortTest
+ * -----------------------
+ * Radix sorts vectors of structs by each of their integer fields in turn,
+ * as signed and unsigned keys, ascending and descending, and checks that
+ * each comes out in order with equal keys still in the order they were
+ * appended, and that no element went missing.  The keys are pseudo-random
+ * and include negative ones, and the 64-bit ones only vary in a few of
+ * their bytes, so some of the radix passes get skipped.
+ */
+
+static const int kNumRadixElems = 100003;
+static void RadixSortTest()
+{
+  const int kOffsets[] = { offsetof(radixElem, tiny), offsetof(radixElem, small), offsetof(radixElem, medium),
+			   offsetof(radixElem, large), offsetof(radixElem, signedLarge) };
+  const int kWidths[] = { 1, 2, 4, 8, 8 };
+  fprintf(stdout, "\n\n------------------------- Starting the radix sort tests...\n");
+  for (int f = 0; f < sizeof(kOffsets) / sizeof(kOffsets[0]); f++) {
+    for (int flags = 0; flags < 4; flags++) {
+      bool isSigned = flags & 1, descending = flags & 2;
+      vector elems;
+      VectorNew(&elems, sizeof(radixElem), NULL, kNumRadixElems);
+      for (int i = 0; i < kNumRadixElems; i++) {
+	long r = (long) i * kLargePrime % kEvenLargerPrime;
+	radixElem elem = { r, r * 7, r * 1000 - 1500000000, (uint64_t) (r % 5000) << 40, (r - 1500000) * (1L << 20), i };
+	VectorAppend(&elems, &elem);
+      }
+
+      VectorRadixSort(&elems, kOffsets[f], kWidths[f], isSigned, descending);
+      long seqSum = ((radixElem *) VectorNth(&elems, 0))->seq;
+      for (int i = 1; i < kNumRadixElems; i++) {
+	const radixElem *prev = VectorNth(&elems, i - 1), *elem = VectorNth(&elems, i);
+	int cmp = RadixCompare(prev, elem, kOffsets[f], kWidths[f], isSigned);
+	assert(descending ? cmp >= 0 : cmp <= 0);
+	assert(cmp != 0 || prev->seq < elem->seq);
+	seqSum += elem->seq;
+      }
+      assert(seqSum == (long) kNumRadixElems * (kNumRadixElems - 1) / 2);
+      VectorDispose(&elems);
+    }
+    fprintf(stdout, "Radix sorted %d elements by %d-byte keys, signed and unsigned, ascending and descending.\n",
+	    kNumRadixElems, kWidths[f]);
+  }
+}
+
 /** 
  * Function: FreeString
  * --------------------
@@ -405,6 +739,11 @@ int main(int ignored, char **alsoIgnored)
 {
   SimpleTest();
   ChallengingTest();
+  GrowthTest();
+  RangeTest();
+  TypedTest();
+  ParallelSortTest();
+  RadixSortTest();
   MemoryTest();
   return 0;
 }